@@ -10,6 +10,7 @@
 %define memory_map                  0x5000
 %define local_apic_address          0x6000
 %define active_cpu_count            0x6008
+%define cpu_blocks                  0x6100
 %define boot_sector_base            0x7c00
 %define temp_sector                 0x7e00
 %define loader_base                 0x8000
@@ -473,6 +473,41 @@ ap64:
         ; Setup interrupt table
         lidt [idt.desc]
 
+        ; Enable SSE and AVX state as CpuInit does on the BSP
+        xor eax, eax
+        cpuid
+        mov r9d, eax                ; Largest standard function
+
+        mov eax, 0x01
+        cpuid
+        mov r8d, ecx
+
+        test edx, 1 << 26           ; SSE2
+        jz .no_sse
+        mov rax, cr0
+        and al, ~0x04               ; Clear EM
+        or al, 0x02                 ; Set MP
+        mov cr0, rax
+        mov rax, cr4
+        or eax, 0x0600              ; Set OSFXSR and OSXMMEXCPT
+        mov cr4, rax
+.no_sse:
+
+        mov eax, r8d
+        and eax, (1 << 26) | (1 << 28)
+        cmp eax, (1 << 26) | (1 << 28)
+        jne .no_avx                 ; XSAVE and AVX both needed
+        cmp r9d, 0x07
+        jb .no_avx
+        mov rax, cr4
+        or eax, 0x40000             ; Set OSXSAVE
+        mov cr4, rax
+        mov eax, 0x07               ; XCR0 enables x87, SSE and AVX state
+        xor edx, edx
+        xor ecx, ecx
+        xsetbv
+.no_avx:
+
         ; Enable Local APIC
         mov rsi, [local_apic_address]
         add rsi, 0x00f0             ; Spurious Interrupt Vector
@@ -484,9 +519,20 @@ ap64:
         ; Enable interrupts
         sti
 
-        ; Mark CPU as active
+        ; Mark CPU as active, taking the previous count as this CPU's index
+        mov al, 1
         lock
-        inc byte [active_cpu_count]
+        xadd [active_cpu_count], al
+
+        ; Per-CPU block at the GS base holds the index, see SmpCpuIndex
+        movzx eax, al
+        lea rdi, [cpu_blocks + rax * 8]
+        mov [rdi], rax
+        mov rax, rdi
+        mov rdx, rdi
+        shr rdx, 32
+        mov ecx, 0xc0000101         ; IA32_GS_BASE
+        wrmsr
 
         ; Sleep CPU
 .sleep:
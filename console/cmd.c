@@ -7,9 +7,16 @@
 #include "cpu/detect.h"
 #include "cpu/io.h"
 #include "gfx/gfx.h"
+#include "net/arp.h"
+#include "net/bond.h"
+#include "net/capture.h"
 #include "net/dns.h"
+#include "net/gro.h"
 #include "net/icmp.h"
+#include "net/intel.h"
 #include "net/ipv4.h"
+#include "net/latency.h"
+#include "net/loopback.h"
 #include "net/net.h"
 #include "net/ntp.h"
 #include "net/port.h"
@@ -17,11 +24,120 @@
 #include "net/route.h"
 #include "net/tcp.h"
 #include "net/udp.h"
+#include "net/xdp.h"
 #include "stdlib/format.h"
 #include "stdlib/string.h"
 #include "time/pit.h"
 #include "time/rtc.h"
 
+// ------------------------------------------------------------------------------------------------
+static void CmdBond(uint argc, const char **argv)
+{
+    if (argc == 1)
+    {
+        BondPrint();
+        return;
+    }
+
+    uint mode = ~0u;
+    if (argc >= 4)
+    {
+        if (strcmp(argv[2], "rr") == 0)
+        {
+            mode = BOND_MODE_ROUND_ROBIN;
+        }
+        else if (strcmp(argv[2], "hash") == 0)
+        {
+            mode = BOND_MODE_HASH;
+        }
+    }
+
+    if (mode == ~0u || argc - 3 > BOND_MAX_PORTS)
+    {
+        ConsolePrint("Usage: bond [<name> rr|hash <port>...]\n");
+        return;
+    }
+
+    NetIntf *ports[BOND_MAX_PORTS];
+    uint portCount = argc - 3;
+    for (uint i = 0; i < portCount; ++i)
+    {
+        ports[i] = NetIntfFind(argv[3 + i]);
+        if (!ports[i])
+        {
+            ConsolePrint("Unknown interface %s\n", argv[3 + i]);
+            return;
+        }
+    }
+
+    if (!BondCreate(argv[1], mode, ports, portCount))
+    {
+        ConsolePrint("Failed to create %s\n", argv[1]);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void CmdCapture(uint argc, const char **argv)
+{
+    if (argc == 1)
+    {
+        CapturePrint();
+        return;
+    }
+
+    const char *op = argv[1];
+
+    if (strcmp(op, "start") == 0 && argc <= 4)
+    {
+        // Optional interface and snapshot length, in either order
+        NetIntf *intf = 0;
+        uint snapLen = CAPTURE_DEFAULT_SNAPLEN;
+
+        for (uint i = 2; i < argc; ++i)
+        {
+            if (sscanf(argv[i], "%d", &snapLen) != 1)
+            {
+                intf = NetIntfFind(argv[i]);
+                if (!intf)
+                {
+                    ConsolePrint("Unknown interface %s\n", argv[i]);
+                    return;
+                }
+            }
+        }
+
+        CaptureStart(intf, snapLen);
+    }
+    else if (strcmp(op, "stop") == 0 && argc == 2)
+    {
+        CaptureStop();
+    }
+    else if (strcmp(op, "filter") == 0)
+    {
+        BpfInsn prog[BPF_COMPILE_MAX];
+        uint count = 0;
+
+        if (argc > 2)
+        {
+            count = BpfCompile(prog, argc - 2, argv + 2);
+            if (!count)
+            {
+                ConsolePrint("Unknown filter\n");
+                return;
+            }
+        }
+
+        CaptureSetFilter(prog, count);
+    }
+    else
+    {
+        ConsolePrint("Usage: capture [start [interface] [snaplen] | stop | filter [expression]]\n");
+        return;
+    }
+
+    CapturePrint();
+}
+
 // ------------------------------------------------------------------------------------------------
 static void CmdDateTime(uint argc, const char **argv)
 {
@@ -111,35 +227,63 @@ static void HttpOnTcpData(TcpConn *conn, const u8 *data, uint len)
     }
 }
 
-static void CmdHttp(uint argc, const char **argv)
+static void HttpOnResolve(void *ctx, const char *host, const Ipv4Addr *addr)
 {
-    if (argc != 3)
+    if (!addr)
     {
-        ConsolePrint("Usage: http <dest ipv4 address> <path>\n");
+        ConsolePrint("Failed to resolve %s\n", host);
         return;
     }
 
-    Ipv4Addr dstAddr;
-    if (!StrToIpv4Addr(&dstAddr, argv[1]))
+    u16 port = 80;
+
+    TcpConn *conn = TcpCreate();
+    conn->ctx = ctx;
+    conn->onState = HttpOnTcpState;
+    conn->onData = HttpOnTcpData;
+
+    TcpConnect(conn, addr, port);
+}
+
+static void CmdHttp(uint argc, const char **argv)
+{
+    if (argc != 3)
     {
-        ConsolePrint("Failed to parse destination address\n");
+        ConsolePrint("Usage: http <dest host or ipv4 address> <path>\n");
         return;
     }
 
-    u16 port = 80;
     static char buf[256];
 
     snprintf(buf, sizeof(buf), "GET %s HTTP/1.0\r\n\r\n", argv[2]);
 
-    TcpConn *conn = TcpCreate();
-    conn->ctx = buf;
-    conn->onState = HttpOnTcpState;
-    conn->onData = HttpOnTcpData;
-
-    TcpConnect(conn, &dstAddr, port);
+    Ipv4Addr dstAddr;
+    if (StrToIpv4Addr(&dstAddr, argv[1]))
+    {
+        HttpOnResolve(buf, argv[1], &dstAddr);
+    }
+    else
+    {
+        DnsResolve(argv[1], HttpOnResolve, buf);
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
+static void HostOnResolve(void *ctx, const char *host, const Ipv4Addr *addr)
+{
+    if (addr)
+    {
+        char addrStr[IPV4_ADDR_STRING_SIZE];
+        Ipv4AddrToStr(addrStr, sizeof(addrStr), addr);
+
+        ConsolePrint("%s has address %s\n", host, addrStr);
+    }
+    else
+    {
+        ConsolePrint("Host %s not found\n", host);
+    }
+}
+
 static void CmdHost(uint argc, const char **argv)
 {
     if (argc != 2)
@@ -150,7 +294,50 @@ static void CmdHost(uint argc, const char **argv)
 
     const char *hostName = argv[1];
 
-    DnsQueryHost(hostName, 0);
+    DnsResolve(hostName, HostOnResolve, 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void CmdIfStat(uint argc, const char **argv)
+{
+    // Deltas are since the previous ifstat of the same interface
+    if (argc == 2)
+    {
+        NetIntf *intf = NetIntfFind(argv[1]);
+        if (!intf)
+        {
+            ConsolePrint("Unknown interface %s\n", argv[1]);
+            return;
+        }
+
+        NetIntfPrintStats(intf);
+    }
+    else if (argc == 1)
+    {
+        NetIntf *intf;
+        ListForEach(intf, g_netIntfList, link)
+        {
+            NetIntfPrintStats(intf);
+        }
+
+        NetPrintDrops();
+    }
+    else
+    {
+        ConsolePrint("Usage: ifstat [interface]\n");
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void CmdLsArp(uint argc, const char **argv)
+{
+    ArpPrintCache();
+}
+
+// ------------------------------------------------------------------------------------------------
+static void CmdLsDns(uint argc, const char **argv)
+{
+    DnsPrintCache();
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -186,7 +373,99 @@ static void CmdLsRoute(uint argc, const char **argv)
 // ------------------------------------------------------------------------------------------------
 static void CmdMem(uint argc, const char **argv)
 {
-    ConsolePrint("net buf: %d\n", g_netBufAllocCount);
+    NetPrintBufStats();
+}
+
+// ------------------------------------------------------------------------------------------------
+static void CmdMtu(uint argc, const char **argv)
+{
+    if (argc == 3)
+    {
+        NetIntf *intf = NetIntfFind(argv[1]);
+        uint mtu;
+
+        if (!intf)
+        {
+            ConsolePrint("Unknown interface %s\n", argv[1]);
+        }
+        else if (sscanf(argv[2], "%d", &mtu) != 1 || !NetIntfSetMtu(intf, mtu))
+        {
+            ConsolePrint("Invalid MTU for %s\n", intf->name);
+        }
+    }
+    else if (argc != 1)
+    {
+        ConsolePrint("Usage: mtu [interface mtu]\n");
+        return;
+    }
+
+    NetIntf *intf;
+    ListForEach(intf, g_netIntfList, link)
+    {
+        ConsolePrint("%-8s mtu %u\n", intf->name, intf->mtu);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void CmdNetGro(uint argc, const char **argv)
+{
+    GroPrint();
+}
+
+// ------------------------------------------------------------------------------------------------
+static void CmdNetIntr(uint argc, const char **argv)
+{
+    if (argc == 4)
+    {
+        uint itr, rdtr, radv;
+        if (sscanf(argv[1], "%d", &itr) == 1 &&
+            sscanf(argv[2], "%d", &rdtr) == 1 &&
+            sscanf(argv[3], "%d", &radv) == 1)
+        {
+            EthIntelSetModeration(itr, rdtr, radv);
+        }
+    }
+    else if (argc != 1)
+    {
+        ConsolePrint("Usage: net_intr [<itr us> <rdtr us> <radv us>]\n");
+        return;
+    }
+
+    EthIntelPrintIntr();
+}
+
+// ------------------------------------------------------------------------------------------------
+static void CmdNetLat(uint argc, const char **argv)
+{
+    if (argc == 1)
+    {
+        LatencyPrint();
+    }
+    else if (argc == 2 && strcmp(argv[1], "reset") == 0)
+    {
+        LatencyReset();
+    }
+    else if (argc != 2 || !LatencyPrintStage(argv[1]))
+    {
+        ConsolePrint("Usage: net_lat [reset|<stage>]\n");
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void CmdNetLoop(uint argc, const char **argv)
+{
+    if (argc == 3 && strcmp(argv[1], "csum") == 0 &&
+        (strcmp(argv[2], "on") == 0 || strcmp(argv[2], "off") == 0))
+    {
+        LoopbackSetCsumOffload(strcmp(argv[2], "off") == 0);
+    }
+    else if (argc != 1)
+    {
+        ConsolePrint("Usage: net_loop [csum on|off]\n");
+        return;
+    }
+
+    LoopbackPrint();
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -243,6 +522,25 @@ static void CmdSyncTime(uint argc, const char **argv)
     NtpSend(&dstAddr);
 }
 
+// ------------------------------------------------------------------------------------------------
+static void CmdPromisc(uint argc, const char **argv)
+{
+    if (argc != 3 || (strcmp(argv[2], "on") != 0 && strcmp(argv[2], "off") != 0))
+    {
+        ConsolePrint("Usage: promisc <interface> on|off\n");
+        return;
+    }
+
+    NetIntf *intf = NetIntfFind(argv[1]);
+    if (!intf)
+    {
+        ConsolePrint("Unknown interface %s\n", argv[1]);
+        return;
+    }
+
+    NetIntfSetPromisc(intf, strcmp(argv[2], "on") == 0);
+}
+
 // ------------------------------------------------------------------------------------------------
 static void CmdReboot(uint argc, const char **argv)
 {
@@ -296,9 +594,73 @@ static void CmdPoke(uint argc, const char **argv)
     *addr = value;
 }
 
+// ------------------------------------------------------------------------------------------------
+static void CmdXdp(uint argc, const char **argv)
+{
+    if (argc == 1)
+    {
+        XdpPrint();
+        return;
+    }
+
+    NetIntf *intf = argc >= 3 ? NetIntfFind(argv[1]) : 0;
+    const char *op = argc >= 3 ? argv[2] : "";
+
+    if (argc >= 3 && !intf)
+    {
+        ConsolePrint("Unknown interface %s\n", argv[1]);
+        return;
+    }
+
+    if (strcmp(op, "off") == 0 && argc == 3)
+    {
+        XdpDetach(intf);
+    }
+    else if (strcmp(op, "drop") == 0 && argc > 3)
+    {
+        BpfInsn prog[BPF_COMPILE_MAX];
+        uint count = BpfCompile(prog, argc - 3, argv + 3);
+        if (!count)
+        {
+            ConsolePrint("Unknown filter\n");
+            return;
+        }
+
+        if (!XdpAttachFilter(intf, prog, count))
+        {
+            ConsolePrint("Too many filters\n");
+            return;
+        }
+    }
+    else if (strcmp(op, "echo") == 0 && argc == 3)
+    {
+        XdpAttachEcho(intf);
+    }
+    else if (strcmp(op, "redirect") == 0 && argc == 4)
+    {
+        NetIntf *target = NetIntfFind(argv[3]);
+        if (!target)
+        {
+            ConsolePrint("Unknown interface %s\n", argv[3]);
+            return;
+        }
+
+        XdpAttachRedirect(intf, target);
+    }
+    else
+    {
+        ConsolePrint("Usage: xdp [<interface> off | drop <expression> | echo | redirect <interface>]\n");
+        return;
+    }
+
+    XdpPrint();
+}
+
 // ------------------------------------------------------------------------------------------------
 const ConsoleCmd g_consoleCmdTable[] =
 {
+    { "bond", CmdBond },
+    { "capture", CmdCapture },
     { "datetime", CmdDateTime },
     { "detect", CmdDetect },
     { "echo", CmdEcho },
@@ -307,16 +669,26 @@ const ConsoleCmd g_consoleCmdTable[] =
     { "help", CmdHelp },
     { "host", CmdHost },
     { "http", CmdHttp },
+    { "ifstat", CmdIfStat },
+    { "lsarp", CmdLsArp },
     { "lsconn", CmdLsConn },
+    { "lsdns", CmdLsDns },
     { "lsroute", CmdLsRoute },
     { "mem", CmdMem },
+    { "mtu", CmdMtu },
+    { "net_gro", CmdNetGro },
+    { "net_intr", CmdNetIntr },
+    { "net_lat", CmdNetLat },
+    { "net_loop", CmdNetLoop },
     { "net_trace", CmdNetTrace },
     { "ping", CmdPing },
+    { "promisc", CmdPromisc },
     { "reboot", CmdReboot },
     { "rlog", CmdRlog },
     { "synctime", CmdSyncTime },
     { "ticks", CmdTicks },
     { "peek", CmdPeek },
     { "poke", CmdPoke },
+    { "xdp", CmdXdp },
     { 0, 0 },
 };
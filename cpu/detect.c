@@ -4,6 +4,7 @@
 
 #include "cpu/detect.h"
 #include "console/console.h"
+#include "cpu/smp.h"
 
 // ------------------------------------------------------------------------------------------------
 // Function 0x01
@@ -68,6 +69,24 @@
 #define EDX_TM                          (1 << 29)   // Thermal Monitor
 #define EDX_PBE                         (1 << 31)   // Pending Break Enable
 
+// ------------------------------------------------------------------------------------------------
+// Function 0x07
+
+#define EBX_AVX2                        (1 << 5)    // Advanced Vector Extensions 2
+
+// ------------------------------------------------------------------------------------------------
+// Control Registers
+
+#define CR0_MP                          (1 << 1)    // Monitor Coprocessor
+#define CR0_EM                          (1 << 2)    // x87 Emulation
+#define CR4_OSFXSR                      (1 << 9)    // FXSAVE/FXRSTOR and SSE enabled
+#define CR4_OSXMMEXCPT                  (1 << 10)   // Unmasked SIMD exceptions raise #XM
+#define CR4_OSXSAVE                     (1 << 18)   // XSAVE and XCR0 enabled
+
+#define XCR0_X87                        (1 << 0)
+#define XCR0_SSE                        (1 << 1)
+#define XCR0_AVX                        (1 << 2)
+
 // ------------------------------------------------------------------------------------------------
 // Extended Function 0x01
 
@@ -77,12 +96,66 @@
 #define EDX_RDTSCP                      (1 << 27)   // RDTSCP and IA32_TSC_AUX
 #define EDX_64_BIT                      (1 << 29)   // 64-bit Architecture
 
+// ------------------------------------------------------------------------------------------------
+// Globals
+
+uint g_cpuFeatures;
+
 // ------------------------------------------------------------------------------------------------
 static inline void cpuid(u32 reg, u32 *eax, u32 *ebx, u32 *ecx, u32 *edx)
 {
+    // Sub-leaf 0 for functions that take one
     __asm__ volatile("cpuid"
         : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
-        : "0" (reg));
+        : "0" (reg), "2" (0));
+}
+
+// ------------------------------------------------------------------------------------------------
+void CpuInit()
+{
+    u32 eax, ebx, ecx, edx;
+
+    u32 largestStandardFunc;
+    cpuid(0, &largestStandardFunc, &ebx, &ecx, &edx);
+    cpuid(0x01, &eax, &ebx, &ecx, &edx);
+
+    // Application processors repeat this setup in boot/loader.asm before they idle
+
+    // Per-CPU state is indexed through the GS base, the boot processor is CPU 0
+    SmpSetCpuIndex(0);
+
+    // SSE state is saved with FXSAVE, never emulated
+    if (edx & EDX_SSE2)
+    {
+        u64 cr0, cr4;
+        __asm__ volatile("mov %%cr0, %0" : "=r" (cr0));
+        __asm__ volatile("mov %%cr4, %0" : "=r" (cr4));
+
+        cr0 = (cr0 & ~CR0_EM) | CR0_MP;
+        cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+
+        __asm__ volatile("mov %0, %%cr0" : : "r" (cr0));
+        __asm__ volatile("mov %0, %%cr4" : : "r" (cr4));
+
+        g_cpuFeatures |= CPU_FEATURE_SSE2;
+    }
+
+    // AVX registers are only usable once XCR0 enables their state
+    if ((ecx & ECX_XSAVE) && (ecx & ECX_AVX) && largestStandardFunc >= 0x07)
+    {
+        u64 cr4;
+        __asm__ volatile("mov %%cr4, %0" : "=r" (cr4));
+        __asm__ volatile("mov %0, %%cr4" : : "r" (cr4 | CR4_OSXSAVE));
+
+        u32 xcr0 = XCR0_X87 | XCR0_SSE | XCR0_AVX;
+        __asm__ volatile("xsetbv" : : "a" (xcr0), "d" (0), "c" (0));
+
+        cpuid(0x07, &eax, &ebx, &ecx, &edx);
+        if (ebx & EBX_AVX2)
+        {
+            g_cpuFeatures |= CPU_FEATURE_AVX2;
+        }
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -6,4 +6,16 @@
 
 #include "stdlib/types.h"
 
+// ------------------------------------------------------------------------------------------------
+// Features selected at runtime
+
+#define CPU_FEATURE_SSE2                0x01
+#define CPU_FEATURE_AVX2                0x02
+
+extern uint g_cpuFeatures;
+
+// ------------------------------------------------------------------------------------------------
+// Functions
+
+void CpuInit();
 void CpuDetect();
@@ -8,6 +8,13 @@
 #include "intr/local_apic.h"
 #include "time/pit.h"
 
+// ------------------------------------------------------------------------------------------------
+// Per-CPU Blocks - one u64 index each, the current CPU's found through its GS base.
+// boot/loader.asm sets up the same layout for the application processors.
+
+#define SMP_CPU_BLOCKS                  0x6100      // cpu_blocks in boot/defines.asm
+#define IA32_GS_BASE                    0xc0000101
+
 // ------------------------------------------------------------------------------------------------
 void SmpInit()
 {
@@ -49,3 +56,23 @@ void SmpInit()
 
     ConsolePrint("All CPUs activated\n");
 }
+
+// ------------------------------------------------------------------------------------------------
+void SmpSetCpuIndex(uint index)
+{
+    volatile u64 *block = (volatile u64 *)SMP_CPU_BLOCKS + index;
+    *block = index;
+
+    u64 base = (uintptr_t)block;
+    __asm__ volatile("wrmsr" : : "c" (IA32_GS_BASE), "a" ((u32)base), "d" ((u32)(base >> 32)));
+}
+
+// ------------------------------------------------------------------------------------------------
+uint SmpCpuIndex()
+{
+    // Dense index of the current CPU for per-CPU state, read without touching the local APIC.
+    // The boot CPU is 0 and application processors follow in the order they started.
+    uint index;
+    __asm__ volatile("mov %%gs:0, %0" : "=r" (index));
+    return index;
+}
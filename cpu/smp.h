@@ -9,3 +9,5 @@
 extern volatile u8 g_activeCpuCount;
 
 void SmpInit();
+void SmpSetCpuIndex(uint index);
+uint SmpCpuIndex();
@@ -0,0 +1,34 @@
+// ------------------------------------------------------------------------------------------------
+// cpu/spinlock.h
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "stdlib/types.h"
+
+// ------------------------------------------------------------------------------------------------
+// Spin Lock
+
+typedef struct SpinLock
+{
+    volatile u32 locked;
+} SpinLock;
+
+// ------------------------------------------------------------------------------------------------
+static inline void SpinLockAcquire(SpinLock *lock)
+{
+    // Spin on a plain read so waiters do not bounce the cache line
+    while (__sync_lock_test_and_set(&lock->locked, 1))
+    {
+        while (lock->locked)
+        {
+            __asm__ volatile("pause");
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static inline void SpinLockRelease(SpinLock *lock)
+{
+    __sync_lock_release(&lock->locked);
+}
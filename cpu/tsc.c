@@ -0,0 +1,50 @@
+// ------------------------------------------------------------------------------------------------
+// cpu/tsc.c
+// ------------------------------------------------------------------------------------------------
+
+#include "cpu/tsc.h"
+#include "console/console.h"
+#include "time/pit.h"
+
+// ------------------------------------------------------------------------------------------------
+// Globals
+
+u64 g_tscHz;
+
+// ------------------------------------------------------------------------------------------------
+
+#define TSC_CALIBRATE_MS                50
+
+// ------------------------------------------------------------------------------------------------
+void TscInit()
+{
+    // Count cycles across whole PIT periods, starting on a tick edge
+    u32 start = g_pitTicks;
+    while (g_pitTicks == start)
+    {
+        ;
+    }
+
+    start = g_pitTicks;
+    u64 tscStart = TscRead();
+
+    while (g_pitTicks - start < TSC_CALIBRATE_MS)
+    {
+        ;
+    }
+
+    g_tscHz = (TscRead() - tscStart) * (1000 / TSC_CALIBRATE_MS);
+
+    ConsolePrint("TSC: %u MHz\n", (uint)(g_tscHz / 1000000));
+}
+
+// ------------------------------------------------------------------------------------------------
+u64 TscCyclesToNs(u64 cycles)
+{
+    if (!g_tscHz)
+    {
+        return 0;
+    }
+
+    return cycles * 1000000 / (g_tscHz / 1000);
+}
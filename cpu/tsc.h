@@ -0,0 +1,26 @@
+// ------------------------------------------------------------------------------------------------
+// cpu/tsc.h
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "stdlib/types.h"
+
+// ------------------------------------------------------------------------------------------------
+// Globals
+
+extern u64 g_tscHz;     // Time stamp counter frequency, 0 until calibrated
+
+// ------------------------------------------------------------------------------------------------
+// Functions
+
+void TscInit();
+u64 TscCyclesToNs(u64 cycles);
+
+// ------------------------------------------------------------------------------------------------
+static inline u64 TscRead()
+{
+    u32 lo, hi;
+    __asm__ volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((u64)hi << 32) | lo;
+}
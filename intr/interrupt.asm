@@ -5,12 +5,14 @@
 [GLOBAL default_exception_handler]
 [GLOBAL default_interrupt_handler]
 [GLOBAL exception_handlers]
+[GLOBAL irq_handlers]
 [GLOBAL pit_interrupt]
 [GLOBAL spurious_interrupt]
 
 [EXTERN g_pitTicks]
 [EXTERN g_localApicAddr]
 [EXTERN ExceptionDump]
+[EXTERN IntrDispatch]
 
 ; -------------------------------------------------------------------------------------------------
 ; Default handlers
@@ -95,6 +97,125 @@ exception_body:
 
         jmp $
 
+; -------------------------------------------------------------------------------------------------
+; Device interrupt handlers - vectors INT_DEVICE_BASE onwards
+
+%macro make_irq_handler 1
+irq%1_handler:
+        push byte %1
+        jmp irq_body
+%endmacro
+
+make_irq_handler 0
+make_irq_handler 1
+make_irq_handler 2
+make_irq_handler 3
+make_irq_handler 4
+make_irq_handler 5
+make_irq_handler 6
+make_irq_handler 7
+make_irq_handler 8
+make_irq_handler 9
+make_irq_handler 10
+make_irq_handler 11
+make_irq_handler 12
+make_irq_handler 13
+make_irq_handler 14
+make_irq_handler 15
+make_irq_handler 16
+make_irq_handler 17
+make_irq_handler 18
+make_irq_handler 19
+make_irq_handler 20
+make_irq_handler 21
+make_irq_handler 22
+make_irq_handler 23
+make_irq_handler 24
+make_irq_handler 25
+make_irq_handler 26
+make_irq_handler 27
+make_irq_handler 28
+make_irq_handler 29
+make_irq_handler 30
+make_irq_handler 31
+
+irq_handlers:
+        dq irq0_handler
+        dq irq1_handler
+        dq irq2_handler
+        dq irq3_handler
+        dq irq4_handler
+        dq irq5_handler
+        dq irq6_handler
+        dq irq7_handler
+        dq irq8_handler
+        dq irq9_handler
+        dq irq10_handler
+        dq irq11_handler
+        dq irq12_handler
+        dq irq13_handler
+        dq irq14_handler
+        dq irq15_handler
+        dq irq16_handler
+        dq irq17_handler
+        dq irq18_handler
+        dq irq19_handler
+        dq irq20_handler
+        dq irq21_handler
+        dq irq22_handler
+        dq irq23_handler
+        dq irq24_handler
+        dq irq25_handler
+        dq irq26_handler
+        dq irq27_handler
+        dq irq28_handler
+        dq irq29_handler
+        dq irq30_handler
+        dq irq31_handler
+
+irq_body:
+        push rax
+        push rcx
+        push rdx
+        push rsi
+        push rdi
+        push r8
+        push r9
+        push r10
+        push r11
+
+        ; Compiled code uses SSE registers, including the checksum routines the handlers
+        ; interrupt.  Legacy SSE leaves the upper AVX halves alone, so FXSAVE covers it.
+        ; The save area keeps the stack 16-byte aligned for FXSAVE and the call.
+        sub rsp, 520
+        fxsave [rsp]
+
+        ; Dispatch with the handler index
+        mov rdi, [rsp + 592]
+        cld
+        call IntrDispatch
+
+        ; Acknowledge interrupt
+        mov rdi, [g_localApicAddr]
+        add rdi, 0xb0
+        xor eax, eax
+        stosd
+
+        fxrstor [rsp]
+        add rsp, 520
+
+        pop r11
+        pop r10
+        pop r9
+        pop r8
+        pop rdi
+        pop rsi
+        pop rdx
+        pop rcx
+        pop rax
+        add rsp, 8
+        iretq
+
 ; -------------------------------------------------------------------------------------------------
 ; Prints a string to the screen
 ; in: rdi = screen address
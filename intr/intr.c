@@ -10,9 +10,29 @@
 #include "acpi/acpi.h"
 #include "time/pit.h"
 
+// ------------------------------------------------------------------------------------------------
+// I/O APIC Redirection Entry
+
+#define IOAPIC_ACTIVE_LOW               (1 << 13)
+#define IOAPIC_LEVEL                    (1 << 15)
+#define IOAPIC_DESTINATION_SHIFT        56
+
+// ------------------------------------------------------------------------------------------------
+typedef struct IntrEntry
+{
+    IntrHandler handler;
+    void *ctx;
+} IntrEntry;
+
+static IntrEntry s_intrEntries[INT_DEVICE_COUNT];
+static uint s_intrCount;
+
 // ------------------------------------------------------------------------------------------------
 extern void pit_interrupt();
 extern void spurious_interrupt();
+extern void (*irq_handlers[INT_DEVICE_COUNT])();
+
+void IntrDispatch(uint index);
 
 // ------------------------------------------------------------------------------------------------
 void IntrInit()
@@ -22,6 +42,11 @@ void IntrInit()
     IdtSetHandler(INT_TIMER, INTERRUPT_GATE, pit_interrupt);
     IdtSetHandler(INT_SPURIOUS, INTERRUPT_GATE, spurious_interrupt);
 
+    for (uint i = 0; i < INT_DEVICE_COUNT; ++i)
+    {
+        IdtSetHandler(INT_DEVICE_BASE + i, INTERRUPT_GATE, irq_handlers[i]);
+    }
+
     // Initialize subsystems
     PicInit();
     LocalApicInit();
@@ -34,3 +59,38 @@ void IntrInit()
     // Enable all interrupts
     __asm__ volatile("sti");
 }
+
+// ------------------------------------------------------------------------------------------------
+void IntrDispatch(uint index)
+{
+    IntrEntry *entry = &s_intrEntries[index];
+    if (entry->handler)
+    {
+        entry->handler(entry->ctx);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+uint IntrAlloc(IntrHandler handler, void *ctx)
+{
+    if (s_intrCount == INT_DEVICE_COUNT)
+    {
+        return 0;
+    }
+
+    IntrEntry *entry = &s_intrEntries[s_intrCount];
+    entry->ctx = ctx;
+    entry->handler = handler;
+
+    return INT_DEVICE_BASE + s_intrCount++;
+}
+
+// ------------------------------------------------------------------------------------------------
+void IntrRouteIrq(uint irq, uint vector)
+{
+    // PCI interrupts are level triggered. Without the ACPI routing tables only the legacy
+    // line from configuration space is known, which firmware such as QEMU reports as active high.
+    u64 dest = (u64)LocalApicGetId() << IOAPIC_DESTINATION_SHIFT;
+
+    IoApicSetEntry(g_ioApicAddr, AcpiRemapIrq(irq), dest | IOAPIC_LEVEL | vector);
+}
@@ -18,7 +18,15 @@
 #define IRQ_ATA1                        0x0f
 
 #define INT_TIMER                       0x20
+#define INT_DEVICE_BASE                 0x30        // Vectors handed out by IntrAlloc
+#define INT_DEVICE_COUNT                32
 #define INT_SPURIOUS                    0xff
 
+// ------------------------------------------------------------------------------------------------
+typedef void (*IntrHandler)(void *ctx);
+
 // ------------------------------------------------------------------------------------------------
 void IntrInit();
+
+uint IntrAlloc(IntrHandler handler, void *ctx);
+void IntrRouteIrq(uint irq, uint vector);
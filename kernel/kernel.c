@@ -4,7 +4,9 @@
 
 #include "acpi/acpi.h"
 #include "console/console.h"
+#include "cpu/detect.h"
 #include "cpu/smp.h"
+#include "cpu/tsc.h"
 #include "gfx/gfx.h"
 #include "gfx/vga.h"
 #include "intr/intr.h"
@@ -27,9 +29,11 @@ int kmain()
     ConsoleInit();
     ConsolePrint("Welcome!\n");
 
+    CpuInit();
     VMInit();
     AcpiInit();
     IntrInit();
+    TscInit();
     PciInit();
     NetInit();
     SmpInit();
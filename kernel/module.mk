@@ -7,6 +7,7 @@ KERNEL_SOURCES := \
 	console/cmd.c \
 	cpu/detect.c \
 	cpu/smp.c \
+	cpu/tsc.c \
 	gfx/gfx.c \
 	gfx/gfxdisplay.c \
 	gfx/gfxmem.c \
@@ -26,16 +27,22 @@ KERNEL_SOURCES := \
 	mem/vm.c \
 	net/addr.c \
 	net/arp.c \
+	net/bond.c \
+	net/bpf.c \
 	net/buf.c \
+	net/capture.c \
 	net/checksum.c \
 	net/dhcp.c \
 	net/dns.c \
 	net/eth.c \
+	net/gro.c \
+	net/gso.c \
 	net/icmp.c \
 	net/intel.c \
 	net/intf.c \
 	net/ipv4.c \
 	net/ipv6.c \
+	net/latency.c \
 	net/loopback.c \
 	net/net.c \
 	net/ntp.c \
@@ -44,6 +51,8 @@ KERNEL_SOURCES := \
 	net/route.c \
 	net/tcp.c \
 	net/udp.c \
+	net/virtio.c \
+	net/xdp.c \
 	pci/driver.c \
 	pci/pci.c \
 	pci/registry.c \
@@ -82,12 +91,21 @@ kernel/kernel.bin: $(KERNEL_OBJECTS) kernel/linker.ld
 SOURCES += \
 	console/console_mock.c \
 	console/console_test.c \
+	net/bpf_test.c \
+	net/checksum_test.c \
+	net/port_test.c \
+	net/sim.c \
+	net/sim_test.c \
 	net/tcp_test.c \
 	stdlib/format_test.c \
 	stdlib/string_test.c
 
 TESTS += \
 	console/console_test.exe \
+	net/bpf_test.exe \
+	net/checksum_test.exe \
+	net/port_test.exe \
+	net/sim_test.exe \
 	net/tcp_test.exe \
 	stdlib/format_test.exe \
 	stdlib/string_test.exe \
@@ -95,10 +113,12 @@ TESTS += \
 	stdlib/string_test_native.exe
 
 TCP_TEST_SOURCES := \
+	cpu/tsc.c \
 	net/addr.c \
 	net/buf.c \
 	net/checksum.c \
 	net/intf.c \
+	net/latency.c \
 	net/port.c \
 	net/route.c \
 	net/tcp.c \
@@ -106,9 +126,47 @@ TCP_TEST_SOURCES := \
 	test/test.c \
 	time/time.c
 
+SIM_TEST_SOURCES := \
+	cpu/tsc.c \
+	net/addr.c \
+	net/arp.c \
+	net/buf.c \
+	net/checksum.c \
+	net/dns.c \
+	net/eth.c \
+	net/gro.c \
+	net/gso.c \
+	net/icmp.c \
+	net/intf.c \
+	net/ipv4.c \
+	net/ipv6.c \
+	net/latency.c \
+	net/port.c \
+	net/route.c \
+	net/sim.c \
+	net/sim_test.c \
+	net/tcp.c \
+	net/udp.c \
+	stdlib/format.c \
+	stdlib/string.c \
+	test/test.c \
+	time/time.c
+
 console/console_test.exe: test/test.test.o console/console_test.test.o console/console.test.o
 	$(CC) -o $@ $^
 
+net/bpf_test.exe: test/test.test.o net/bpf_test.test.o net/bpf.test.o net/addr.test.o stdlib/format.test.o stdlib/string.test.o
+	$(CC) -o $@ $^
+
+net/checksum_test.exe: test/test.test.o net/checksum_test.test.o net/checksum.test.o
+	$(CC) -o $@ $^
+
+net/port_test.exe: test/test.test.o net/port_test.test.o net/port.test.o
+	$(CC) -o $@ $^
+
+net/sim_test.exe: $(SIM_TEST_SOURCES:.c=.test.o)
+	$(CC) -o $@ $^
+
 net/tcp_test.exe: $(TCP_TEST_SOURCES:.c=.test.o)
 	$(CC) -o $@ $^
 
@@ -10,6 +10,7 @@
 #include "net/swap.h"
 #include "console/console.h"
 #include "stdlib/string.h"
+#include "time/pit.h"
 
 // ------------------------------------------------------------------------------------------------
 // ARP Protocol
@@ -20,20 +21,49 @@
 
 // ------------------------------------------------------------------------------------------------
 // ARP Cache
-#define ARP_CACHE_SIZE      16
+
+#define ARP_FREE            0
+#define ARP_INCOMPLETE      1       // Resolution in progress
+#define ARP_REACHABLE       2       // Confirmed within ARP_REACHABLE_TIME
+#define ARP_PROBE           3       // Unicast refresh in progress, address usable until it fails
+#define ARP_STALE           4       // Unconfirmed, address still usable until next probe
 
 typedef struct ArpEntry
 {
+    Link hashLink;
+    Link lruLink;
+    uint state;
+
     EthAddr ha;
     Ipv4Addr pa;
-
-    // deferred packet to send
     NetIntf *intf;
+
+    // timers
+    u32 updated;                        // when was the mapping last confirmed?
+    u32 used;                           // when was the mapping last used?
+    u32 probed;                         // when was the last request sent?
+    uint probes;                        // requests sent without a reply
+
+    // deferred packets to send, oldest first
     u16 etherType;
-    NetBuf *pkt;
+    Link pending;
+    uint pendingCount;
 } ArpEntry;
 
-static ArpEntry s_arpCache[ARP_CACHE_SIZE];
+static ArpEntry s_arpEntries[ARP_CACHE_SIZE];
+static Link s_arpHash[ARP_HASH_SIZE];
+static Link s_arpLru;                   // least recently used first
+static Link s_arpFree;
+static u32 s_arpNextPoll;
+
+static const char *s_arpStateStrs[] =
+{
+    "FREE",
+    "INCOMPLETE",
+    "REACHABLE",
+    "PROBE",
+    "STALE",
+};
 
 // ------------------------------------------------------------------------------------------------
 static void ArpPrint(const NetBuf *pkt)
@@ -131,12 +161,22 @@ static void ArpSend(NetIntf *intf, uint op, const EthAddr *tha, const Ipv4Addr *
     intf->send(intf, tha, ET_ARP, pkt);
 }
 
+// ------------------------------------------------------------------------------------------------
+static uint ArpHash(const Ipv4Addr *pa)
+{
+    u32 h = pa->u.bits;
+    h ^= h >> 16;
+    h ^= h >> 8;
+    return h & (ARP_HASH_SIZE - 1);
+}
+
 // ------------------------------------------------------------------------------------------------
 static ArpEntry *ArpLookup(const Ipv4Addr *pa)
 {
-    ArpEntry *entry = s_arpCache;
-    ArpEntry *end = entry + ARP_CACHE_SIZE;
-    for (; entry != end; ++entry)
+    Link *bucket = &s_arpHash[ArpHash(pa)];
+
+    ArpEntry *entry;
+    ListForEach(entry, *bucket, hashLink)
     {
         if (Ipv4AddrEq(&entry->pa, pa))
         {
@@ -148,51 +188,142 @@ static ArpEntry *ArpLookup(const Ipv4Addr *pa)
 }
 
 // ------------------------------------------------------------------------------------------------
-static ArpEntry *ArpAdd(const EthAddr *ha, const Ipv4Addr *pa)
+static void ArpDropPending(ArpEntry *entry)
 {
-    // TODO - handle overflow
-    ArpEntry *entry = s_arpCache;
-    ArpEntry *end = entry + ARP_CACHE_SIZE;
-    for (; entry != end; ++entry)
+    // Packets still waiting for the address have nowhere to go
+    NetBuf *pkt;
+    NetBuf *next;
+    ListForEachSafe(pkt, next, entry->pending, link)
     {
-        if (!entry->pa.u.bits)
-        {
-            break;
-        }
+        LinkRemove(&pkt->link);
+        NetReleaseBuf(pkt);
+        NetIntfDrop(entry->intf, NET_DROP_NO_DEST);
     }
 
-    if (entry != end)
+    entry->pendingCount = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void ArpFree(ArpEntry *entry)
+{
+    ArpDropPending(entry);
+
+    entry->state = ARP_FREE;
+    LinkRemove(&entry->hashLink);
+    LinkMoveBefore(&s_arpFree, &entry->lruLink);
+}
+
+// ------------------------------------------------------------------------------------------------
+static ArpEntry *ArpAdd(NetIntf *intf, const EthAddr *ha, const Ipv4Addr *pa, uint state)
+{
+    // Reuse the least recently used entry if the cache is full
+    if (ListIsEmpty(&s_arpFree))
     {
-        entry->ha = *ha;
-        entry->pa = *pa;
-        return entry;
+        ArpEntry *victim = LinkData(s_arpLru.next, ArpEntry, lruLink);
+        ArpFree(victim);
     }
 
-    ConsolePrint("Ran out of ARP entries\n");
-    return 0;
+    ArpEntry *entry = LinkData(s_arpFree.next, ArpEntry, lruLink);
+    LinkMoveBefore(&s_arpLru, &entry->lruLink);
+    LinkBefore(&s_arpHash[ArpHash(pa)], &entry->hashLink);
+
+    entry->state = state;
+    entry->ha = *ha;
+    entry->pa = *pa;
+    entry->intf = intf;
+    entry->updated = g_pitTicks;
+    entry->used = g_pitTicks;
+    entry->probed = 0;
+    entry->probes = 0;
+    entry->etherType = 0;
+    LinkInit(&entry->pending);
+    entry->pendingCount = 0;
+
+    return entry;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void ArpConfirm(ArpEntry *entry, NetIntf *intf, const EthAddr *ha)
+{
+    entry->ha = *ha;
+    entry->intf = intf;
+    entry->state = ARP_REACHABLE;
+    entry->updated = g_pitTicks;
+    entry->probes = 0;
+
+    if (ListIsEmpty(&entry->pending))
+    {
+        return;
+    }
+
+    // Detach the whole queue first so the sends below see an empty entry
+    Link batch;
+    LinkInit(&batch);
+    LinkAfter(&entry->pending, &batch);
+    LinkRemove(&entry->pending);
+    LinkInit(&entry->pending);
+    entry->pendingCount = 0;
+
+    // Send deferred packets in order
+    NetBuf *pkt;
+    NetBuf *next;
+    ListForEachSafe(pkt, next, batch, link)
+    {
+        LinkRemove(&pkt->link);
+        EthSendIntf(intf, &entry->pa, entry->etherType, pkt);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void ArpProbe(ArpEntry *entry)
+{
+    // Unicast request to the cached address; the mapping stays usable meanwhile.
+    entry->state = ARP_PROBE;
+    entry->probed = g_pitTicks;
+    ++entry->probes;
+    ArpSend(entry->intf, ARP_OP_REQUEST, &entry->ha, &entry->pa);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void ArpResolve(ArpEntry *entry)
+{
+    entry->probed = g_pitTicks;
+    ++entry->probes;
+    ArpSend(entry->intf, ARP_OP_REQUEST, &g_broadcastEthAddr, &entry->pa);
 }
 
 // ------------------------------------------------------------------------------------------------
 void ArpRequest(NetIntf *intf, const Ipv4Addr *tpa, u16 etherType, NetBuf *pkt)
 {
     ArpEntry *entry = ArpLookup(tpa);
+    bool resolve = false;
     if (!entry)
     {
-        entry = ArpAdd(&g_nullEthAddr, tpa);
+        entry = ArpAdd(intf, &g_nullEthAddr, tpa, ARP_INCOMPLETE);
+        resolve = true;
     }
 
-    if (entry)
+    // Queue packet until the address is resolved, dropping the oldest on overflow
+    if (entry->pendingCount == ARP_MAX_PENDING)
     {
-        // Drop any packet already queued
-        if (entry->pkt)
-        {
-            NetReleaseBuf(entry->pkt);
-        }
+        NetIntfDrop(intf, NET_DROP_ARP_OVERFLOW);
+
+        NetBuf *oldest = LinkData(entry->pending.next, NetBuf, link);
+        LinkRemove(&oldest->link);
+        NetReleaseBuf(oldest);
+        --entry->pendingCount;
+    }
 
-        entry->intf = intf;
-        entry->etherType = etherType;
-        entry->pkt = pkt;
-        ArpSend(intf, ARP_OP_REQUEST, &g_broadcastEthAddr, tpa);
+    LinkBefore(&entry->pending, &pkt->link);
+    ++entry->pendingCount;
+
+    entry->intf = intf;
+    entry->etherType = etherType;
+
+    // Further requests are sent by ArpPoll at ARP_RETRANS_TIME intervals
+    if (resolve)
+    {
+        ArpResolve(entry);
     }
 }
 
@@ -206,12 +337,92 @@ void ArpReply(NetIntf *intf, const EthAddr *tha, const Ipv4Addr *tpa)
 void ArpInit()
 {
     // Clear cache of all entries
-    ArpEntry *entry = s_arpCache;
+    LinkInit(&s_arpLru);
+    LinkInit(&s_arpFree);
+
+    for (uint i = 0; i < ARP_HASH_SIZE; ++i)
+    {
+        LinkInit(&s_arpHash[i]);
+    }
+
+    ArpEntry *entry = s_arpEntries;
     ArpEntry *end = entry + ARP_CACHE_SIZE;
     for (; entry != end; ++entry)
     {
-        memset(&entry->ha, 0, sizeof(EthAddr));
-        memset(&entry->pa, 0, sizeof(Ipv4Addr));
+        memset(entry, 0, sizeof(ArpEntry));
+        LinkInit(&entry->hashLink);
+        LinkBefore(&s_arpFree, &entry->lruLink);
+    }
+
+    s_arpNextPoll = g_pitTicks + ARP_POLL_INTERVAL;
+}
+
+// ------------------------------------------------------------------------------------------------
+void ArpPoll()
+{
+    if ((int)(g_pitTicks - s_arpNextPoll) < 0)
+    {
+        return;
+    }
+
+    s_arpNextPoll = g_pitTicks + ARP_POLL_INTERVAL;
+
+    ArpEntry *entry;
+    ArpEntry *next;
+    ListForEachSafe(entry, next, s_arpLru, lruLink)
+    {
+        u32 age = g_pitTicks - entry->updated;
+        bool retrans = g_pitTicks - entry->probed >= ARP_RETRANS_TIME;
+
+        switch (entry->state)
+        {
+        case ARP_INCOMPLETE:
+            // Retransmit request, giving up and dropping the queue after too many
+            if (retrans)
+            {
+                if (entry->probes < ARP_MAX_PROBES)
+                {
+                    ArpResolve(entry);
+                }
+                else
+                {
+                    ArpFree(entry);
+                }
+            }
+            break;
+
+        case ARP_REACHABLE:
+            // Unconfirmed mapping becomes stale
+            if (age >= ARP_REACHABLE_TIME)
+            {
+                entry->state = ARP_STALE;
+            }
+            break;
+
+        case ARP_PROBE:
+            // A neighbor that stops answering is forgotten, so the next send resolves afresh
+            // instead of going to a dead address
+            if (retrans)
+            {
+                if (entry->probes < ARP_MAX_PROBES)
+                {
+                    ArpProbe(entry);
+                }
+                else
+                {
+                    ArpFree(entry);
+                }
+            }
+            break;
+
+        case ARP_STALE:
+            // Flush entries that have not been used for a long time
+            if (g_pitTicks - entry->used >= ARP_STALE_TIME)
+            {
+                ArpFree(entry);
+            }
+            break;
+        }
     }
 }
 
@@ -219,12 +430,23 @@ void ArpInit()
 const EthAddr *ArpLookupEthAddr(const Ipv4Addr *pa)
 {
     ArpEntry *entry = ArpLookup(pa);
-    if (entry)
+    if (!entry || entry->state == ARP_INCOMPLETE)
     {
-        return &entry->ha;
+        return 0;
     }
 
-    return 0;
+    // Mark as recently used
+    entry->used = g_pitTicks;
+    LinkMoveBefore(&s_arpLru, &entry->lruLink);
+
+    // Refresh mapping before it expires so hot destinations never stall
+    if (entry->state == ARP_STALE ||
+        (entry->state == ARP_REACHABLE && g_pitTicks - entry->updated >= ARP_REFRESH_TIME))
+    {
+        ArpProbe(entry);
+    }
+
+    return &entry->ha;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -235,6 +457,7 @@ void ArpRecv(NetIntf *intf, NetBuf *pkt)
     // Decode Header
     if (pkt->start + sizeof(ArpHeader) > pkt->end)
     {
+        NetIntfDrop(intf, NET_DROP_HEADER);
         return;
     }
 
@@ -248,6 +471,7 @@ void ArpRecv(NetIntf *intf, NetBuf *pkt)
     // Skip packets that are not Ethernet, IPv4, or well-formed
     if (htype != ARP_HTYPE_ETH || ptype != ET_IPV4 || pkt->start + 28 > pkt->end)
     {
+        NetIntfDrop(intf, NET_DROP_HEADER);
         return;
     }
 
@@ -262,18 +486,8 @@ void ArpRecv(NetIntf *intf, NetBuf *pkt)
     ArpEntry *entry = ArpLookup(spa);
     if (entry)
     {
-        entry->ha = *sha;
+        ArpConfirm(entry, intf, sha);
         merge = true;
-
-        // Send deferred packet
-        if (entry->pkt)
-        {
-            EthSendIntf(entry->intf, spa, entry->etherType, entry->pkt);
-
-            entry->intf = 0;
-            entry->etherType = 0;
-            entry->pkt = 0;
-        }
     }
 
     // Check if this ARP packet is targeting our IP
@@ -282,7 +496,7 @@ void ArpRecv(NetIntf *intf, NetBuf *pkt)
         // Add a new entry if we didn't update earlier.
         if (!merge)
         {
-            ArpAdd(sha, spa);
+            ArpAdd(intf, sha, spa, ARP_REACHABLE);
         }
 
         // Respond to requests.
@@ -292,3 +506,22 @@ void ArpRecv(NetIntf *intf, NetBuf *pkt)
         }
     }
 }
+
+// ------------------------------------------------------------------------------------------------
+void ArpPrintCache()
+{
+    ConsolePrint("%-15s  %-17s  %-10s  %s\n", "Address", "HW Address", "State", "Age");
+
+    ArpEntry *entry;
+    ListForEach(entry, s_arpLru, lruLink)
+    {
+        char haStr[ETH_ADDR_STRING_SIZE];
+        char paStr[IPV4_ADDR_STRING_SIZE];
+
+        EthAddrToStr(haStr, sizeof(haStr), &entry->ha);
+        Ipv4AddrToStr(paStr, sizeof(paStr), &entry->pa);
+
+        ConsolePrint("%-15s  %-17s  %-10s  %u\n",
+            paStr, haStr, s_arpStateStrs[entry->state], g_pitTicks - entry->updated);
+    }
+}
@@ -7,6 +7,21 @@
 #include "net/addr.h"
 #include "net/intf.h"
 
+// ------------------------------------------------------------------------------------------------
+// Configuration
+
+#define ARP_CACHE_SIZE          256         // Maximum number of neighbor entries
+#define ARP_HASH_SIZE           64          // Hash buckets (power of 2)
+
+#define ARP_REACHABLE_TIME      60000       // Time an entry is valid after confirmation (ms)
+#define ARP_REFRESH_TIME        45000       // Age at which a used entry is refreshed (ms)
+#define ARP_STALE_TIME          300000      // Time an unused stale entry is kept (ms)
+#define ARP_POLL_INTERVAL       100         // Time between cache aging scans (ms)
+
+#define ARP_RETRANS_TIME        1000        // Minimum time between requests for an entry (ms)
+#define ARP_MAX_PROBES          3           // Requests sent before giving up
+#define ARP_MAX_PENDING         16          // Packets queued per unresolved entry
+
 // ------------------------------------------------------------------------------------------------
 // ARP Header
 
@@ -23,9 +38,12 @@ typedef struct ArpHeader
 // Functions
 
 void ArpInit();
+void ArpPoll();
 
 const EthAddr *ArpLookupEthAddr(const Ipv4Addr *pa);
 void ArpRequest(NetIntf *intf, const Ipv4Addr *tpa, u16 etherType, NetBuf *pkt);
 void ArpReply(NetIntf *intf, const EthAddr *tha, const Ipv4Addr *tpa);
 
 void ArpRecv(NetIntf *intf, NetBuf *pkt);
+
+void ArpPrintCache();
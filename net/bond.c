@@ -0,0 +1,259 @@
+// ------------------------------------------------------------------------------------------------
+// net/bond.c
+// ------------------------------------------------------------------------------------------------
+
+#include "net/bond.h"
+#include "net/dhcp.h"
+#include "net/eth.h"
+#include "console/console.h"
+#include "mem/vm.h"
+#include "stdlib/string.h"
+
+// ------------------------------------------------------------------------------------------------
+// Aggregate State
+
+typedef struct Bond
+{
+    Link link;
+    NetIntf *intf;
+    char name[BOND_NAME_SIZE];
+    uint mode;
+    uint next;                          // next port for round robin
+
+    NetIntf *ports[BOND_MAX_PORTS];
+    uint txPackets[BOND_MAX_PORTS];
+    uint portCount;
+} Bond;
+
+static Link s_bonds = { &s_bonds, &s_bonds };
+
+static const char *s_modeStrs[] =
+{
+    "round-robin",
+    "hash",
+};
+
+// ------------------------------------------------------------------------------------------------
+static void BondPoll(NetIntf *intf)
+{
+    Bond *bond = intf->dev;
+
+    for (uint i = 0; i < bond->portCount; ++i)
+    {
+        NetIntf *port = bond->ports[i];
+        port->poll(port);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void BondSend(NetIntf *intf, NetBuf *buf)
+{
+    Bond *bond = intf->dev;
+
+    uint i;
+    if (bond->mode == BOND_MODE_HASH)
+    {
+        i = EthFlowHash(buf) % bond->portCount;
+    }
+    else
+    {
+        i = bond->next++ % bond->portCount;
+    }
+
+    NetIntf *port = bond->ports[i];
+    ++bond->txPackets[i];
+    port->devSend(port, buf);
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool BondSetMtu(NetIntf *intf, uint mtu)
+{
+    Bond *bond = intf->dev;
+    uint oldMtu[BOND_MAX_PORTS];
+
+    for (uint i = 0; i < bond->portCount; ++i)
+    {
+        NetIntf *port = bond->ports[i];
+        oldMtu[i] = port->mtu;
+
+        if (!NetIntfSetMtu(port, mtu))
+        {
+            // Put back the ports already changed so they all keep the aggregate's MTU
+            while (i--)
+            {
+                NetIntfSetMtu(bond->ports[i], oldMtu[i]);
+            }
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void BondUpdateStats(NetIntf *intf)
+{
+    Bond *bond = intf->dev;
+    NetIntfStats *stats = &intf->stats;
+
+    // Device counters of the aggregate are the sums over its ports
+    stats->hwRxPackets = 0;
+    stats->hwRxBytes = 0;
+    stats->hwTxPackets = 0;
+    stats->hwTxBytes = 0;
+    stats->hwRxMissed = 0;
+    stats->hwRxNoBuf = 0;
+    stats->hwRxCrcErrors = 0;
+    stats->hwRxLengthErrors = 0;
+    stats->hwRxErrors = 0;
+    stats->hwTxCollisions = 0;
+
+    for (uint i = 0; i < bond->portCount; ++i)
+    {
+        NetIntf *port = bond->ports[i];
+        if (!port->updateStats)
+        {
+            continue;
+        }
+
+        port->updateStats(port);
+
+        const NetIntfStats *portStats = &port->stats;
+        stats->hwRxPackets += portStats->hwRxPackets;
+        stats->hwRxBytes += portStats->hwRxBytes;
+        stats->hwTxPackets += portStats->hwTxPackets;
+        stats->hwTxBytes += portStats->hwTxBytes;
+        stats->hwRxMissed += portStats->hwRxMissed;
+        stats->hwRxNoBuf += portStats->hwRxNoBuf;
+        stats->hwRxCrcErrors += portStats->hwRxCrcErrors;
+        stats->hwRxLengthErrors += portStats->hwRxLengthErrors;
+        stats->hwRxErrors += portStats->hwRxErrors;
+        stats->hwTxCollisions += portStats->hwTxCollisions;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void BondUpdateFilter(NetIntf *intf)
+{
+    Bond *bond = intf->dev;
+
+    // Every port accepts what the aggregate accepts, plus the aggregate's own address
+    for (uint i = 0; i < bond->portCount; ++i)
+    {
+        NetIntf *port = bond->ports[i];
+
+        memcpy(port->mcastAddrs, intf->mcastAddrs, intf->mcastCount * sizeof(EthAddr));
+        port->mcastCount = intf->mcastCount;
+
+        port->ucastCount = 0;
+        if (!EthAddrEq(&port->ethAddr, &intf->ethAddr))
+        {
+            port->ucastAddrs[port->ucastCount++] = intf->ethAddr;
+        }
+
+        for (uint j = 0; j < intf->ucastCount && port->ucastCount < NET_INTF_UCAST_MAX; ++j)
+        {
+            port->ucastAddrs[port->ucastCount++] = intf->ucastAddrs[j];
+        }
+
+        port->promisc = intf->promisc;
+
+        if (port->updateFilter)
+        {
+            port->updateFilter(port);
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+NetIntf *BondCreate(const char *name, uint mode, NetIntf **ports, uint portCount)
+{
+    if (mode > BOND_MODE_HASH || !portCount || portCount > BOND_MAX_PORTS)
+    {
+        return 0;
+    }
+
+    if (strlen(name) >= BOND_NAME_SIZE || NetIntfFind(name))
+    {
+        return 0;
+    }
+
+    // Only Ethernet ports not already in an aggregate can join
+    for (uint i = 0; i < portCount; ++i)
+    {
+        NetIntf *port = ports[i];
+        if (!port->devSend || port->master || port->poll == BondPoll)
+        {
+            return 0;
+        }
+
+        for (uint j = 0; j < i; ++j)
+        {
+            if (ports[j] == port)
+            {
+                return 0;
+            }
+        }
+    }
+
+    Bond *bond = VMAlloc(sizeof(Bond));
+    memset(bond, 0, sizeof(Bond));
+    strcpy(bond->name, name);
+    bond->mode = mode;
+
+    NetIntf *intf = NetIntfCreate();
+    intf->ethAddr = ports[0]->ethAddr;
+    intf->ipAddr = g_nullIpv4Addr;
+    intf->name = bond->name;
+    intf->dev = bond;
+    intf->caps = ~0u;
+    intf->mtu = ~0u;
+    intf->poll = BondPoll;
+    intf->send = EthSendIntf;
+    intf->devSend = BondSend;
+    intf->setMtu = BondSetMtu;
+    intf->updateFilter = BondUpdateFilter;
+    intf->updateStats = BondUpdateStats;
+
+    // Offloads and MTU are limited by the least capable port
+    for (uint i = 0; i < portCount; ++i)
+    {
+        NetIntf *port = ports[i];
+
+        bond->ports[i] = port;
+        intf->caps &= port->caps;
+        if (intf->mtu > port->mtu)
+        {
+            intf->mtu = port->mtu;
+        }
+
+        port->master = intf;
+        LinkRemove(&port->link);
+    }
+
+    bond->portCount = portCount;
+    bond->intf = intf;
+    LinkBefore(&s_bonds, &bond->link);
+
+    BondUpdateFilter(intf);
+    NetIntfAdd(intf);
+    DhcpDiscover(intf);
+
+    return intf;
+}
+
+// ------------------------------------------------------------------------------------------------
+void BondPrint()
+{
+    Bond *bond;
+    ListForEach(bond, s_bonds, link)
+    {
+        ConsolePrint("%s: mode=%s mtu=%u\n", bond->name, s_modeStrs[bond->mode], bond->intf->mtu);
+
+        for (uint i = 0; i < bond->portCount; ++i)
+        {
+            ConsolePrint("  %-8s tx=%u\n", bond->ports[i]->name, bond->txPackets[i]);
+        }
+    }
+}
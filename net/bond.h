@@ -0,0 +1,28 @@
+// ------------------------------------------------------------------------------------------------
+// net/bond.h
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "net/intf.h"
+
+// ------------------------------------------------------------------------------------------------
+// Configuration
+
+#define BOND_MAX_PORTS          4           // Ports aggregated into one interface
+#define BOND_NAME_SIZE          16
+
+// ------------------------------------------------------------------------------------------------
+// Transmit Policy
+
+#define BOND_MODE_ROUND_ROBIN   0           // Rotate packets across ports
+#define BOND_MODE_HASH          1           // Keep each IPv4 address/port flow on one port
+
+// ------------------------------------------------------------------------------------------------
+// Functions
+
+// Ports leave the interface list and receive for the aggregate, which takes the address
+// of the first port.  The link partner must group the ports into one static trunk.
+NetIntf *BondCreate(const char *name, uint mode, NetIntf **ports, uint portCount);
+
+void BondPrint();
@@ -0,0 +1,474 @@
+// ------------------------------------------------------------------------------------------------
+// net/bpf.c
+// ------------------------------------------------------------------------------------------------
+
+#include "net/bpf.h"
+#include "net/eth.h"
+#include "net/ipv4.h"
+#include "stdlib/format.h"
+#include "stdlib/string.h"
+
+// ------------------------------------------------------------------------------------------------
+bool BpfValidate(const BpfInsn *prog, uint count)
+{
+    if (!count || count > BPF_MAX_INSNS)
+    {
+        return false;
+    }
+
+    for (uint pc = 0; pc < count; ++pc)
+    {
+        const BpfInsn *insn = &prog[pc];
+        uint code = insn->code;
+
+        switch (BPF_CLASS(code))
+        {
+        case BPF_LD:
+            switch (BPF_MODE(code))
+            {
+            case BPF_ABS:
+            case BPF_IND:
+                if (BPF_SIZE(code) != BPF_W && BPF_SIZE(code) != BPF_H && BPF_SIZE(code) != BPF_B)
+                {
+                    return false;
+                }
+                break;
+
+            case BPF_MEM:
+                if (insn->k >= BPF_MEM_WORDS)
+                {
+                    return false;
+                }
+                break;
+
+            case BPF_IMM:
+            case BPF_LEN:
+                break;
+
+            default:
+                return false;
+            }
+            break;
+
+        case BPF_LDX:
+            switch (BPF_MODE(code))
+            {
+            case BPF_MSH:
+                if (BPF_SIZE(code) != BPF_B)
+                {
+                    return false;
+                }
+                break;
+
+            case BPF_MEM:
+                if (insn->k >= BPF_MEM_WORDS)
+                {
+                    return false;
+                }
+                break;
+
+            case BPF_IMM:
+            case BPF_LEN:
+                break;
+
+            default:
+                return false;
+            }
+            break;
+
+        case BPF_ST:
+        case BPF_STX:
+            if (insn->k >= BPF_MEM_WORDS)
+            {
+                return false;
+            }
+            break;
+
+        case BPF_ALU:
+            switch (BPF_OP(code))
+            {
+            case BPF_DIV:
+            case BPF_MOD:
+                if (BPF_SRC(code) == BPF_K && !insn->k)
+                {
+                    return false;
+                }
+                break;
+
+            case BPF_ADD:
+            case BPF_SUB:
+            case BPF_MUL:
+            case BPF_OR:
+            case BPF_AND:
+            case BPF_LSH:
+            case BPF_RSH:
+            case BPF_NEG:
+            case BPF_XOR:
+                break;
+
+            default:
+                return false;
+            }
+            break;
+
+        case BPF_JMP:
+            // Jumps only go forward, so programs always terminate
+            if (BPF_OP(code) == BPF_JA)
+            {
+                if (insn->k >= count - pc - 1)
+                {
+                    return false;
+                }
+            }
+            else if (BPF_OP(code) > BPF_JSET ||
+                pc + 1 + insn->jt >= count || pc + 1 + insn->jf >= count)
+            {
+                return false;
+            }
+            break;
+
+        case BPF_RET:
+            if (BPF_RVAL(code) == 0x18)
+            {
+                return false;
+            }
+            break;
+
+        case BPF_MISC:
+            if (BPF_MISCOP(code) != BPF_TAX && BPF_MISCOP(code) != BPF_TXA)
+            {
+                return false;
+            }
+            break;
+        }
+    }
+
+    return BPF_CLASS(prog[count - 1].code) == BPF_RET;
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool BpfLoad(const u8 *pkt, uint len, uint size, u32 offset, u32 *result)
+{
+    // Bytes are in network order
+    uint width = size == BPF_W ? 4 : size == BPF_H ? 2 : 1;
+    if (offset > len || width > len - offset)
+    {
+        return false;
+    }
+
+    const u8 *p = pkt + offset;
+    u32 val = 0;
+    for (uint i = 0; i < width; ++i)
+    {
+        val = (val << 8) | p[i];
+    }
+
+    *result = val;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+uint BpfRun(const BpfInsn *prog, const u8 *pkt, uint wireLen, uint len)
+{
+    u32 a = 0;
+    u32 x = 0;
+    u32 mem[BPF_MEM_WORDS] = { 0 };
+
+    for (const BpfInsn *insn = prog; ; ++insn)
+    {
+        uint code = insn->code;
+        u32 k = insn->k;
+
+        switch (BPF_CLASS(code))
+        {
+        case BPF_LD:
+            switch (BPF_MODE(code))
+            {
+            case BPF_IMM:
+                a = k;
+                break;
+
+            case BPF_ABS:
+                if (!BpfLoad(pkt, len, BPF_SIZE(code), k, &a))
+                {
+                    return 0;
+                }
+                break;
+
+            case BPF_IND:
+                if (x + k < x || !BpfLoad(pkt, len, BPF_SIZE(code), x + k, &a))
+                {
+                    return 0;
+                }
+                break;
+
+            case BPF_MEM:
+                a = mem[k];
+                break;
+
+            case BPF_LEN:
+                a = wireLen;
+                break;
+            }
+            break;
+
+        case BPF_LDX:
+            switch (BPF_MODE(code))
+            {
+            case BPF_IMM:
+                x = k;
+                break;
+
+            case BPF_MEM:
+                x = mem[k];
+                break;
+
+            case BPF_LEN:
+                x = wireLen;
+                break;
+
+            case BPF_MSH:
+                // IPv4 header length from the low nibble of the byte at k
+                if (k >= len)
+                {
+                    return 0;
+                }
+
+                x = (pkt[k] & 0xf) << 2;
+                break;
+            }
+            break;
+
+        case BPF_ST:
+            mem[k] = a;
+            break;
+
+        case BPF_STX:
+            mem[k] = x;
+            break;
+
+        case BPF_ALU:
+            {
+                u32 v = BPF_SRC(code) == BPF_X ? x : k;
+
+                switch (BPF_OP(code))
+                {
+                case BPF_ADD:
+                    a += v;
+                    break;
+
+                case BPF_SUB:
+                    a -= v;
+                    break;
+
+                case BPF_MUL:
+                    a *= v;
+                    break;
+
+                case BPF_OR:
+                    a |= v;
+                    break;
+
+                case BPF_AND:
+                    a &= v;
+                    break;
+
+                case BPF_XOR:
+                    a ^= v;
+                    break;
+
+                case BPF_NEG:
+                    a = -a;
+                    break;
+
+                case BPF_LSH:
+                    a = v < 32 ? a << v : 0;
+                    break;
+
+                case BPF_RSH:
+                    a = v < 32 ? a >> v : 0;
+                    break;
+
+                case BPF_DIV:
+                case BPF_MOD:
+                    // Constant divisors are checked by BpfValidate
+                    if (!v)
+                    {
+                        return 0;
+                    }
+
+                    a = BPF_OP(code) == BPF_DIV ? a / v : a % v;
+                    break;
+                }
+            }
+            break;
+
+        case BPF_JMP:
+            {
+                u32 v = BPF_SRC(code) == BPF_X ? x : k;
+                bool taken = false;
+
+                switch (BPF_OP(code))
+                {
+                case BPF_JA:
+                    insn += k;
+                    continue;
+
+                case BPF_JEQ:
+                    taken = a == v;
+                    break;
+
+                case BPF_JGT:
+                    taken = a > v;
+                    break;
+
+                case BPF_JGE:
+                    taken = a >= v;
+                    break;
+
+                case BPF_JSET:
+                    taken = (a & v) != 0;
+                    break;
+                }
+
+                insn += taken ? insn->jt : insn->jf;
+            }
+            break;
+
+        case BPF_RET:
+            return BPF_RVAL(code) == BPF_A ? a : BPF_RVAL(code) == BPF_X ? x : k;
+
+        case BPF_MISC:
+            if (BPF_MISCOP(code) == BPF_TAX)
+            {
+                x = a;
+            }
+            else
+            {
+                a = x;
+            }
+            break;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// Filter Templates - jump offsets are relative to the next instruction
+
+static const BpfInsn s_etherTypeFilter[] =
+{
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),               // ethertype
+    BPF_STMT(BPF_RET | BPF_K, BPF_SNAP_ALL),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+static const BpfInsn s_protocolFilter[] =
+{
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ET_IPV4, 0, 3),
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),               // IP protocol
+    BPF_STMT(BPF_RET | BPF_K, BPF_SNAP_ALL),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+static const BpfInsn s_hostFilter[] =
+{
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ET_IPV4, 0, 5),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 26),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 2, 0),               // source address
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 30),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),               // destination address
+    BPF_STMT(BPF_RET | BPF_K, BPF_SNAP_ALL),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+static const BpfInsn s_portFilter[] =
+{
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ET_IPV4, 0, 11),
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IP_PROTOCOL_TCP, 1, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IP_PROTOCOL_UDP, 0, 8),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 6, 0),         // later fragments have no ports
+    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 14),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 2, 0),               // source port
+    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),               // destination port
+    BPF_STMT(BPF_RET | BPF_K, BPF_SNAP_ALL),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+// ------------------------------------------------------------------------------------------------
+static uint BpfTemplate(BpfInsn *prog, const BpfInsn *filter, uint size, u32 value)
+{
+    // Every placeholder comparison takes the same value
+    uint count = size / sizeof(BpfInsn);
+    memcpy(prog, filter, size);
+
+    for (uint i = 0; i < count; ++i)
+    {
+        if (prog[i].code == (BPF_JMP | BPF_JEQ | BPF_K) && !prog[i].k)
+        {
+            prog[i].k = value;
+        }
+    }
+
+    return count;
+}
+
+// ------------------------------------------------------------------------------------------------
+uint BpfCompile(BpfInsn *prog, uint argc, const char **argv)
+{
+    if (argc == 1)
+    {
+        const char *name = argv[0];
+
+        if (strcmp(name, "arp") == 0)
+        {
+            return BpfTemplate(prog, s_etherTypeFilter, sizeof(s_etherTypeFilter), ET_ARP);
+        }
+        else if (strcmp(name, "ip") == 0)
+        {
+            return BpfTemplate(prog, s_etherTypeFilter, sizeof(s_etherTypeFilter), ET_IPV4);
+        }
+        else if (strcmp(name, "icmp") == 0)
+        {
+            return BpfTemplate(prog, s_protocolFilter, sizeof(s_protocolFilter), IP_PROTOCOL_ICMP);
+        }
+        else if (strcmp(name, "tcp") == 0)
+        {
+            return BpfTemplate(prog, s_protocolFilter, sizeof(s_protocolFilter), IP_PROTOCOL_TCP);
+        }
+        else if (strcmp(name, "udp") == 0)
+        {
+            return BpfTemplate(prog, s_protocolFilter, sizeof(s_protocolFilter), IP_PROTOCOL_UDP);
+        }
+    }
+    else if (argc == 2)
+    {
+        if (strcmp(argv[0], "host") == 0)
+        {
+            Ipv4Addr addr;
+            if (StrToIpv4Addr(&addr, argv[1]))
+            {
+                u32 k = (addr.u.n[0] << 24) | (addr.u.n[1] << 16) | (addr.u.n[2] << 8) | addr.u.n[3];
+                return BpfTemplate(prog, s_hostFilter, sizeof(s_hostFilter), k);
+            }
+        }
+        else if (strcmp(argv[0], "port") == 0)
+        {
+            uint port;
+            if (sscanf(argv[1], "%d", &port) == 1 && port && port <= 0xffff)
+            {
+                return BpfTemplate(prog, s_portFilter, sizeof(s_portFilter), port);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+// ------------------------------------------------------------------------------------------------
+// net/bpf.h
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "stdlib/types.h"
+
+// ------------------------------------------------------------------------------------------------
+// Classic BPF Instructions - the encoding used by tcpdump -dd
+
+typedef struct BpfInsn
+{
+    u16 code;
+    u8 jt;
+    u8 jf;
+    u32 k;
+} BpfInsn;
+
+#define BPF_STMT(code, k)               { (u16)(code), 0, 0, k }
+#define BPF_JUMP(code, k, jt, jf)       { (u16)(code), jt, jf, k }
+
+#define BPF_MAX_INSNS                   512         // Longest program accepted
+#define BPF_MEM_WORDS                   16          // Scratch memory words
+#define BPF_COMPILE_MAX                 16          // Longest program built by BpfCompile
+#define BPF_SNAP_ALL                    0x40000     // Return value keeping the whole packet
+
+// Instruction classes
+#define BPF_CLASS(code)                 ((code) & 0x07)
+#define BPF_LD                          0x00
+#define BPF_LDX                         0x01
+#define BPF_ST                          0x02
+#define BPF_STX                         0x03
+#define BPF_ALU                         0x04
+#define BPF_JMP                         0x05
+#define BPF_RET                         0x06
+#define BPF_MISC                        0x07
+
+// Load sizes
+#define BPF_SIZE(code)                  ((code) & 0x18)
+#define BPF_W                           0x00
+#define BPF_H                           0x08
+#define BPF_B                           0x10
+
+// Load modes
+#define BPF_MODE(code)                  ((code) & 0xe0)
+#define BPF_IMM                         0x00
+#define BPF_ABS                         0x20
+#define BPF_IND                         0x40
+#define BPF_MEM                         0x60
+#define BPF_LEN                         0x80
+#define BPF_MSH                         0xa0
+
+// ALU and jump operations
+#define BPF_OP(code)                    ((code) & 0xf0)
+#define BPF_ADD                         0x00
+#define BPF_SUB                         0x10
+#define BPF_MUL                         0x20
+#define BPF_DIV                         0x30
+#define BPF_OR                          0x40
+#define BPF_AND                         0x50
+#define BPF_LSH                         0x60
+#define BPF_RSH                         0x70
+#define BPF_NEG                         0x80
+#define BPF_MOD                         0x90
+#define BPF_XOR                         0xa0
+
+#define BPF_JA                          0x00
+#define BPF_JEQ                         0x10
+#define BPF_JGT                         0x20
+#define BPF_JGE                         0x30
+#define BPF_JSET                        0x40
+
+// Operand source
+#define BPF_SRC(code)                   ((code) & 0x08)
+#define BPF_K                           0x00
+#define BPF_X                           0x08
+
+// Return value
+#define BPF_RVAL(code)                  ((code) & 0x18)
+#define BPF_A                           0x10
+
+// Register transfers
+#define BPF_MISCOP(code)                ((code) & 0xf8)
+#define BPF_TAX                         0x00
+#define BPF_TXA                         0x80
+
+// ------------------------------------------------------------------------------------------------
+// Functions
+
+// Checks that every instruction is known, jumps and scratch accesses stay in range, constant
+// divisors are non-zero and the program ends in a return, so BpfRun needs no such checks.
+bool BpfValidate(const BpfInsn *prog, uint count);
+
+// Returns the number of bytes of the packet to keep, 0 to reject it.  Loads beyond the
+// len bytes available reject the packet; wireLen is the length loaded by BPF_LEN.
+uint BpfRun(const BpfInsn *prog, const u8 *pkt, uint wireLen, uint len);
+
+// Builds a filter for Ethernet frames from one tcpdump style primitive: arp, ip, icmp, tcp,
+// udp, host <ipv4 addr> or port <n>.  Returns the instruction count, 0 if not understood.
+uint BpfCompile(BpfInsn *prog, uint argc, const char **argv);
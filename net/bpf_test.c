@@ -0,0 +1,177 @@
+// ------------------------------------------------------------------------------------------------
+// net/bpf_test.c
+// ------------------------------------------------------------------------------------------------
+
+#include "test/test.h"
+#include "net/bpf.h"
+#include "stdlib/string.h"
+
+// ------------------------------------------------------------------------------------------------
+// Ethernet + IPv4 + UDP frame from 10.0.2.15:1234 to 10.0.2.2:53
+
+static const u8 s_udpFrame[] =
+{
+    0x52, 0x54, 0x00, 0x12, 0x35, 0x02, 0x52, 0x54, 0x00, 0x12, 0x34, 0x56, 0x08, 0x00,
+    0x45, 0x00, 0x00, 0x20, 0x00, 0x01, 0x00, 0x00, 0x40, 0x11, 0x00, 0x00,
+    0x0a, 0x00, 0x02, 0x0f, 0x0a, 0x00, 0x02, 0x02,
+    0x04, 0xd2, 0x00, 0x35, 0x00, 0x0c, 0x00, 0x00,
+    0xde, 0xad, 0xbe, 0xef,
+};
+
+// ------------------------------------------------------------------------------------------------
+static uint Compile(BpfInsn *prog, const char *a, const char *b)
+{
+    const char *argv[] = { a, b };
+    uint count = BpfCompile(prog, b ? 2 : 1, argv);
+    if (count)
+    {
+        ASSERT_TRUE(BpfValidate(prog, count));
+    }
+
+    return count;
+}
+
+// ------------------------------------------------------------------------------------------------
+static uint Match(const char *a, const char *b, const u8 *pkt, uint len)
+{
+    BpfInsn prog[BPF_COMPILE_MAX];
+    ASSERT_TRUE(Compile(prog, a, b) != 0);
+
+    return BpfRun(prog, pkt, len, len);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TestValidate()
+{
+    static const BpfInsn accept[] =
+    {
+        BPF_STMT(BPF_RET | BPF_K, BPF_SNAP_ALL),
+    };
+
+    static const BpfInsn noReturn[] =
+    {
+        BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+    };
+
+    static const BpfInsn jumpOut[] =
+    {
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+
+    static const BpfInsn divZero[] =
+    {
+        BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 0),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+
+    static const BpfInsn badMem[] =
+    {
+        BPF_STMT(BPF_ST, BPF_MEM_WORDS),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+
+    static const BpfInsn badCode[] =
+    {
+        BPF_STMT(0xffff, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+
+    ASSERT_TRUE(BpfValidate(accept, 1));
+    ASSERT_TRUE(!BpfValidate(accept, 0));
+    ASSERT_TRUE(!BpfValidate(noReturn, 1));
+    ASSERT_TRUE(!BpfValidate(jumpOut, 2));
+    ASSERT_TRUE(!BpfValidate(divZero, 2));
+    ASSERT_TRUE(!BpfValidate(badMem, 2));
+    ASSERT_TRUE(!BpfValidate(badCode, 2));
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TestRun()
+{
+    // Arithmetic, scratch memory and register transfers
+    static const BpfInsn alu[] =
+    {
+        BPF_STMT(BPF_LD | BPF_IMM, 6),
+        BPF_STMT(BPF_ST, 3),
+        BPF_STMT(BPF_LDX | BPF_IMM, 7),
+        BPF_STMT(BPF_ALU | BPF_MUL | BPF_X, 0),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_MEM, 3),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 1),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+
+    ASSERT_TRUE(BpfValidate(alu, 9));
+    ASSERT_EQ_UINT(BpfRun(alu, s_udpFrame, 0, 0), 24);
+
+    // Packet loads in network byte order and the wire length
+    static const BpfInsn loads[] =
+    {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 26),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x0a00020f, 0, 2),
+        BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+
+    ASSERT_TRUE(BpfValidate(loads, 5));
+    ASSERT_EQ_UINT(BpfRun(loads, s_udpFrame, 1500, sizeof(s_udpFrame)), 1500);
+
+    // Loads past the captured bytes reject the packet
+    ASSERT_EQ_UINT(BpfRun(loads, s_udpFrame, 1500, 28), 0);
+
+    // Division by a zero register rejects the packet
+    static const BpfInsn divX[] =
+    {
+        BPF_STMT(BPF_LD | BPF_IMM, 10),
+        BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+        BPF_STMT(BPF_RET | BPF_K, 1),
+    };
+
+    ASSERT_TRUE(BpfValidate(divX, 3));
+    ASSERT_EQ_UINT(BpfRun(divX, s_udpFrame, 0, 0), 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TestCompile()
+{
+    BpfInsn prog[BPF_COMPILE_MAX];
+    uint len = sizeof(s_udpFrame);
+
+    ASSERT_EQ_UINT(Compile(prog, "bogus", 0), 0);
+    ASSERT_EQ_UINT(Compile(prog, "host", "nowhere"), 0);
+    ASSERT_EQ_UINT(Compile(prog, "port", "0"), 0);
+    ASSERT_EQ_UINT(Compile(prog, "port", "70000"), 0);
+
+    ASSERT_EQ_UINT(Match("ip", 0, s_udpFrame, len), BPF_SNAP_ALL);
+    ASSERT_EQ_UINT(Match("arp", 0, s_udpFrame, len), 0);
+    ASSERT_EQ_UINT(Match("udp", 0, s_udpFrame, len), BPF_SNAP_ALL);
+    ASSERT_EQ_UINT(Match("tcp", 0, s_udpFrame, len), 0);
+    ASSERT_EQ_UINT(Match("icmp", 0, s_udpFrame, len), 0);
+
+    ASSERT_EQ_UINT(Match("host", "10.0.2.15", s_udpFrame, len), BPF_SNAP_ALL);
+    ASSERT_EQ_UINT(Match("host", "10.0.2.2", s_udpFrame, len), BPF_SNAP_ALL);
+    ASSERT_EQ_UINT(Match("host", "10.0.2.3", s_udpFrame, len), 0);
+
+    ASSERT_EQ_UINT(Match("port", "1234", s_udpFrame, len), BPF_SNAP_ALL);
+    ASSERT_EQ_UINT(Match("port", "53", s_udpFrame, len), BPF_SNAP_ALL);
+    ASSERT_EQ_UINT(Match("port", "54", s_udpFrame, len), 0);
+
+    // Non-first fragments carry no ports
+    u8 frag[sizeof(s_udpFrame)];
+    memcpy(frag, s_udpFrame, len);
+    frag[21] = 0x10;
+    ASSERT_EQ_UINT(Match("port", "53", frag, len), 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+int main(int argc, const char **argv)
+{
+    TestValidate();
+    TestRun();
+    TestCompile();
+
+    return EXIT_SUCCESS;
+}
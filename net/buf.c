@@ -3,44 +3,568 @@
 // ------------------------------------------------------------------------------------------------
 
 #include "net/buf.h"
+#include "acpi/acpi.h"
+#include "console/console.h"
+#include "cpu/smp.h"
+#include "cpu/spinlock.h"
 #include "mem/vm.h"
+#include "stdlib/string.h"
+
+// Buffers are carved from fixed size slabs, one size class per slab.  Each CPU caches freed
+// buffers in two magazines per class and only takes the class lock to exchange a whole
+// magazine with the depot.  Full magazines beyond NET_DEPOT_MAX_FULL go back to their slabs,
+// and slabs with every buffer free return to a list shared by all classes.
+//
+// Clones are built from reference buffers, a class with no data space.  A reference buffer
+// either points into the data of another buffer, holding a reference to it, or serves as
+// a chain head whose headroom is private to the clone.
 
 // ------------------------------------------------------------------------------------------------
-static Link s_netFreeBufs = { &s_netFreeBufs, &s_netFreeBufs };
-int g_netBufAllocCount;
+typedef struct NetSlab
+{
+    Link link;                          // in the class's partial list or s_emptySlabs
+    struct NetBufPool *pool;
+    Link freeBufs;
+    uint freeCount;
+    uint capacity;
+} NetSlab;
+
+#define NET_SLAB_HDR_SIZE   ((sizeof(NetSlab) + 63) & ~63)
+
+typedef struct NetBufMag
+{
+    Link link;
+    uint count;
+    NetBuf *bufs[NET_MAG_SIZE];
+} NetBufMag;
+
+typedef struct NetBufPool
+{
+    uint size;                          // data space of each buffer
+    uint magSize;                       // buffers per magazine
+
+    // depot and slab layer, guarded by lock
+    SpinLock lock;
+    Link fullMags;
+    uint fullCount;
+    Link emptyMags;
+    Link partialSlabs;
+    uint slabCount;
+    uint held;                          // buffers outside slabs, in use or cached
+    uint heldPeak;
+} NetBufPool;
+
+typedef struct NetBufCache
+{
+    NetBufMag *loaded;
+    NetBufMag *previous;
+    int inUse;                          // allocations minus releases on this CPU
+} __attribute__((aligned(64))) NetBufCache;
+
+#define NET_BUF_POOL(i, size, magSize) \
+    { size, magSize, { 0 }, \
+      { &s_netBufPools[i].fullMags, &s_netBufPools[i].fullMags }, 0, \
+      { &s_netBufPools[i].emptyMags, &s_netBufPools[i].emptyMags }, \
+      { &s_netBufPools[i].partialSlabs, &s_netBufPools[i].partialSlabs }, 0, 0, 0 }
+
+#define NET_REF_POOL        NET_BUF_CLASS_COUNT
+#define NET_POOL_COUNT      (NET_BUF_CLASS_COUNT + 1)
+
+static NetBufPool s_netBufPools[NET_POOL_COUNT] =
+{
+    NET_BUF_POOL(0, 0x0800, 16),
+    NET_BUF_POOL(1, 0x1000, 16),
+    NET_BUF_POOL(2, 0x2000, 8),
+    NET_BUF_POOL(3, 0x4000, 4),
+    NET_BUF_POOL(4, 0x10000, 2),
+    NET_BUF_POOL(5, 0, 16),
+};
+
+static NetBufCache s_netBufCaches[MAX_CPU_COUNT][NET_POOL_COUNT];
+
+static SpinLock s_slabLock;
+static Link s_emptySlabs = { &s_emptySlabs, &s_emptySlabs };
+static uint s_slabTotal;
 
 // ------------------------------------------------------------------------------------------------
-NetBuf *NetAllocBuf()
+static NetBufPool *NetFindPool(uint size)
 {
-    NetBuf *buf;
+    for (uint i = 0; i < NET_BUF_CLASS_COUNT; ++i)
+    {
+        if (size <= s_netBufPools[i].size)
+        {
+            return &s_netBufPools[i];
+        }
+    }
+
+    return 0;
+}
 
-    if (ListIsEmpty(&s_netFreeBufs))
+// ------------------------------------------------------------------------------------------------
+static void NetSlabAdd(NetBufPool *pool)
+{
+    NetSlab *slab = 0;
+
+    SpinLockAcquire(&s_slabLock);
+    if (!ListIsEmpty(&s_emptySlabs))
     {
-        buf = VMAlloc(NET_BUF_SIZE);
+        slab = LinkData(s_emptySlabs.next, NetSlab, link);
+        LinkRemove(&slab->link);
     }
-    else
+    SpinLockRelease(&s_slabLock);
+
+    if (!slab)
+    {
+        slab = VMAllocAlign(NET_SLAB_SIZE, 4096);
+        __sync_fetch_and_add(&s_slabTotal, 1);
+    }
+
+    // Carve into buffers of this class
+    uint bufSize = NET_BUF_START + pool->size;
+
+    slab->pool = pool;
+    slab->capacity = (NET_SLAB_SIZE - NET_SLAB_HDR_SIZE) / bufSize;
+    slab->freeCount = slab->capacity;
+    LinkInit(&slab->freeBufs);
+
+    u8 *p = (u8 *)slab + NET_SLAB_HDR_SIZE;
+    for (uint i = 0; i < slab->capacity; ++i)
+    {
+        NetBuf *buf = (NetBuf *)p;
+        buf->slab = slab;
+        LinkBefore(&slab->freeBufs, &buf->link);
+        p += bufSize;
+    }
+
+    LinkBefore(&pool->partialSlabs, &slab->link);
+    ++pool->slabCount;
+}
+
+// ------------------------------------------------------------------------------------------------
+static uint NetSlabAlloc(NetBufPool *pool, NetBuf **bufs, uint count)
+{
+    // Called with the pool lock held
+    for (uint i = 0; i < count; ++i)
     {
-        buf = LinkData(s_netFreeBufs.next, NetBuf, link);
+        if (ListIsEmpty(&pool->partialSlabs))
+        {
+            NetSlabAdd(pool);
+        }
+
+        NetSlab *slab = LinkData(pool->partialSlabs.next, NetSlab, link);
+        NetBuf *buf = LinkData(slab->freeBufs.next, NetBuf, link);
         LinkRemove(&buf->link);
+
+        if (!--slab->freeCount)
+        {
+            LinkRemove(&slab->link);
+        }
+
+        bufs[i] = buf;
     }
 
+    pool->held += count;
+    if (pool->heldPeak < pool->held)
+    {
+        pool->heldPeak = pool->held;
+    }
+
+    return count;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void NetSlabFree(NetBufPool *pool, NetBuf *buf)
+{
+    // Called with the pool lock held
+    NetSlab *slab = buf->slab;
+    LinkBefore(&slab->freeBufs, &buf->link);
+    --pool->held;
+
+    if (!slab->freeCount++)
+    {
+        LinkBefore(&pool->partialSlabs, &slab->link);
+    }
+
+    if (slab->freeCount == slab->capacity)
+    {
+        // Wholly free - any class may reuse the memory
+        LinkRemove(&slab->link);
+        --pool->slabCount;
+
+        SpinLockAcquire(&s_slabLock);
+        LinkBefore(&s_emptySlabs, &slab->link);
+        SpinLockRelease(&s_slabLock);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static NetBufMag *NetMagGetEmpty(NetBufPool *pool)
+{
+    // Called with the pool lock held
+    if (ListIsEmpty(&pool->emptyMags))
+    {
+        NetBufMag *mag = VMAllocAlign(sizeof(NetBufMag), 64);
+        mag->count = 0;
+        return mag;
+    }
+
+    NetBufMag *mag = LinkData(pool->emptyMags.next, NetBufMag, link);
+    LinkRemove(&mag->link);
+    return mag;
+}
+
+// ------------------------------------------------------------------------------------------------
+static NetBufCache *NetGetCache(NetBufPool *pool)
+{
+    NetBufCache *cache = &s_netBufCaches[SmpCpuIndex()][pool - s_netBufPools];
+
+    if (!cache->loaded)
+    {
+        SpinLockAcquire(&pool->lock);
+        cache->loaded = NetMagGetEmpty(pool);
+        cache->previous = NetMagGetEmpty(pool);
+        SpinLockRelease(&pool->lock);
+    }
+
+    return cache;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void NetCacheRefill(NetBufCache *cache, NetBufPool *pool)
+{
+    // Both magazines are empty - swap one for a full magazine from the depot, or fill from slabs
+    SpinLockAcquire(&pool->lock);
+
+    if (pool->fullCount)
+    {
+        NetBufMag *full = LinkData(pool->fullMags.next, NetBufMag, link);
+        LinkRemove(&full->link);
+        --pool->fullCount;
+
+        LinkAfter(&pool->emptyMags, &cache->previous->link);
+        cache->previous = cache->loaded;
+        cache->loaded = full;
+    }
+    else
+    {
+        NetBufMag *mag = cache->loaded;
+        mag->count = NetSlabAlloc(pool, mag->bufs, pool->magSize);
+    }
+
+    SpinLockRelease(&pool->lock);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void NetCacheFlush(NetBufCache *cache, NetBufPool *pool)
+{
+    // Both magazines are full - hand one to the depot
+    SpinLockAcquire(&pool->lock);
+
+    LinkBefore(&pool->fullMags, &cache->previous->link);
+    ++pool->fullCount;
+
+    cache->previous = cache->loaded;
+    cache->loaded = NetMagGetEmpty(pool);
+
+    // Above the watermark, return the oldest magazine's buffers to their slabs
+    while (pool->fullCount > NET_DEPOT_MAX_FULL)
+    {
+        NetBufMag *mag = LinkData(pool->fullMags.next, NetBufMag, link);
+        LinkRemove(&mag->link);
+        --pool->fullCount;
+
+        for (uint i = 0; i < mag->count; ++i)
+        {
+            NetSlabFree(pool, mag->bufs[i]);
+        }
+
+        mag->count = 0;
+        LinkAfter(&pool->emptyMags, &mag->link);
+    }
+
+    SpinLockRelease(&pool->lock);
+}
+
+// ------------------------------------------------------------------------------------------------
+static NetBuf *NetAllocFrom(NetBufPool *pool)
+{
+    NetBufCache *cache = NetGetCache(pool);
+
+    if (!cache->loaded->count)
+    {
+        if (cache->previous->count)
+        {
+            NetBufMag *mag = cache->loaded;
+            cache->loaded = cache->previous;
+            cache->previous = mag;
+        }
+        else
+        {
+            NetCacheRefill(cache, pool);
+        }
+    }
+
+    NetBufMag *mag = cache->loaded;
+    NetBuf *buf = mag->bufs[--mag->count];
+
     buf->link.prev = 0;
     buf->link.next = 0;
     buf->start = (u8 *)buf + NET_BUF_START;
     buf->end = (u8 *)buf + NET_BUF_START;
     buf->refCount = 1;
+    buf->size = pool->size;
+    buf->csumFlags = 0;
+    buf->gsoSize = 0;
+    buf->next = 0;
+    buf->shared = 0;
+    memset(buf->stamps, 0, sizeof(buf->stamps));
 
-    ++g_netBufAllocCount;
+    ++cache->inUse;
     return buf;
 }
 
+// ------------------------------------------------------------------------------------------------
+NetBuf *NetAllocBuf()
+{
+    return NetAllocFrom(&s_netBufPools[0]);
+}
+
+// ------------------------------------------------------------------------------------------------
+NetBuf *NetAllocBufSize(uint size)
+{
+    NetBufPool *pool = NetFindPool(size);
+    return pool ? NetAllocFrom(pool) : 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+NetBuf *NetAllocLargeBuf()
+{
+    return NetAllocFrom(&s_netBufPools[NET_BUF_CLASS_COUNT - 1]);
+}
+
+// ------------------------------------------------------------------------------------------------
+void NetAllocBufs(NetBuf **bufs, uint count, uint size)
+{
+    NetBufPool *pool = NetFindPool(size);
+
+    for (uint i = 0; i < count; ++i)
+    {
+        bufs[i] = NetAllocFrom(pool);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void NetFreeBuf(NetBuf *buf)
+{
+    NetBufPool *pool = buf->slab->pool;
+    NetBufCache *cache = NetGetCache(pool);
+
+    if (cache->loaded->count == pool->magSize)
+    {
+        if (!cache->previous->count)
+        {
+            NetBufMag *mag = cache->loaded;
+            cache->loaded = cache->previous;
+            cache->previous = mag;
+        }
+        else
+        {
+            NetCacheFlush(cache, pool);
+        }
+    }
+
+    NetBufMag *mag = cache->loaded;
+    mag->bufs[mag->count++] = buf;
+
+    --cache->inUse;
+}
+
 // ------------------------------------------------------------------------------------------------
 void NetReleaseBuf(NetBuf *buf)
 {
-    if (!--buf->refCount)
+    // The last reference to a fragment drops its hold on the rest of the chain
+    while (buf && !--buf->refCount)
+    {
+        NetBuf *next = buf->next;
+
+        if (buf->shared)
+        {
+            NetReleaseBuf(buf->shared);
+        }
+
+        NetFreeBuf(buf);
+        buf = next;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+NetBuf *NetCloneBuf(NetBuf *buf)
+{
+    // Empty head for the clone's own headers, then a reference to each fragment's data
+    NetBuf *head = NetAllocFrom(&s_netBufPools[NET_REF_POOL]);
+    NetBuf *tail = head;
+
+    for (; buf; buf = buf->next)
+    {
+        NetBuf *ref = NetAllocFrom(&s_netBufPools[NET_REF_POOL]);
+        ref->start = buf->start;
+        ref->end = buf->end;
+        ref->shared = buf->shared ? buf->shared : buf;
+        ++ref->shared->refCount;
+
+        tail->next = ref;
+        tail = ref;
+    }
+
+    return head;
+}
+
+// ------------------------------------------------------------------------------------------------
+NetBuf *NetLinearizeBuf(NetBuf *buf)
+{
+    if (!buf->next)
+    {
+        return buf;
+    }
+
+    NetBuf *copy = NetAllocBufSize(NetBufLen(buf));
+    if (copy)
+    {
+        for (NetBuf *frag = buf; frag; frag = frag->next)
+        {
+            uint len = frag->end - frag->start;
+            memcpy(copy->end, frag->start, len);
+            copy->end += len;
+        }
+
+        // Offload state refers to the head, which starts the copy
+        copy->csumFlags = buf->csumFlags;
+        copy->csumOffset = buf->csumOffset;
+        copy->csumStart = copy->start + (buf->csumStart - buf->start);
+        copy->gsoSize = buf->gsoSize;
+        memcpy(copy->stamps, buf->stamps, sizeof(copy->stamps));
+    }
+
+    NetReleaseBuf(buf);
+    return copy;
+}
+
+// ------------------------------------------------------------------------------------------------
+void NetAppendBuf(NetBuf *buf, NetBuf *frag)
+{
+    while (buf->next)
     {
-        --g_netBufAllocCount;
+        buf = buf->next;
+    }
+
+    buf->next = frag;
+}
+
+// ------------------------------------------------------------------------------------------------
+uint NetBufLen(const NetBuf *buf)
+{
+    uint len = 0;
+    for (; buf; buf = buf->next)
+    {
+        len += buf->end - buf->start;
+    }
+
+    return len;
+}
+
+// ------------------------------------------------------------------------------------------------
+uint NetBufFragCount(const NetBuf *buf)
+{
+    uint count = 0;
+    for (; buf; buf = buf->next)
+    {
+        ++count;
+    }
+
+    return count;
+}
+
+// ------------------------------------------------------------------------------------------------
+u8 *NetBufPush(NetBuf *buf, uint len)
+{
+    // Headroom lies between the buffer header and the data, and is never shared
+    if (buf->shared || buf->start - len < (u8 *)(buf + 1))
+    {
+        return 0;
+    }
+
+    buf->start -= len;
+    return buf->start;
+}
+
+// ------------------------------------------------------------------------------------------------
+u8 *NetBufPull(NetBuf *buf, uint len)
+{
+    if (buf->start + len > buf->end)
+    {
+        return 0;
+    }
+
+    u8 *data = buf->start;
+    buf->start += len;
+    return data;
+}
+
+// ------------------------------------------------------------------------------------------------
+void NetBufTrim(NetBuf *buf, uint len)
+{
+    // Keep the first len bytes of the chain
+    for (; buf; buf = buf->next)
+    {
+        uint fragLen = buf->end - buf->start;
+        if (len <= fragLen)
+        {
+            buf->end = buf->start + len;
+
+            NetReleaseBuf(buf->next);
+            buf->next = 0;
+            return;
+        }
+
+        len -= fragLen;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+int NetBufInUse()
+{
+    // Buffers are often released on a different CPU than they were allocated on
+    int count = 0;
+
+    for (uint cpu = 0; cpu < MAX_CPU_COUNT; ++cpu)
+    {
+        for (uint i = 0; i < NET_POOL_COUNT; ++i)
+        {
+            count += s_netBufCaches[cpu][i].inUse;
+        }
+    }
+
+    return count;
+}
+
+// ------------------------------------------------------------------------------------------------
+void NetPrintBufStats()
+{
+    ConsolePrint("net buf: %d in use, %u slabs (%uKB)\n",
+        NetBufInUse(), s_slabTotal, s_slabTotal * (NET_SLAB_SIZE / KB));
+    ConsolePrint("   size   inuse    held    peak  slabs  depot\n");
+
+    for (uint i = 0; i < NET_POOL_COUNT; ++i)
+    {
+        NetBufPool *pool = &s_netBufPools[i];
+
+        int inUse = 0;
+        for (uint cpu = 0; cpu < MAX_CPU_COUNT; ++cpu)
+        {
+            inUse += s_netBufCaches[cpu][i].inUse;
+        }
 
-        LinkAfter(&s_netFreeBufs, &buf->link);
+        ConsolePrint("%7u %7d %7u %7u %6u %6u\n",
+            pool->size, inUse, pool->held, pool->heldPeak, pool->slabCount, pool->fullCount);
     }
 }
@@ -9,8 +9,19 @@
 // ------------------------------------------------------------------------------------------------
 // Net Buffer
 
-#define NET_BUF_SIZE        2048
 #define NET_BUF_START       256     // Room for various protocol headers + header below
+#define NET_BUF_DATA_SIZE   2048    // Data space of a standard buffer, fits a 1500 byte MTU frame
+#define NET_BUF_SIZE        (NET_BUF_START + NET_BUF_DATA_SIZE)
+#define NET_LARGE_BUF_SIZE  (NET_BUF_START + 0x10000)   // Holds a 64KB super-segment
+
+// Size classes by data space - 2K, 4K, 8K, 16K for jumbo frames and 64K
+#define NET_BUF_CLASS_COUNT 5
+
+#define NET_SLAB_SIZE       0x40000 // Memory carved into buffers of one size class at a time
+#define NET_MAG_SIZE        16      // Largest magazine in the per-CPU caches
+#define NET_DEPOT_MAX_FULL  4       // Full magazines a class keeps before returning buffers to slabs
+#define NET_BUF_MAX_FRAGS   8       // Fragments a chain may have when handed to a device
+#define NET_BUF_STAMP_COUNT 9       // Latency trace stages, see net/latency.h
 
 typedef struct NetBuf
 {
@@ -18,17 +29,45 @@ typedef struct NetBuf
     u8             *start;          // offset to data start
     u8             *end;            // offset to data end exclusive
     uint            refCount;
+    uint            size;           // Data space following NET_BUF_START
     u32             seq;            // Data from TCP header used for out-of-order/retransmit
     u8              flags;          // Data from TCP header used for out-of-order/retransmit
+    u8              csumFlags;      // NET_CSUM_* checksum status or offload request
+    u16             csumOffset;     // Offset of checksum field from csumStart
+    u8             *csumStart;      // Start of data covered by a partial checksum
+    u16             gsoSize;        // TX: payload per segment of a super-segment, 0 if none
+    struct NetSlab *slab;           // Slab the buffer was carved from
+    struct NetBuf  *next;           // Next fragment of a chain, owned by this one
+    struct NetBuf  *shared;         // Buffer holding the data of a clone fragment, 0 if own data
+    u32             stamps[NET_BUF_STAMP_COUNT];    // TSC at each stage, 0 if not reached
 } NetBuf;
 
 // ------------------------------------------------------------------------------------------------
-// Globals
+// Checksum Flags
 
-extern int g_netBufAllocCount;
+#define NET_CSUM_IP_VALID   0x01    // RX: IPv4 header checksum verified by hardware
+#define NET_CSUM_L4_VALID   0x02    // RX: TCP/UDP checksum verified by hardware
+#define NET_CSUM_PARTIAL    0x04    // TX: pseudo header sum stored, device completes checksum
 
 // ------------------------------------------------------------------------------------------------
 // Functions
 
 NetBuf *NetAllocBuf();
+NetBuf *NetAllocBufSize(uint size);
+NetBuf *NetAllocLargeBuf();
+void NetAllocBufs(NetBuf **bufs, uint count, uint size);
 void NetReleaseBuf(NetBuf *buf);
+
+// Chains - functions taking a chain are passed its first fragment
+NetBuf *NetCloneBuf(NetBuf *buf);
+NetBuf *NetLinearizeBuf(NetBuf *buf);
+void NetAppendBuf(NetBuf *buf, NetBuf *frag);
+
+uint NetBufLen(const NetBuf *buf);
+uint NetBufFragCount(const NetBuf *buf);
+u8 *NetBufPush(NetBuf *buf, uint len);
+u8 *NetBufPull(NetBuf *buf, uint len);
+void NetBufTrim(NetBuf *buf, uint len);
+
+int NetBufInUse();
+void NetPrintBufStats();
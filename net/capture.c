@@ -0,0 +1,263 @@
+// ------------------------------------------------------------------------------------------------
+// net/capture.c
+// ------------------------------------------------------------------------------------------------
+
+#include "net/capture.h"
+#include "net/port.h"
+#include "net/udp.h"
+#include "console/console.h"
+#include "cpu/tsc.h"
+#include "mem/vm.h"
+#include "stdlib/string.h"
+#include "time/rtc.h"
+
+// ------------------------------------------------------------------------------------------------
+// Ring Records
+
+typedef struct CaptureRecord
+{
+    u64 tsc;
+    u32 wireLen;
+    u32 capLen;
+} CaptureRecord;
+
+#define CAPTURE_ALIGN           8
+
+// ------------------------------------------------------------------------------------------------
+// Globals
+
+bool g_captureActive;
+
+static u8 *s_ring;
+static uint s_head;                     // free running offsets
+static uint s_tail;
+
+static NetIntf *s_intf;
+static uint s_snapLen;
+static BpfInsn s_filter[BPF_MAX_INSNS];
+static uint s_filterCount;
+static bool s_sending;                  // suppresses capture of the stream itself
+
+static abs_time s_baseTime;
+static u64 s_baseTsc;
+
+static uint s_seq;
+static uint s_captured;
+static uint s_filtered;
+static uint s_drops;
+static uint s_msgs;
+
+// ------------------------------------------------------------------------------------------------
+static void CaptureRingWrite(uint offset, const void *src, uint len)
+{
+    uint pos = offset & (CAPTURE_RING_SIZE - 1);
+    uint first = CAPTURE_RING_SIZE - pos;
+    if (first > len)
+    {
+        first = len;
+    }
+
+    memcpy(s_ring + pos, src, first);
+    memcpy(s_ring, (const u8 *)src + first, len - first);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void CaptureRingRead(uint offset, void *dst, uint len)
+{
+    uint pos = offset & (CAPTURE_RING_SIZE - 1);
+    uint first = CAPTURE_RING_SIZE - pos;
+    if (first > len)
+    {
+        first = len;
+    }
+
+    memcpy(dst, s_ring + pos, first);
+    memcpy((u8 *)dst + first, s_ring, len - first);
+}
+
+// ------------------------------------------------------------------------------------------------
+void CaptureStart(NetIntf *intf, uint snapLen)
+{
+    if (!s_ring)
+    {
+        s_ring = VMAlloc(CAPTURE_RING_SIZE);
+    }
+
+    if (snapLen > CAPTURE_MAX_SNAPLEN)
+    {
+        snapLen = CAPTURE_MAX_SNAPLEN;
+    }
+
+    s_intf = intf;
+    s_snapLen = snapLen;
+    s_head = 0;
+    s_tail = 0;
+    s_captured = 0;
+    s_filtered = 0;
+    s_drops = 0;
+    s_msgs = 0;
+
+    // Stream time stamps are wall clock time at the start plus elapsed TSC time
+    DateTime dt;
+    RtcGetTime(&dt);
+    s_baseTime = JoinTime(&dt);
+    s_baseTsc = TscRead();
+
+    g_captureActive = true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void CaptureStop()
+{
+    // Records already in the ring are still streamed
+    g_captureActive = false;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool CaptureSetFilter(const BpfInsn *prog, uint count)
+{
+    if (count && !BpfValidate(prog, count))
+    {
+        return false;
+    }
+
+    memcpy(s_filter, prog, count * sizeof(BpfInsn));
+    s_filterCount = count;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void CapturePacket(NetIntf *intf, const NetBuf *buf)
+{
+    if (s_sending || (s_intf && intf != s_intf && intf->master != s_intf))
+    {
+        return;
+    }
+
+    // Filters see the first fragment of a chain
+    uint wireLen = NetBufLen(buf);
+    uint capLen = s_snapLen;
+
+    if (s_filterCount)
+    {
+        uint keep = BpfRun(s_filter, buf->start, wireLen, buf->end - buf->start);
+        if (!keep)
+        {
+            ++s_filtered;
+            return;
+        }
+
+        if (capLen > keep)
+        {
+            capLen = keep;
+        }
+    }
+
+    if (capLen > wireLen)
+    {
+        capLen = wireLen;
+    }
+
+    uint size = sizeof(CaptureRecord) + ((capLen + CAPTURE_ALIGN - 1) & ~(CAPTURE_ALIGN - 1));
+    if (CAPTURE_RING_SIZE - (s_head - s_tail) < size)
+    {
+        ++s_drops;
+        return;
+    }
+
+    CaptureRecord rec;
+    rec.tsc = TscRead();
+    rec.wireLen = wireLen;
+    rec.capLen = capLen;
+    CaptureRingWrite(s_head, &rec, sizeof(rec));
+
+    uint offset = s_head + sizeof(rec);
+    for (const NetBuf *frag = buf; frag && capLen; frag = frag->next)
+    {
+        uint len = frag->end - frag->start;
+        if (len > capLen)
+        {
+            len = capLen;
+        }
+
+        CaptureRingWrite(offset, frag->start, len);
+        offset += len;
+        capLen -= len;
+    }
+
+    s_head += size;
+    ++s_captured;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void CaptureSend(NetBuf *msg)
+{
+    // Broadcast on each configured interface, sharing one copy of the datagram
+    s_sending = true;
+
+    NetIntf *intf;
+    ListForEach(intf, g_netIntfList, link)
+    {
+        if (!Ipv4AddrEq(&intf->broadcastAddr, &g_nullIpv4Addr))
+        {
+            UdpSendIntf(intf, &intf->broadcastAddr, PORT_CAPTURE, PORT_CAPTURE, NetCloneBuf(msg));
+        }
+    }
+
+    s_sending = false;
+
+    NetReleaseBuf(msg);
+    ++s_msgs;
+}
+
+// ------------------------------------------------------------------------------------------------
+void CapturePoll()
+{
+    for (uint count = 0; count < CAPTURE_MAX_MSGS && s_tail != s_head; ++count)
+    {
+        NetBuf *msg = NetAllocBuf();
+
+        CaptureMsgHeader *hdr = (CaptureMsgHeader *)msg->end;
+        hdr->magic = CAPTURE_MAGIC;
+        hdr->seq = s_seq++;
+        msg->end += sizeof(CaptureMsgHeader);
+
+        // Pack as many records as fit, converting time stamps on the way
+        while (s_tail != s_head)
+        {
+            CaptureRecord rec;
+            CaptureRingRead(s_tail, &rec, sizeof(rec));
+
+            if (msg->end + sizeof(PcapRecord) + rec.capLen > msg->start + CAPTURE_MSG_SIZE)
+            {
+                break;
+            }
+
+            u64 ns = TscCyclesToNs(rec.tsc - s_baseTsc);
+
+            PcapRecord *pcap = (PcapRecord *)msg->end;
+            pcap->sec = s_baseTime + ns / 1000000000;
+            pcap->usec = (ns % 1000000000) / 1000;
+            pcap->capLen = rec.capLen;
+            pcap->wireLen = rec.wireLen;
+            msg->end += sizeof(PcapRecord);
+
+            CaptureRingRead(s_tail + sizeof(rec), msg->end, rec.capLen);
+            msg->end += rec.capLen;
+
+            s_tail += sizeof(rec) + ((rec.capLen + CAPTURE_ALIGN - 1) & ~(CAPTURE_ALIGN - 1));
+        }
+
+        CaptureSend(msg);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void CapturePrint()
+{
+    ConsolePrint("capture: %s on %s, snaplen=%u, filter=%u insns\n",
+        g_captureActive ? "active" : "stopped", s_intf ? s_intf->name : "all",
+        s_snapLen, s_filterCount);
+    ConsolePrint("captured=%u filtered=%u dropped=%u msgs=%u queued=%u bytes\n",
+        s_captured, s_filtered, s_drops, s_msgs, s_head - s_tail);
+}
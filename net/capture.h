@@ -0,0 +1,66 @@
+// ------------------------------------------------------------------------------------------------
+// net/capture.h
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "net/bpf.h"
+#include "net/intf.h"
+
+// ------------------------------------------------------------------------------------------------
+// Configuration
+
+#define CAPTURE_RING_SIZE       0x40000     // Captured bytes waiting to be streamed
+#define CAPTURE_MSG_SIZE        1472        // UDP payload of one stream datagram
+#define CAPTURE_MAX_MSGS        16          // Datagrams streamed per poll
+#define CAPTURE_DEFAULT_SNAPLEN 128
+#define CAPTURE_MAX_SNAPLEN     (CAPTURE_MSG_SIZE - sizeof(CaptureMsgHeader) - sizeof(PcapRecord))
+
+// ------------------------------------------------------------------------------------------------
+// Stream Format
+//
+// Each datagram sent to PORT_CAPTURE holds a header followed by records in the pcap file
+// format, little endian, so the host only has to prepend a pcap file header.
+
+#define CAPTURE_MAGIC           0x70616343  // "Ccap"
+
+typedef struct CaptureMsgHeader
+{
+    u32 magic;
+    u32 seq;                            // detects datagrams lost on the way to the host
+} CaptureMsgHeader;
+
+typedef struct PcapRecord
+{
+    u32 sec;
+    u32 usec;
+    u32 capLen;
+    u32 wireLen;
+} PcapRecord;
+
+// ------------------------------------------------------------------------------------------------
+// Globals
+
+extern bool g_captureActive;
+
+// ------------------------------------------------------------------------------------------------
+// Functions
+
+// Captures frames of intf and ports aggregated into it, or of every interface if intf is 0.
+void CaptureStart(NetIntf *intf, uint snapLen);
+void CaptureStop();
+bool CaptureSetFilter(const BpfInsn *prog, uint count);
+void CapturePoll();
+void CapturePrint();
+
+void CapturePacket(NetIntf *intf, const NetBuf *buf);
+
+// ------------------------------------------------------------------------------------------------
+static inline void CaptureTap(NetIntf *intf, const NetBuf *buf)
+{
+    // Called by drivers for every frame received or sent
+    if (g_captureActive)
+    {
+        CapturePacket(intf, buf);
+    }
+}
@@ -3,6 +3,124 @@
 // ------------------------------------------------------------------------------------------------
 
 #include "net/checksum.h"
+#include "cpu/detect.h"
+
+// Sums are accumulated as 32-bit halves of 64-bit words in memory order.  Each half fits
+// a 64-bit accumulator 2^32 times over, and since 2^16 = 1 modulo 0xffff the halves fold
+// to the same ones' complement sum as adding 16-bit words one at a time.
+
+// ------------------------------------------------------------------------------------------------
+// Unaligned access types
+
+typedef u64 U64u __attribute__((__may_alias__, __aligned__(1)));
+typedef u64 V4u64 __attribute__((__vector_size__(32)));
+typedef u64 V4u64u __attribute__((__vector_size__(32), __may_alias__, __aligned__(1)));
+
+typedef uint (*NetChecksumFunc)(const u8 *data, uint len, uint sum);
+
+// ------------------------------------------------------------------------------------------------
+static uint NetFold64(u64 acc)
+{
+    acc = (acc & 0xffffffff) + (acc >> 32);
+    acc = (acc & 0xffffffff) + (acc >> 32);
+
+    u32 sum = acc;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    return sum;
+}
+
+// ------------------------------------------------------------------------------------------------
+static u64 NetChecksumWords(const u8 *data, uint len, u64 acc)
+{
+    const U64u *p = (const U64u *)data;
+
+    while (len >= 32)
+    {
+        u64 a = p[0];
+        u64 b = p[1];
+        u64 c = p[2];
+        u64 d = p[3];
+
+        acc += (a & 0xffffffff) + (a >> 32);
+        acc += (b & 0xffffffff) + (b >> 32);
+        acc += (c & 0xffffffff) + (c >> 32);
+        acc += (d & 0xffffffff) + (d >> 32);
+
+        p += 4;
+        len -= 32;
+    }
+
+    while (len >= 8)
+    {
+        u64 a = *p++;
+        acc += (a & 0xffffffff) + (a >> 32);
+        len -= 8;
+    }
+
+    // Remaining bytes, a final odd byte is the low half of its word
+    const u8 *tail = (const u8 *)p;
+    u64 a = 0;
+    for (uint i = 0; i < len; ++i)
+    {
+        a |= (u64)tail[i] << (i * 8);
+    }
+
+    return acc + (a & 0xffffffff) + (a >> 32);
+}
+
+// ------------------------------------------------------------------------------------------------
+static uint NetChecksumScalar(const u8 *data, uint len, uint sum)
+{
+    return NetFold64(NetChecksumWords(data, len, sum));
+}
+
+// ------------------------------------------------------------------------------------------------
+__attribute__((__target__("avx2")))
+static uint NetChecksumAvx2(const u8 *data, uint len, uint sum)
+{
+    V4u64 lo = { 0, 0, 0, 0 };
+    V4u64 hi = { 0, 0, 0, 0 };
+
+    const V4u64u *p = (const V4u64u *)data;
+    while (len >= 128)
+    {
+        V4u64 a = p[0];
+        V4u64 b = p[1];
+        V4u64 c = p[2];
+        V4u64 d = p[3];
+
+        lo += (a & 0xffffffff) + (b & 0xffffffff);
+        hi += (a >> 32) + (b >> 32);
+        lo += (c & 0xffffffff) + (d & 0xffffffff);
+        hi += (c >> 32) + (d >> 32);
+
+        p += 4;
+        len -= 128;
+    }
+
+    u64 acc = (u64)sum + lo[0] + lo[1] + lo[2] + lo[3] + hi[0] + hi[1] + hi[2] + hi[3];
+    return NetFold64(NetChecksumWords((const u8 *)p, len, acc));
+}
+
+// ------------------------------------------------------------------------------------------------
+static NetChecksumFunc s_checksumFunc = NetChecksumScalar;
+
+// ------------------------------------------------------------------------------------------------
+void NetChecksumInit(uint cpuFeatures)
+{
+    // 128-bit vectors were measured slower than the unrolled scalar loop, which keeps more
+    // execution ports busy, so only AVX2 replaces it
+    if (cpuFeatures & CPU_FEATURE_AVX2)
+    {
+        s_checksumFunc = NetChecksumAvx2;
+    }
+    else
+    {
+        s_checksumFunc = NetChecksumScalar;
+    }
+}
 
 // ------------------------------------------------------------------------------------------------
 u16 NetChecksum(const u8 *data, const u8 *end)
@@ -14,29 +132,97 @@ u16 NetChecksum(const u8 *data, const u8 *end)
 // ------------------------------------------------------------------------------------------------
 uint NetChecksumAcc(const u8 *data, const u8 *end, uint sum)
 {
+    // Headers are too short to pay for the vector setup
     uint len = end - data;
-    u16 *p = (u16 *)data;
-
-    while (len > 1)
+    if (len < 64)
     {
-        sum += *p++;
-        len -= 2;
+        return NetChecksumScalar(data, len, sum);
     }
 
-    if (len)
+    return s_checksumFunc(data, len, sum);
+}
+
+// ------------------------------------------------------------------------------------------------
+uint NetChecksumAccBuf(const NetBuf *buf, const u8 *start, uint sum)
+{
+    // Sum a chain from start in its first fragment.  A fragment at an odd offset
+    // contributes its bytes to the opposite halves of each word, so swap its sum.
+    uint offset = 0;
+    const u8 *data = start;
+
+    while (buf)
     {
-        sum += *(u8 *)p;
+        uint part = NetChecksumFold(NetChecksumAcc(data, buf->end, 0));
+
+        if (offset & 1)
+        {
+            part = ((part & 0xff) << 8) | (part >> 8);
+        }
+
+        sum += part;
+        offset += buf->end - data;
+
+        buf = buf->next;
+        data = buf ? buf->start : 0;
     }
 
     return sum;
 }
 
+// ------------------------------------------------------------------------------------------------
+uint NetChecksumCopy(u8 *dst, const u8 *src, uint len, uint sum)
+{
+    // Each word is summed while it is in a register for the store
+    U64u *d = (U64u *)dst;
+    const U64u *s = (const U64u *)src;
+    u64 acc = sum;
+
+    while (len >= 32)
+    {
+        u64 a = s[0];
+        u64 b = s[1];
+        u64 c = s[2];
+        u64 e = s[3];
+
+        d[0] = a;
+        d[1] = b;
+        d[2] = c;
+        d[3] = e;
+
+        acc += (a & 0xffffffff) + (a >> 32);
+        acc += (b & 0xffffffff) + (b >> 32);
+        acc += (c & 0xffffffff) + (c >> 32);
+        acc += (e & 0xffffffff) + (e >> 32);
+
+        d += 4;
+        s += 4;
+        len -= 32;
+    }
+
+    // Copy the tail byte by byte and sum it like any other
+    const u8 *tail = (const u8 *)s;
+    u8 *out = (u8 *)d;
+    for (uint i = 0; i < len; ++i)
+    {
+        out[i] = tail[i];
+    }
+
+    return NetFold64(NetChecksumWords(tail, len, acc));
+}
+
 // ------------------------------------------------------------------------------------------------
 u16 NetChecksumFinal(uint sum)
 {
+    // Complemented, in memory order - store directly into the header
+    return ~NetChecksumFold(sum);
+}
+
+// ------------------------------------------------------------------------------------------------
+u16 NetChecksumFold(uint sum)
+{
+    // Folded but not complemented, in memory order - the seed for a partial checksum
     sum = (sum & 0xffff) + (sum >> 16);
     sum += (sum >> 16);
 
-    u16 temp = ~sum;
-    return ((temp & 0x00ff) << 8) | ((temp & 0xff00) >> 8); // TODO - shouldn't swap this twice
+    return sum;
 }
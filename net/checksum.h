@@ -5,6 +5,7 @@
 #pragma once
 
 #include "net/addr.h"
+#include "net/buf.h"
 
 // ------------------------------------------------------------------------------------------------
 // Checksum Header
@@ -21,6 +22,13 @@ typedef struct ChecksumHeader
 // ------------------------------------------------------------------------------------------------
 // Functions
 
+// Checksums and sums are in memory order.  NetChecksumFinal and NetChecksum return the value
+// to store in a header as is, and zero when summed over data that includes a valid checksum.
+void NetChecksumInit(uint cpuFeatures);
+
 u16 NetChecksum(const u8 *data, const u8 *end);
 uint NetChecksumAcc(const u8 *data, const u8 *end, uint sum);
+uint NetChecksumAccBuf(const NetBuf *buf, const u8 *start, uint sum);
+uint NetChecksumCopy(u8 *dst, const u8 *src, uint len, uint sum);
 u16 NetChecksumFinal(uint sum);
+u16 NetChecksumFold(uint sum);
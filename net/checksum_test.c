@@ -0,0 +1,236 @@
+// ------------------------------------------------------------------------------------------------
+// net/checksum_test.c
+// ------------------------------------------------------------------------------------------------
+
+#include "test/test.h"
+#include "cpu/detect.h"
+#include "net/checksum.h"
+#include "stdlib/string.h"
+
+#include <stdio.h>
+
+// ------------------------------------------------------------------------------------------------
+// Original implementation, one 16-bit word per iteration
+
+static uint RefChecksumAcc(const u8 *data, const u8 *end, uint sum)
+{
+    uint len = end - data;
+    const u16 *p = (const u16 *)data;
+
+    while (len > 1)
+    {
+        sum += *p++;
+        len -= 2;
+    }
+
+    if (len)
+    {
+        sum += *(const u8 *)p;
+    }
+
+    return sum;
+}
+
+// ------------------------------------------------------------------------------------------------
+static u16 RefChecksum(const u8 *data, const u8 *end)
+{
+    uint sum = RefChecksumAcc(data, end, 0);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum += (sum >> 16);
+
+    return ~sum;
+}
+
+// ------------------------------------------------------------------------------------------------
+static u8 s_data[0x10000 + 64];
+static u8 s_copy[0x10000 + 64];
+
+static const char *s_variantNames[] = { "scalar", "sse2", "avx2" };
+static const uint s_variantFeatures[] = { 0, CPU_FEATURE_SSE2, CPU_FEATURE_AVX2 };  // sse2 runs scalar
+
+#define VARIANT_COUNT (sizeof(s_variantNames) / sizeof(s_variantNames[0]))
+
+// ------------------------------------------------------------------------------------------------
+static bool VariantSupported(uint variant)
+{
+    if (s_variantFeatures[variant] & CPU_FEATURE_AVX2)
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TestKnownValue()
+{
+    // RFC 1071 section 3 example - sum 0xddf2 in network order
+    const u8 data[] = { 0x00, 0x01, 0xf2, 0x03, 0xf4, 0xf5, 0xf6, 0xf7 };
+
+    u16 fold = NetChecksumFold(NetChecksumAcc(data, data + sizeof(data), 0));
+    ASSERT_EQ_MEM(&fold, "\xdd\xf2", 2);
+
+    // The stored checksum makes the sum over the data zero
+    u8 packet[10];
+    memcpy(packet, data, sizeof(data));
+    packet[8] = 0;
+    packet[9] = 0;
+
+    *(u16 *)(packet + 8) = NetChecksum(packet, packet + 10);
+    ASSERT_EQ_MEM(packet + 8, "\x22\x0d", 2);
+    ASSERT_EQ_HEX16(NetChecksum(packet, packet + 10), 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TestMatchesReference()
+{
+    for (uint variant = 0; variant < VARIANT_COUNT; ++variant)
+    {
+        if (!VariantSupported(variant))
+        {
+            continue;
+        }
+
+        NetChecksumInit(s_variantFeatures[variant]);
+
+        // Every alignment and a range of lengths around the unrolled block sizes
+        for (uint offset = 0; offset < 8; ++offset)
+        {
+            for (uint len = 0; len < 600; ++len)
+            {
+                const u8 *data = s_data + offset;
+                ASSERT_EQ_HEX16(NetChecksum(data, data + len), RefChecksum(data, data + len));
+            }
+        }
+
+        // Partial sums carried across calls
+        uint sum = NetChecksumAcc(s_data, s_data + 12, 0);
+        sum = NetChecksumAcc(s_data + 12, s_data + 1500, sum);
+        ASSERT_EQ_HEX16(NetChecksumFinal(sum), RefChecksum(s_data, s_data + 1500));
+    }
+
+    NetChecksumInit(0);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TestLargeBuffer()
+{
+    // 64KB of ones would overflow a 32-bit accumulator without folding
+    u8 *ones = s_copy;
+    memset(ones, 0xff, 0x10000);
+
+    for (uint variant = 0; variant < VARIANT_COUNT; ++variant)
+    {
+        if (!VariantSupported(variant))
+        {
+            continue;
+        }
+
+        NetChecksumInit(s_variantFeatures[variant]);
+        ASSERT_EQ_HEX16(NetChecksumFold(NetChecksumAcc(ones, ones + 0x10000, 0xffffffff)), 0xffff);
+        ASSERT_EQ_HEX16(NetChecksum(s_data, s_data + 0x10000), RefChecksum(s_data, s_data + 0x10000));
+    }
+
+    NetChecksumInit(0);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TestCopy()
+{
+    for (uint len = 0; len < 300; ++len)
+    {
+        memset(s_copy, 0, len + 8);
+
+        uint sum = NetChecksumCopy(s_copy + 1, s_data + 3, len, 0x1234);
+        ASSERT_EQ_MEM(s_copy + 1, s_data + 3, len);
+        ASSERT_EQ_UINT(s_copy[len + 1], 0);
+        ASSERT_EQ_HEX16(NetChecksumFold(sum),
+            NetChecksumFold(RefChecksumAcc(s_data + 3, s_data + 3 + len, 0x1234)));
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TestChain()
+{
+    // Fragments at odd offsets sum to the same value as contiguous data
+    NetBuf frags[3];
+    memset(frags, 0, sizeof(frags));
+
+    frags[0].start = s_data;
+    frags[0].end = s_data + 7;
+    frags[0].next = &frags[1];
+    frags[1].start = s_data + 7;
+    frags[1].end = s_data + 100;
+    frags[1].next = &frags[2];
+    frags[2].start = s_data + 100;
+    frags[2].end = s_data + 333;
+
+    uint sum = NetChecksumAccBuf(&frags[0], s_data + 2, 0);
+    ASSERT_EQ_HEX16(NetChecksumFinal(sum), RefChecksum(s_data + 2, s_data + 333));
+}
+
+// ------------------------------------------------------------------------------------------------
+static void Benchmark(const char *name, uint len, uint variant)
+{
+    const uint iterations = 0x1000000 / len;
+    uint sum = 0;
+
+    u64 start = __builtin_ia32_rdtsc();
+    for (uint i = 0; i < iterations; ++i)
+    {
+        if (variant == ~0u)
+        {
+            sum += NetChecksumFold(RefChecksumAcc(s_data, s_data + len, 0));
+        }
+        else
+        {
+            sum += NetChecksumFold(NetChecksumAcc(s_data, s_data + len, 0));
+        }
+    }
+    u64 cycles = __builtin_ia32_rdtsc() - start;
+
+    printf("-- %-10s %6u bytes: %6.3f cycles/byte (%x)\n",
+        name, len, (double)cycles / (iterations * len), sum);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void RunBenchmarks()
+{
+    static const uint sizes[] = { 64, 1500, 0x10000 };
+
+    for (uint i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+        Benchmark("reference", sizes[i], ~0u);
+
+        for (uint variant = 0; variant < VARIANT_COUNT; ++variant)
+        {
+            if (VariantSupported(variant))
+            {
+                NetChecksumInit(s_variantFeatures[variant]);
+                Benchmark(s_variantNames[variant], sizes[i], variant);
+            }
+        }
+    }
+
+    NetChecksumInit(0);
+}
+
+// ------------------------------------------------------------------------------------------------
+int main(int argc, const char **argv)
+{
+    srand(1);
+    for (uint i = 0; i < sizeof(s_data); ++i)
+    {
+        s_data[i] = rand();
+    }
+
+    TestKnownValue();
+    TestMatchesReference();
+    TestLargeBuffer();
+    TestCopy();
+    TestChain();
+
+    RunBenchmarks();
+
+    return EXIT_SUCCESS;
+}
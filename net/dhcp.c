@@ -90,6 +90,11 @@ typedef struct DhcpOptions
 #define DHCP_RELEASE                    7
 #define DHCP_INFORM                     8
 
+// ------------------------------------------------------------------------------------------------
+// Static Variables
+
+static UdpSocket *s_dhcpSocket;
+
 // ------------------------------------------------------------------------------------------------
 static bool DhcpParseOptions(DhcpOptions *opt, const NetBuf *pkt)
 {
@@ -290,10 +295,16 @@ static void DhcpAck(NetIntf *intf, const DhcpHeader *hdr, const DhcpOptions *opt
 }
 
 // ------------------------------------------------------------------------------------------------
-void DhcpRecv(NetIntf *intf, const NetBuf *pkt)
+static void DhcpRecv(UdpSocket *sock, NetIntf *intf,
+    const Ipv4Addr *srcAddr, u16 srcPort, const NetBuf *pkt)
 {
     DhcpPrint(pkt);
 
+    if (srcPort != PORT_BOOTP_SERVER)
+    {
+        return;
+    }
+
     if (pkt->start + sizeof(DhcpHeader) > pkt->end)
     {
         return;
@@ -346,6 +357,21 @@ void DhcpDiscover(NetIntf *intf)
 {
     ConsolePrint("DHCP discovery\n");
 
+    // Listen on the client port for replies
+    if (!s_dhcpSocket)
+    {
+        s_dhcpSocket = UdpCreate();
+        s_dhcpSocket->onRecv = DhcpRecv;
+
+        if (!UdpBind(s_dhcpSocket, 0, PORT_BOOTP_CLIENT))
+        {
+            // Retry the bind on the next call rather than send from port 0
+            UdpClose(s_dhcpSocket);
+            s_dhcpSocket = 0;
+            return;
+        }
+    }
+
     NetBuf *pkt = NetAllocBuf();
 
     // Header
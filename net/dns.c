@@ -4,11 +4,14 @@
 
 #include "net/dns.h"
 #include "net/buf.h"
+#include "net/net.h"
 #include "net/port.h"
 #include "net/swap.h"
 #include "net/udp.h"
 #include "console/console.h"
+#include "mem/vm.h"
 #include "stdlib/string.h"
+#include "time/pit.h"
 
 // ------------------------------------------------------------------------------------------------
 // DNS Header
@@ -23,46 +26,265 @@ typedef struct DnsHeader
     u16 additionalCount;
 } PACKED DnsHeader;
 
+// ------------------------------------------------------------------------------------------------
+// DNS Protocol
+
+#define DNS_FLAG_RESPONSE       0x8000
+#define DNS_FLAG_RD             0x0100
+#define DNS_RCODE_MASK          0x000f
+
+#define DNS_RCODE_OK            0
+#define DNS_RCODE_NXDOMAIN      3
+
+#define DNS_TYPE_A              1
+#define DNS_TYPE_CNAME          5
+#define DNS_TYPE_SOA            6
+#define DNS_CLASS_IN            1
+
+#define DNS_MAX_POINTERS        16      // Compression pointers followed per name
+
+// ------------------------------------------------------------------------------------------------
+// DNS Cache
+
+#define DNS_FREE                0
+#define DNS_PENDING             1       // Query outstanding, callers waiting
+#define DNS_RESOLVED            2       // Address valid until expiry
+#define DNS_NEGATIVE            3       // Name does not exist until expiry
+
+typedef struct DnsWaiter
+{
+    Link link;
+    DnsCallback callback;
+    void *ctx;
+} DnsWaiter;
+
+typedef struct DnsEntry
+{
+    Link link;                          // LRU list or free list
+    uint state;
+    char name[DNS_NAME_SIZE];
+    Ipv4Addr addr;
+    u32 expires;
+    u32 sent;
+    uint retries;
+    u16 id;
+    UdpSocket *sock;                    // bound for the outstanding query only
+    Link waiters;
+} DnsEntry;
+
 // ------------------------------------------------------------------------------------------------
 // Globals
 
 Ipv4Addr g_dnsServer;
 
 // ------------------------------------------------------------------------------------------------
-void DnsRecv(NetIntf *intf, const NetBuf *pkt)
+// Static Variables
+
+static DnsEntry s_dnsEntries[DNS_CACHE_SIZE];
+static Link s_dnsLru;                   // least recently used first
+static Link s_dnsFree;
+static Link s_dnsFreeWaiters = { &s_dnsFreeWaiters, &s_dnsFreeWaiters };
+static u32 s_dnsNextPoll;
+
+static const char *s_dnsStateStrs[] =
 {
-    DnsPrint(pkt);
+    "FREE",
+    "PENDING",
+    "RESOLVED",
+    "NEGATIVE",
+};
+
+// ------------------------------------------------------------------------------------------------
+static const u8 *DnsReadName(const NetBuf *pkt, const u8 *p, char *name, uint size)
+{
+    // Decodes a possibly compressed name into lower case dotted form and returns
+    // the position following the name in the original record.
+    const u8 *next = 0;
+    char *out = name;
+    char *outEnd = name + size - 1;
+    uint pointers = 0;
+
+    for (;;)
+    {
+        if (p >= pkt->end)
+        {
+            return 0;
+        }
+
+        u8 count = *p++;
+
+        if (count >= 0xc0)
+        {
+            if (p >= pkt->end || ++pointers > DNS_MAX_POINTERS)
+            {
+                return 0;
+            }
+
+            uint offset = ((count & 0x3f) << 8) | *p++;
+            if (!next)
+            {
+                next = p;
+            }
+
+            p = pkt->start + offset;
+        }
+        else if (count >= 64)
+        {
+            return 0;
+        }
+        else if (count > 0)
+        {
+            if (p + count > pkt->end || out + count + 1 > outEnd)
+            {
+                return 0;
+            }
+
+            if (out != name)
+            {
+                *out++ = '.';
+            }
+
+            for (uint i = 0; i < count; ++i)
+            {
+                char c = p[i];
+                *out++ = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+            }
+
+            p += count;
+        }
+        else
+        {
+            *out = '\0';
+            return next ? next : p;
+        }
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
-void DnsQueryHost(const char *host, uint id)
+static DnsEntry *DnsLookup(const char *name)
 {
-    // Skip request if not configured
-    if (Ipv4AddrEq(&g_dnsServer, &g_nullIpv4Addr))
+    DnsEntry *entry;
+    ListForEach(entry, s_dnsLru, link)
     {
-        return;
+        if (strcmp(entry->name, name) == 0)
+        {
+            return entry;
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void DnsFree(DnsEntry *entry)
+{
+    entry->state = DNS_FREE;
+    LinkMoveBefore(&s_dnsFree, &entry->link);
+}
+
+// ------------------------------------------------------------------------------------------------
+static DnsEntry *DnsAdd(const char *name)
+{
+    // Reuse the least recently used entry that has no query outstanding
+    if (ListIsEmpty(&s_dnsFree))
+    {
+        DnsEntry *victim;
+        ListForEach(victim, s_dnsLru, link)
+        {
+            if (victim->state != DNS_PENDING)
+            {
+                DnsFree(victim);
+                break;
+            }
+        }
+
+        if (ListIsEmpty(&s_dnsFree))
+        {
+            return 0;
+        }
+    }
+
+    DnsEntry *entry = LinkData(s_dnsFree.next, DnsEntry, link);
+    LinkMoveBefore(&s_dnsLru, &entry->link);
+
+    strcpy(entry->name, name);
+    entry->state = DNS_FREE;
+    entry->addr = g_nullIpv4Addr;
+    entry->expires = 0;
+    entry->retries = 0;
+    LinkInit(&entry->waiters);
+
+    return entry;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void DnsComplete(DnsEntry *entry, const Ipv4Addr *addr)
+{
+    // Detach the waiters first so callbacks can issue new lookups
+    Link batch;
+    LinkInit(&batch);
+    if (!ListIsEmpty(&entry->waiters))
+    {
+        LinkAfter(&entry->waiters, &batch);
+        LinkRemove(&entry->waiters);
+        LinkInit(&entry->waiters);
+    }
+
+    char name[DNS_NAME_SIZE];
+    strcpy(name, entry->name);
+
+    Ipv4Addr result;
+    if (addr)
+    {
+        result = *addr;
     }
 
+    DnsWaiter *waiter;
+    DnsWaiter *next;
+    ListForEachSafe(waiter, next, batch, link)
+    {
+        LinkMoveBefore(&s_dnsFreeWaiters, &waiter->link);
+        waiter->callback(waiter->ctx, name, addr ? &result : 0);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void DnsCloseQuery(DnsEntry *entry)
+{
+    UdpClose(entry->sock);
+    entry->sock = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void DnsFail(DnsEntry *entry)
+{
+    // Transient failures are not cached
+    DnsCloseQuery(entry);
+    DnsFree(entry);
+    DnsComplete(entry, 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void DnsSendQuery(DnsEntry *entry)
+{
+    entry->sent = g_pitTicks;
+    ++entry->retries;
+
     NetBuf *pkt = NetAllocBuf();
 
     DnsHeader *hdr = (DnsHeader *)pkt->start;
-    hdr->id = NetSwap16(id);
-    hdr->flags = NetSwap16(0x0100);    // Recursion Desired
+    hdr->id = NetSwap16(entry->id);
+    hdr->flags = NetSwap16(DNS_FLAG_RD);
     hdr->questionCount = NetSwap16(1);
     hdr->answerCount = NetSwap16(0);
     hdr->authorityCount = NetSwap16(0);
     hdr->additionalCount = NetSwap16(0);
 
     u8 *q = pkt->start + sizeof(DnsHeader);
-    uint hostLen = strlen(host);
-    if (hostLen >= 256)
-    {
-        return;
-    }
 
     // Convert hostname to DNS format
     u8 *labelHead = q++;
-    const char *p = host;
+    const char *p = entry->name;
     for (;;)
     {
         char c = *p++;
@@ -82,16 +304,313 @@ void DnsQueryHost(const char *host, uint id)
         }
     }
 
-    *(u16 *)q = NetSwap16(1);   // query type
+    *(u16 *)q = NetSwap16(DNS_TYPE_A);      // query type
     q += sizeof(u16);
-    *(u16 *)q = NetSwap16(1);   // query class
+    *(u16 *)q = NetSwap16(DNS_CLASS_IN);    // query class
     q += sizeof(u16);
 
     pkt->end = q;
-    uint srcPort = NetEphemeralPort();
 
     DnsPrint(pkt);
-    UdpSend(&g_dnsServer, PORT_DNS, srcPort, pkt);
+    UdpSend(&g_dnsServer, PORT_DNS, entry->sock->localPort, pkt);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void DnsRecv(UdpSocket *sock, NetIntf *intf,
+    const Ipv4Addr *srcAddr, u16 srcPort, const NetBuf *pkt)
+{
+    // Each query has its own socket, so only the server can answer it
+    DnsEntry *entry = sock->ctx;
+    if (srcPort != PORT_DNS || !Ipv4AddrEq(srcAddr, &g_dnsServer))
+    {
+        return;
+    }
+
+    DnsPrint(pkt);
+
+    // Validate header and question
+    if (pkt->start + sizeof(DnsHeader) > pkt->end)
+    {
+        return;
+    }
+
+    const DnsHeader *hdr = (const DnsHeader *)pkt->start;
+
+    u16 id = NetSwap16(hdr->id);
+    u16 flags = NetSwap16(hdr->flags);
+    u16 answerCount = NetSwap16(hdr->answerCount);
+    u16 authorityCount = NetSwap16(hdr->authorityCount);
+
+    if (~flags & DNS_FLAG_RESPONSE || NetSwap16(hdr->questionCount) != 1)
+    {
+        return;
+    }
+
+    char name[DNS_NAME_SIZE];
+    const u8 *p = DnsReadName(pkt, pkt->start + sizeof(DnsHeader), name, sizeof(name));
+    if (!p || p + 4 > pkt->end)
+    {
+        return;
+    }
+
+    p += 4;
+
+    // Match outstanding query
+    if (entry->state != DNS_PENDING || entry->id != id || strcmp(entry->name, name) != 0)
+    {
+        return;
+    }
+
+    uint rcode = flags & DNS_RCODE_MASK;
+    if (rcode != DNS_RCODE_OK && rcode != DNS_RCODE_NXDOMAIN)
+    {
+        DnsFail(entry);
+        return;
+    }
+
+    // Follow the CNAME chain from the query name to an address record
+    uint ttl = DNS_MAX_TTL;
+    bool found = false;
+
+    char owner[DNS_NAME_SIZE];
+    char target[DNS_NAME_SIZE];
+
+    for (uint i = 0; i < answerCount + authorityCount; ++i)
+    {
+        p = DnsReadName(pkt, p, owner, sizeof(owner));
+        if (!p || p + 10 > pkt->end)
+        {
+            break;
+        }
+
+        u16 type = (p[0] << 8) | p[1];
+        u16 class = (p[2] << 8) | p[3];
+        u32 rrTtl = (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+        u16 dataLen = (p[8] << 8) | p[9];
+        p += 10;
+
+        const u8 *data = p;
+        p += dataLen;
+        if (p > pkt->end)
+        {
+            break;
+        }
+
+        if (class != DNS_CLASS_IN)
+        {
+            continue;
+        }
+
+        if (i < answerCount)
+        {
+            // Answer section
+            if (found || strcmp(owner, name) != 0)
+            {
+                continue;
+            }
+
+            if (type == DNS_TYPE_CNAME)
+            {
+                if (!DnsReadName(pkt, data, target, sizeof(target)))
+                {
+                    break;
+                }
+
+                strcpy(name, target);
+                ttl = rrTtl < ttl ? rrTtl : ttl;
+            }
+            else if (type == DNS_TYPE_A && dataLen == sizeof(Ipv4Addr))
+            {
+                entry->addr = *(const Ipv4Addr *)data;
+                ttl = rrTtl < ttl ? rrTtl : ttl;
+                found = true;
+            }
+        }
+        else if (!found && type == DNS_TYPE_SOA)
+        {
+            // Negative TTL is the lesser of the SOA TTL and its minimum field
+            const u8 *q = DnsReadName(pkt, data, target, sizeof(target));
+            q = q ? DnsReadName(pkt, q, target, sizeof(target)) : 0;
+            if (q && q + 20 <= p)
+            {
+                u32 minimum = (q[16] << 24) | (q[17] << 16) | (q[18] << 8) | q[19];
+                ttl = minimum < rrTtl ? minimum : rrTtl;
+            }
+        }
+    }
+
+    if (!found && ttl == DNS_MAX_TTL)
+    {
+        ttl = DNS_NEGATIVE_TTL;
+    }
+
+    if (ttl > DNS_MAX_TTL)
+    {
+        ttl = DNS_MAX_TTL;
+    }
+
+    entry->state = found ? DNS_RESOLVED : DNS_NEGATIVE;
+    entry->expires = g_pitTicks + ttl * 1000;
+    DnsCloseQuery(entry);
+
+    DnsComplete(entry, found ? &entry->addr : 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+void DnsInit()
+{
+    LinkInit(&s_dnsLru);
+    LinkInit(&s_dnsFree);
+
+    DnsEntry *entry = s_dnsEntries;
+    DnsEntry *end = entry + DNS_CACHE_SIZE;
+    for (; entry != end; ++entry)
+    {
+        memset(entry, 0, sizeof(DnsEntry));
+        LinkInit(&entry->waiters);
+        LinkBefore(&s_dnsFree, &entry->link);
+    }
+
+    s_dnsNextPoll = g_pitTicks + DNS_POLL_INTERVAL;
+}
+
+// ------------------------------------------------------------------------------------------------
+void DnsPoll()
+{
+    if ((int)(g_pitTicks - s_dnsNextPoll) < 0)
+    {
+        return;
+    }
+
+    s_dnsNextPoll = g_pitTicks + DNS_POLL_INTERVAL;
+
+    DnsEntry *entry;
+    DnsEntry *next;
+    ListForEachSafe(entry, next, s_dnsLru, link)
+    {
+        switch (entry->state)
+        {
+        case DNS_PENDING:
+            // Retransmit query, giving up after too many
+            if (g_pitTicks - entry->sent >= DNS_RETRANS_TIME)
+            {
+                if (entry->retries < DNS_MAX_RETRIES)
+                {
+                    DnsSendQuery(entry);
+                }
+                else
+                {
+                    DnsFail(entry);
+                    return;     // callbacks may have changed the list
+                }
+            }
+            break;
+
+        case DNS_RESOLVED:
+        case DNS_NEGATIVE:
+            if ((int)(g_pitTicks - entry->expires) >= 0)
+            {
+                DnsFree(entry);
+            }
+            break;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void DnsResolve(const char *host, DnsCallback callback, void *ctx)
+{
+    // Normalize name for cache lookup
+    char name[DNS_NAME_SIZE];
+    uint len = strlen(host);
+    if (len == 0 || len >= DNS_NAME_SIZE)
+    {
+        callback(ctx, host, 0);
+        return;
+    }
+
+    for (uint i = 0; i <= len; ++i)
+    {
+        char c = host[i];
+        name[i] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+
+    DnsEntry *entry = DnsLookup(name);
+    if (entry && entry->state != DNS_PENDING && (int)(g_pitTicks - entry->expires) >= 0)
+    {
+        DnsFree(entry);
+        entry = 0;
+    }
+
+    if (entry)
+    {
+        LinkMoveBefore(&s_dnsLru, &entry->link);
+
+        if (entry->state == DNS_RESOLVED)
+        {
+            callback(ctx, host, &entry->addr);
+            return;
+        }
+        else if (entry->state == DNS_NEGATIVE)
+        {
+            callback(ctx, host, 0);
+            return;
+        }
+
+        // Otherwise a query is already outstanding for this name
+    }
+    else
+    {
+        // Skip request if not configured
+        if (Ipv4AddrEq(&g_dnsServer, &g_nullIpv4Addr))
+        {
+            callback(ctx, host, 0);
+            return;
+        }
+
+        entry = DnsAdd(name);
+        if (!entry)
+        {
+            callback(ctx, host, 0);
+            return;
+        }
+
+        // A random ID and source port per query leave forged replies 32 bits to guess
+        UdpSocket *sock = UdpCreate();
+        sock->onRecv = DnsRecv;
+        sock->ctx = entry;
+
+        if (!UdpBind(sock, 0, 0))
+        {
+            UdpClose(sock);
+            DnsFree(entry);
+            callback(ctx, host, 0);
+            return;
+        }
+
+        entry->state = DNS_PENDING;
+        entry->id = NetRandom();
+        entry->sock = sock;
+        DnsSendQuery(entry);
+    }
+
+    // Wait for the outstanding query
+    DnsWaiter *waiter;
+
+    Link *p = s_dnsFreeWaiters.next;
+    if (p != &s_dnsFreeWaiters)
+    {
+        LinkRemove(p);
+        waiter = LinkData(p, DnsWaiter, link);
+    }
+    else
+    {
+        waiter = VMAlloc(sizeof(DnsWaiter));
+    }
+
+    waiter->callback = callback;
+    waiter->ctx = ctx;
+    LinkBefore(&entry->waiters, &waiter->link);
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -104,7 +623,7 @@ static const u8 *DnsPrintHost(const NetBuf *pkt, const u8 *p, bool first)
         if (count >= 64)
         {
             u8 n = *p++;
-            uint offset = ((count & 0x3f) << 6) | n;
+            uint offset = ((count & 0x3f) << 8) | n;
 
             DnsPrintHost(pkt, pkt->start + offset, first);
             return p;
@@ -183,6 +702,11 @@ static const u8 *DnsPrintRR(const char *hdr, const NetBuf *pkt, const u8 *p)
 // ------------------------------------------------------------------------------------------------
 void DnsPrint(const NetBuf *pkt)
 {
+    if (~g_netTrace & TRACE_APP)
+    {
+        return;
+    }
+
     const DnsHeader *hdr = (const DnsHeader *)pkt->start;
 
     u16 id = NetSwap16(hdr->id);
@@ -217,3 +741,21 @@ void DnsPrint(const NetBuf *pkt)
         p = DnsPrintRR("Add", pkt, p);
     }
 }
+
+// ------------------------------------------------------------------------------------------------
+void DnsPrintCache()
+{
+    ConsolePrint("%-15s  %-8s  %-6s  %s\n", "Address", "State", "TTL", "Name");
+
+    DnsEntry *entry;
+    ListForEach(entry, s_dnsLru, link)
+    {
+        char addrStr[IPV4_ADDR_STRING_SIZE];
+        Ipv4AddrToStr(addrStr, sizeof(addrStr), &entry->addr);
+
+        int ttl = entry->state == DNS_PENDING ? 0 : (int)(entry->expires - g_pitTicks) / 1000;
+
+        ConsolePrint("%-15s  %-8s  %-6d  %s\n",
+            addrStr, s_dnsStateStrs[entry->state], ttl, entry->name);
+    }
+}
@@ -6,6 +6,18 @@
 
 #include "net/intf.h"
 
+// ------------------------------------------------------------------------------------------------
+// Configuration
+
+#define DNS_CACHE_SIZE          64          // Maximum number of cached names
+#define DNS_NAME_SIZE           256         // Maximum host name length including terminator
+
+#define DNS_MAX_TTL             86400       // Upper bound on cached TTL (seconds)
+#define DNS_NEGATIVE_TTL        60          // Negative TTL when the server provides no SOA (seconds)
+#define DNS_POLL_INTERVAL       100         // Time between retransmit scans (ms)
+#define DNS_RETRANS_TIME        1000        // Time between query retransmissions (ms)
+#define DNS_MAX_RETRIES         3           // Queries sent before giving up
+
 // ------------------------------------------------------------------------------------------------
 // Globals
 
@@ -14,7 +26,13 @@ extern Ipv4Addr g_dnsServer;
 // ------------------------------------------------------------------------------------------------
 // Functions
 
-void DnsRecv(NetIntf *intf, const NetBuf *buf);
-void DnsQueryHost(const char *host, uint id);
+// Completion callback - addr is null if the name could not be resolved.
+typedef void (*DnsCallback)(void *ctx, const char *host, const Ipv4Addr *addr);
+
+void DnsInit();
+void DnsPoll();
+
+void DnsResolve(const char *host, DnsCallback callback, void *ctx);
 
 void DnsPrint(const NetBuf *buf);
+void DnsPrintCache();
@@ -4,11 +4,19 @@
 
 #include "net/eth.h"
 #include "net/arp.h"
+#include "net/gso.h"
 #include "net/ipv4.h"
 #include "net/ipv6.h"
+#include "net/latency.h"
 #include "net/net.h"
 #include "net/swap.h"
 #include "console/console.h"
+#include "stdlib/format.h"
+
+// ------------------------------------------------------------------------------------------------
+// Locals
+
+static uint s_intfCount;
 
 // ------------------------------------------------------------------------------------------------
 static bool EthDecode(EthPacket *ep, NetBuf *pkt)
@@ -53,12 +61,32 @@ static bool EthDecode(EthPacket *ep, NetBuf *pkt)
 // ------------------------------------------------------------------------------------------------
 void EthRecv(NetIntf *intf, NetBuf *pkt)
 {
+    LatencyStamp(pkt, LAT_RX_ETH);
     EthPrint(pkt);
 
+    // Ports of an aggregate count and deliver to the stack as the aggregate
+    NetIntf *port = intf;
+    if (intf->master)
+    {
+        intf = intf->master;
+    }
+
+    ++intf->stats.rxPackets;
+    intf->stats.rxBytes += NetBufLen(pkt);
+
     EthPacket ep;
     if (!EthDecode(&ep, pkt))
     {
         // Bad packet or one we don't care about (e.g. STP packets)
+        NetIntfDrop(intf, NET_DROP_HEADER);
+        return;
+    }
+
+    // Hash collisions in the multicast filter and promiscuous capture let through frames
+    // that the stack should not see
+    if ((port->promisc || ep.hdr->dst.n[0] & 1) && !NetIntfAcceptAddr(port, &ep.hdr->dst))
+    {
+        NetIntfDrop(intf, NET_DROP_FILTER);
         return;
     }
 
@@ -78,12 +106,18 @@ void EthRecv(NetIntf *intf, NetBuf *pkt)
     case ET_IPV6:
         Ipv6Recv(intf, pkt);
         break;
+
+    default:
+        NetIntfDrop(intf, NET_DROP_ETHERTYPE);
+        break;
     }
 }
 
 // ------------------------------------------------------------------------------------------------
 void EthSendIntf(NetIntf *intf, const void *dstAddr, u16 etherType, NetBuf *pkt)
 {
+    LatencyStamp(pkt, LAT_TX_ETH);
+
     // Determine ethernet address by protocol of packet
     const EthAddr *dstEthAddr = 0;
 
@@ -123,7 +157,8 @@ void EthSendIntf(NetIntf *intf, const void *dstAddr, u16 etherType, NetBuf *pkt)
     // Skip packets without a destination
     if (!dstEthAddr)
     {
-        ConsolePrint("Dropped packet\n");
+        NetIntfDrop(intf, NET_DROP_NO_DEST);
+        NetReleaseBuf(pkt);
         return;
     }
 
@@ -135,9 +170,61 @@ void EthSendIntf(NetIntf *intf, const void *dstAddr, u16 etherType, NetBuf *pkt)
     hdr->src = intf->ethAddr;
     hdr->etherType = NetSwap16(etherType);
 
-    // Transmit
+    // Devices without scatter-gather take one contiguous frame
+    if (pkt->next && (~intf->caps & NET_INTF_SG || NetBufFragCount(pkt) > NET_BUF_MAX_FRAGS))
+    {
+        pkt = NetLinearizeBuf(pkt);
+        if (!pkt)
+        {
+            NetIntfDrop(intf, NET_DROP_NO_BUF);
+            return;
+        }
+    }
+
+    ++intf->stats.txPackets;
+    intf->stats.txBytes += NetBufLen(pkt);
+
+    // Transmit, segmenting in software when the device cannot
     EthPrint(pkt);
-    intf->devSend(pkt);
+    if (pkt->gsoSize && ~intf->caps & NET_INTF_TSO)
+    {
+        GsoSend(intf, pkt);
+    }
+    else
+    {
+        intf->devSend(intf, pkt);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void EthIntfName(char *name, uint size)
+{
+    snprintf(name, size, "eth%u", s_intfCount++);
+}
+
+// ------------------------------------------------------------------------------------------------
+u32 EthFlowHash(const NetBuf *pkt)
+{
+    // Hash IPv4 addresses and TCP/UDP ports so every packet of a flow maps alike
+    const u8 *p = pkt->start;
+    if (pkt->end - p < 34 || p[12] != 0x08 || p[13] != 0x00)
+    {
+        return 0;
+    }
+
+    const u8 *ip = p + 14;
+    u32 hash = *(const u32 *)(ip + 12) ^ *(const u32 *)(ip + 16);
+
+    uint ihl = (ip[0] & 0xf) * 4;
+    if ((ip[9] == IP_PROTOCOL_TCP || ip[9] == IP_PROTOCOL_UDP) && ip + ihl + 4 <= pkt->end)
+    {
+        hash ^= *(const u32 *)(ip + ihl);
+    }
+
+    hash ^= hash >> 16;
+    hash ^= hash >> 8;
+
+    return hash;
 }
 
 // ------------------------------------------------------------------------------------------------
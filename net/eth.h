@@ -13,6 +13,12 @@
 #define ET_ARP                          0x0806
 #define ET_IPV6                         0x86DD
 
+// ------------------------------------------------------------------------------------------------
+// Frame Limits
+
+#define ETH_MAX_MTU                     9000        // Largest jumbo frame payload
+#define ETH_FRAME_OVERHEAD              18          // Header plus 802.1Q tag a frame may carry
+
 // ------------------------------------------------------------------------------------------------
 // Ethernet Header
 
@@ -39,4 +45,7 @@ typedef struct EthPacket
 void EthRecv(NetIntf *intf, NetBuf *pkt);
 void EthSendIntf(NetIntf *intf, const void *dstAddr, u16 etherType, NetBuf *pkt);
 
+void EthIntfName(char *name, uint size);
+u32 EthFlowHash(const NetBuf *pkt);
+
 void EthPrint(NetBuf *pkt);
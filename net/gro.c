@@ -0,0 +1,268 @@
+// ------------------------------------------------------------------------------------------------
+// net/gro.c
+// ------------------------------------------------------------------------------------------------
+
+#include "net/gro.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/ipv4.h"
+#include "net/swap.h"
+#include "net/tcp.h"
+#include "console/console.h"
+#include "stdlib/string.h"
+
+// ------------------------------------------------------------------------------------------------
+// Held Flow
+
+typedef struct GroFlow
+{
+    NetIntf *intf;
+    NetBuf *pkt;                        // first segment, later ones chained behind it
+    NetBuf *tail;                       // last fragment of the chain
+    uint count;                         // segments merged into pkt
+    u32 nextSeq;                        // sequence number the next segment must start at
+} GroFlow;
+
+static GroFlow s_flows[GRO_MAX_FLOWS];
+static uint s_flowCount;
+
+// statistics
+static uint s_groSegments;
+static uint s_groPackets;
+
+// ------------------------------------------------------------------------------------------------
+static Ipv4Header *GroIpv4Header(NetBuf *pkt)
+{
+    return (Ipv4Header *)(pkt->start + sizeof(EthHeader));
+}
+
+// ------------------------------------------------------------------------------------------------
+static TcpHeader *GroTcpHeader(NetBuf *pkt)
+{
+    return (TcpHeader *)(pkt->start + sizeof(EthHeader) + sizeof(Ipv4Header));
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool GroCandidate(NetBuf *pkt)
+{
+    // Only plain Ethernet + IPv4 + TCP data segments with a verified TCP checksum
+    if (~pkt->csumFlags & NET_CSUM_L4_VALID)
+    {
+        return false;
+    }
+
+    if (pkt->start + sizeof(EthHeader) + sizeof(Ipv4Header) + sizeof(TcpHeader) > pkt->end)
+    {
+        return false;
+    }
+
+    const EthHeader *ethHdr = (const EthHeader *)pkt->start;
+    if (ethHdr->etherType != NetSwap16(ET_IPV4))
+    {
+        return false;
+    }
+
+    const Ipv4Header *ipHdr = GroIpv4Header(pkt);
+    if (ipHdr->verIhl != ((4 << 4) | 5) ||
+        ipHdr->protocol != IP_PROTOCOL_TCP ||
+        (NetSwap16(ipHdr->offset) & 0x3fff))
+    {
+        return false;
+    }
+
+    u8 *ipEnd = (u8 *)ipHdr + NetSwap16(ipHdr->len);
+    if (ipEnd > pkt->end)
+    {
+        return false;
+    }
+
+    if (~pkt->csumFlags & NET_CSUM_IP_VALID &&
+        NetChecksum((const u8 *)ipHdr, (const u8 *)ipHdr + sizeof(Ipv4Header)))
+    {
+        return false;
+    }
+
+    const TcpHeader *tcpHdr = GroTcpHeader(pkt);
+    const u8 *data = (const u8 *)tcpHdr + (tcpHdr->off >> 2);
+    if (data >= ipEnd)
+    {
+        return false;
+    }
+
+    if ((tcpHdr->flags & ~TCP_PSH) != TCP_ACK)
+    {
+        return false;
+    }
+
+    // Drop Ethernet padding so the payload ends at the IP datagram
+    pkt->end = ipEnd;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool GroSameFlow(NetBuf *a, NetBuf *b)
+{
+    const Ipv4Header *ipA = GroIpv4Header(a);
+    const Ipv4Header *ipB = GroIpv4Header(b);
+    const TcpHeader *tcpA = GroTcpHeader(a);
+    const TcpHeader *tcpB = GroTcpHeader(b);
+
+    return ipA->src.u.bits == ipB->src.u.bits &&
+        ipA->dst.u.bits == ipB->dst.u.bits &&
+        tcpA->srcPort == tcpB->srcPort &&
+        tcpA->dstPort == tcpB->dstPort;
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool GroCanMerge(GroFlow *flow, NetBuf *pkt)
+{
+    NetBuf *head = flow->pkt;
+    const TcpHeader *tcpHead = GroTcpHeader(head);
+    const TcpHeader *tcpHdr = GroTcpHeader(pkt);
+
+    // Segments must be in order, acknowledge the same data and carry identical options
+    if (NetSwap32(tcpHdr->seq) != flow->nextSeq || tcpHdr->ack != tcpHead->ack)
+    {
+        return false;
+    }
+
+    if (tcpHdr->off != tcpHead->off || tcpHead->flags & TCP_PSH)
+    {
+        return false;
+    }
+
+    uint optLen = (tcpHdr->off >> 2) - sizeof(TcpHeader);
+    if (memcmp(tcpHead + 1, tcpHdr + 1, optLen))
+    {
+        return false;
+    }
+
+    uint hdrLen = (u8 *)tcpHdr + (tcpHdr->off >> 2) - pkt->start;
+    uint dataLen = pkt->end - pkt->start - hdrLen;
+    uint ipLen = NetBufLen(head) - sizeof(EthHeader);
+
+    return ipLen + dataLen <= GRO_MAX_SIZE;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void GroMerge(GroFlow *flow, NetBuf *pkt)
+{
+    NetBuf *head = flow->pkt;
+
+    // Take the newest window and push flag
+    TcpHeader *tcpHdr = GroTcpHeader(pkt);
+    TcpHeader *tcpHead = GroTcpHeader(head);
+    tcpHead->windowSize = tcpHdr->windowSize;
+    tcpHead->flags |= tcpHdr->flags & TCP_PSH;
+
+    // Chain the payload in place; the driver drops its own reference after this returns
+    u8 *data = (u8 *)tcpHdr + (tcpHdr->off >> 2);
+    uint dataLen = pkt->end - data;
+
+    pkt->start = data;
+    ++pkt->refCount;
+    flow->tail->next = pkt;
+    flow->tail = pkt;
+
+    flow->nextSeq += dataLen;
+    ++flow->count;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void GroDeliver(GroFlow *flow)
+{
+    NetBuf *pkt = flow->pkt;
+
+    if (flow->count > 1)
+    {
+        // Rebuild the IPv4 header for the merged datagram
+        Ipv4Header *ipHdr = GroIpv4Header(pkt);
+        ipHdr->len = NetSwap16(NetBufLen(pkt) - sizeof(EthHeader));
+        ipHdr->checksum = 0;
+
+        ipHdr->checksum = NetChecksum((u8 *)ipHdr, (u8 *)ipHdr + sizeof(Ipv4Header));
+        pkt->csumFlags |= NET_CSUM_IP_VALID;
+
+        s_groSegments += flow->count;
+        ++s_groPackets;
+    }
+
+    EthRecv(flow->intf, pkt);
+    NetReleaseBuf(pkt);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void GroFlushFlow(uint index)
+{
+    GroDeliver(&s_flows[index]);
+
+    // Keep the table compact, in arrival order
+    --s_flowCount;
+    for (uint i = index; i < s_flowCount; ++i)
+    {
+        s_flows[i] = s_flows[i + 1];
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void GroRecv(NetIntf *intf, NetBuf *pkt)
+{
+    if (!GroCandidate(pkt))
+    {
+        EthRecv(intf, pkt);
+        return;
+    }
+
+    // Merge into the held segment of the same flow if possible
+    for (uint i = 0; i < s_flowCount; ++i)
+    {
+        GroFlow *flow = &s_flows[i];
+        if (flow->intf == intf && GroSameFlow(flow->pkt, pkt))
+        {
+            if (GroCanMerge(flow, pkt))
+            {
+                GroMerge(flow, pkt);
+                return;
+            }
+
+            // Out of order or flags changed - deliver what was held first
+            GroFlushFlow(i);
+            break;
+        }
+    }
+
+    if (s_flowCount == GRO_MAX_FLOWS)
+    {
+        GroFlushFlow(0);
+    }
+
+    // Hold this segment; the driver drops its own reference after this returns
+    TcpHeader *tcpHdr = GroTcpHeader(pkt);
+    u8 *data = (u8 *)tcpHdr + (tcpHdr->off >> 2);
+
+    GroFlow *flow = &s_flows[s_flowCount++];
+    flow->intf = intf;
+    flow->pkt = pkt;
+    flow->tail = pkt;
+    flow->count = 1;
+    flow->nextSeq = NetSwap32(tcpHdr->seq) + (pkt->end - data);
+
+    ++pkt->refCount;
+}
+
+// ------------------------------------------------------------------------------------------------
+void GroFlush()
+{
+    for (uint i = 0; i < s_flowCount; ++i)
+    {
+        GroDeliver(&s_flows[i]);
+    }
+
+    s_flowCount = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+void GroPrint()
+{
+    ConsolePrint("GRO: %u segments merged into %u packets\n", s_groSegments, s_groPackets);
+}
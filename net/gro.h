@@ -0,0 +1,24 @@
+// ------------------------------------------------------------------------------------------------
+// net/gro.h
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "net/intf.h"
+
+// ------------------------------------------------------------------------------------------------
+// Configuration
+
+#define GRO_MAX_FLOWS           8           // Flows held at once within a receive burst
+#define GRO_MAX_SIZE            0xffff      // Largest merged IPv4 datagram, held as a chain
+
+// ------------------------------------------------------------------------------------------------
+// Functions
+
+// Drivers pass received frames through GroRecv instead of EthRecv, and call GroFlush
+// at the end of each receive burst.  The driver keeps ownership of the frame as usual, but
+// a merged segment stays referenced as a fragment of the chain delivered to the stack.
+void GroRecv(NetIntf *intf, NetBuf *pkt);
+void GroFlush();
+
+void GroPrint();
@@ -0,0 +1,94 @@
+// ------------------------------------------------------------------------------------------------
+// net/gso.c
+// ------------------------------------------------------------------------------------------------
+
+#include "net/gso.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/ipv4.h"
+#include "net/swap.h"
+#include "net/tcp.h"
+#include "stdlib/string.h"
+
+// ------------------------------------------------------------------------------------------------
+void GsoSend(NetIntf *intf, NetBuf *pkt)
+{
+    // Super-segments are Ethernet + IPv4 + TCP frames; the TCP header is the checksum start
+    Ipv4Header *ipHdr = (Ipv4Header *)(pkt->start + sizeof(EthHeader));
+    TcpHeader *tcpHdr = (TcpHeader *)pkt->csumStart;
+
+    uint ipOffset = (u8 *)ipHdr - pkt->start;
+    uint tcpOffset = (u8 *)tcpHdr - pkt->start;
+    uint tcpHdrLen = tcpHdr->off >> 2;
+    uint hdrLen = tcpOffset + tcpHdrLen;
+
+    u32 seq = NetSwap32(tcpHdr->seq);
+    u16 id = NetSwap16(ipHdr->id);
+    uint mss = pkt->gsoSize;
+
+    const u8 *data = pkt->start + hdrLen;
+    while (data < pkt->end)
+    {
+        uint len = pkt->end - data;
+        if (len > mss)
+        {
+            len = mss;
+        }
+
+        // Copy headers and one MSS of payload into a buffer of the matching size class
+        NetBuf *seg = NetAllocBufSize(hdrLen + len);
+        memcpy(seg->start, pkt->start, hdrLen);
+        memcpy(seg->start + hdrLen, data, len);
+        seg->end = seg->start + hdrLen + len;
+        memcpy(seg->stamps, pkt->stamps, sizeof(seg->stamps));
+
+        data += len;
+
+        // IPv4 header
+        Ipv4Header *segIpHdr = (Ipv4Header *)(seg->start + ipOffset);
+        segIpHdr->len = NetSwap16(seg->end - (u8 *)segIpHdr);
+        segIpHdr->id = NetSwap16(id++);
+        segIpHdr->checksum = 0;
+
+        segIpHdr->checksum = NetChecksum((u8 *)segIpHdr, seg->start + tcpOffset);
+
+        // TCP header - FIN and PSH belong to the last segment only
+        TcpHeader *segTcpHdr = (TcpHeader *)(seg->start + tcpOffset);
+        segTcpHdr->seq = NetSwap32(seq);
+        if (data < pkt->end)
+        {
+            segTcpHdr->flags &= ~(TCP_FIN | TCP_PSH);
+        }
+
+        seq += len;
+
+        // TCP checksum over the pseudo header for this segment's length
+        ChecksumHeader phdr;
+        phdr.src = segIpHdr->src;
+        phdr.dst = segIpHdr->dst;
+        phdr.reserved = 0;
+        phdr.protocol = IP_PROTOCOL_TCP;
+        phdr.len = NetSwap16(tcpHdrLen + len);
+
+        uint sum = NetChecksumAcc((u8 *)&phdr, (u8 *)(&phdr + 1), 0);
+        segTcpHdr->checksum = 0;
+
+        if (intf->caps & NET_INTF_TX_CSUM)
+        {
+            segTcpHdr->checksum = NetChecksumFold(sum);
+
+            seg->csumFlags = NET_CSUM_PARTIAL;
+            seg->csumStart = (u8 *)segTcpHdr;
+            seg->csumOffset = pkt->csumOffset;
+        }
+        else
+        {
+            sum = NetChecksumAcc((u8 *)segTcpHdr, seg->end, sum);
+            segTcpHdr->checksum = NetChecksumFinal(sum);
+        }
+
+        intf->devSend(intf, seg);
+    }
+
+    NetReleaseBuf(pkt);
+}
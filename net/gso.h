@@ -0,0 +1,9 @@
+// ------------------------------------------------------------------------------------------------
+// net/gso.h
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "net/intf.h"
+
+void GsoSend(NetIntf *intf, NetBuf *pkt);
@@ -10,24 +10,6 @@
 #include "console/console.h"
 #include "stdlib/string.h"
 
-// ------------------------------------------------------------------------------------------------
-#define ICMP_TYPE_ECHO_REPLY            0
-#define ICMP_TYPE_DEST_UNREACHABLE      3
-#define ICMP_TYPE_SOUCE_QUENCH          4
-#define ICMP_TYPE_REDIRECT_MSG          5
-#define ICMP_TYPE_ECHO_REQUEST          8
-#define ICMP_TYPE_ROUTER_ADVERTISEMENT  9
-#define ICMP_TYPE_ROUTER_SOLICITATION   10
-#define ICMP_TYPE_TIME_EXCEEDED         11
-#define ICMP_TYPE_BAD_PARAM             12
-#define ICMP_TYPE_TIMESTAMP             13
-#define ICMP_TYPE_TIMESTAMP_REPLY       14
-#define ICMP_TYPE_INFO_REQUEST          15
-#define ICMP_TYPE_INFO_REPLY            16
-#define ICMP_TYPE_ADDR_MASK_REQUEST     17
-#define ICMP_TYPE_ADDR_MASK_REPLY       18
-#define ICMP_TYPE_TRACEROUTE            30
-
 // ------------------------------------------------------------------------------------------------
 void IcmpPrint(const NetBuf *pkt)
 {
@@ -75,9 +57,7 @@ static void IcmpEchoReply(const Ipv4Addr *dstAddr, u16 id, u16 sequence,
     memcpy(data + 8, data, echoLen);
     pkt->end += 8 + echoLen;
 
-    uint checksum = NetChecksum(pkt->start, pkt->end);
-    data[2] = (checksum >> 8) & 0xff;
-    data[3] = (checksum) & 0xff;
+    *(u16 *)(data + 2) = NetChecksum(pkt->start, pkt->end);
 
     IcmpPrint(pkt);
     Ipv4Send(dstAddr, IP_PROTOCOL_ICMP, pkt);
@@ -103,9 +83,7 @@ void IcmpEchoRequest(const Ipv4Addr *dstAddr, u16 id, u16 sequence,
     memcpy(data + 8, echoData, echoLen);
     pkt->end += 8 + echoLen;
 
-    uint checksum = NetChecksum(pkt->start, pkt->end);
-    data[2] = (checksum >> 8) & 0xff;
-    data[3] = (checksum) & 0xff;
+    *(u16 *)(data + 2) = NetChecksum(pkt->start, pkt->end);
 
     IcmpPrint(pkt);
     Ipv4Send(dstAddr, IP_PROTOCOL_ICMP, pkt);
@@ -118,6 +96,7 @@ void IcmpRecv(NetIntf *intf, const Ipv4Header *ipHdr, NetBuf *pkt)
 
     if (pkt->start + 8 > pkt->end)
     {
+        NetIntfDrop(intf, NET_DROP_HEADER);
         return;
     }
 
@@ -6,6 +6,29 @@
 
 #include "net/ipv4.h"
 
+// ------------------------------------------------------------------------------------------------
+// ICMP Types
+
+#define ICMP_TYPE_ECHO_REPLY            0
+#define ICMP_TYPE_DEST_UNREACHABLE      3
+#define ICMP_TYPE_SOUCE_QUENCH          4
+#define ICMP_TYPE_REDIRECT_MSG          5
+#define ICMP_TYPE_ECHO_REQUEST          8
+#define ICMP_TYPE_ROUTER_ADVERTISEMENT  9
+#define ICMP_TYPE_ROUTER_SOLICITATION   10
+#define ICMP_TYPE_TIME_EXCEEDED         11
+#define ICMP_TYPE_BAD_PARAM             12
+#define ICMP_TYPE_TIMESTAMP             13
+#define ICMP_TYPE_TIMESTAMP_REPLY       14
+#define ICMP_TYPE_INFO_REQUEST          15
+#define ICMP_TYPE_INFO_REPLY            16
+#define ICMP_TYPE_ADDR_MASK_REQUEST     17
+#define ICMP_TYPE_ADDR_MASK_REPLY       18
+#define ICMP_TYPE_TRACEROUTE            30
+
+// ------------------------------------------------------------------------------------------------
+// Functions
+
 void IcmpRecv(NetIntf *intf, const Ipv4Header *ipHdr, NetBuf *pkt);
 
 void IcmpEchoRequest(const Ipv4Addr *dstAddr, u16 id, u16 sequence,
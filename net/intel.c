@@ -4,17 +4,36 @@
 
 #include "net/intel.h"
 #include "net/buf.h"
+#include "net/capture.h"
+#include "net/checksum.h"
 #include "net/ipv4.h"
 #include "net/eth.h"
+#include "net/gro.h"
+#include "net/latency.h"
+#include "net/swap.h"
+#include "net/tcp.h"
+#include "net/xdp.h"
 #include "console/console.h"
 #include "cpu/io.h"
+#include "intr/intr.h"
+#include "intr/local_apic.h"
 #include "mem/vm.h"
 #include "pci/driver.h"
 #include "stdlib/string.h"
 #include "time/pit.h"
 
-#define RX_DESC_COUNT                   32
-#define TX_DESC_COUNT                   8
+#define RX_DESC_COUNT                   128         // Power of 2, multiple of 8
+#define RX_BURST_SIZE                   16          // Descriptors gathered before refilling
+#define RX_POLL_BUDGET                  64          // Packets processed per poll
+#define TX_DESC_COUNT                   256         // Power of 2, multiple of 8
+#define TX_QUEUE_LIMIT                  512         // Packets held while the ring is full
+#define TX_BATCH_SIZE                   32          // Descriptors posted before forcing a tail write
+#define MAX_QUEUES                      2           // Queue pairs on the 82574
+
+#define WATCHDOG_INTERVAL               100         // Poll period while waiting for interrupts (ms)
+#define DEFAULT_ITR                     125         // Minimum interval between interrupts (us)
+#define DEFAULT_RDTR                    0           // Receive packet timer (us)
+#define DEFAULT_RADV                    0           // Receive absolute timer (us)
 
 #define PACKET_SIZE                     2048
 
@@ -30,6 +49,16 @@ typedef struct RecvDesc
     volatile u16 special;
 } PACKED RecvDesc;
 
+// ------------------------------------------------------------------------------------------------
+// Extended Receive Descriptor - write-back replaces the buffer address with MRQ and RSS hash
+typedef struct RecvDescExt
+{
+    volatile u64 addr;
+    volatile u32 staterr;               // status in the low bits, errors in the top byte
+    volatile u16 len;
+    volatile u16 vlan;
+} PACKED RecvDescExt;
+
 // ------------------------------------------------------------------------------------------------
 // Receive Status
 
@@ -41,6 +70,18 @@ typedef struct RecvDesc
 #define RSTA_IPCS                       (1 << 6)    // IP Checksum Calculated on Packet
 #define RSTA_PIF                        (1 << 7)    // Passed in-exact filter
 
+// ------------------------------------------------------------------------------------------------
+// Receive Errors - positioned as in the extended status, the legacy errors byte shifted up
+
+#define RERR_CE                         (1u << 24)  // CRC Error or Alignment Error
+#define RERR_SE                         (1u << 25)  // Symbol Error
+#define RERR_SEQ                        (1u << 26)  // Sequence Error
+#define RERR_CXE                        (1u << 28)  // Carrier Extension Error
+#define RERR_TCPE                       (1u << 29)  // TCP/UDP Checksum Error
+#define RERR_IPE                        (1u << 30)  // IP Checksum Error
+#define RERR_RXE                        (1u << 31)  // RX Data Error
+#define RERR_SHIFT                      24
+
 // ------------------------------------------------------------------------------------------------
 // Transmit Descriptor
 typedef struct TransDesc
@@ -65,6 +106,54 @@ typedef struct TransDesc
 #define CMD_VLE                         (1 << 6)    // VLAN Packet Enable
 #define CMD_IDE                         (1 << 7)    // Interrupt Delay Enable
 
+// ------------------------------------------------------------------------------------------------
+// Transmit Context Descriptor
+typedef struct TransContextDesc
+{
+    volatile u8 ipcss;
+    volatile u8 ipcso;
+    volatile u16 ipcse;
+    volatile u8 tucss;
+    volatile u8 tucso;
+    volatile u16 tucse;
+    volatile u32 cmdLen;                // paylen, dtyp and tucmd
+    volatile u8 status;
+    volatile u8 hdrLen;
+    volatile u16 mss;
+} PACKED TransContextDesc;
+
+// ------------------------------------------------------------------------------------------------
+// Transmit Data Descriptor
+typedef struct TransDataDesc
+{
+    volatile u64 addr;
+    volatile u32 cmdLen;                // len, dtyp and dcmd
+    volatile u8 status;
+    volatile u8 popts;
+    volatile u16 special;
+} PACKED TransDataDesc;
+
+#define DTYP_CONTEXT                    (0 << 20)   // Descriptor Type
+#define DTYP_DATA                       (1 << 20)
+
+#define TUCMD_TCP                       (1 << 24)   // Packet is TCP
+#define TUCMD_IP                        (1 << 25)   // Packet is IPv4
+#define TUCMD_TSE                       (1 << 26)   // TCP Segmentation Enable
+#define TUCMD_RS                        (1 << 27)   // Report Status
+#define TUCMD_DEXT                      (1 << 29)   // Extension
+
+#define DCMD_EOP                        (1 << 24)   // End of Packet
+#define DCMD_IFCS                       (1 << 25)   // Insert FCS
+#define DCMD_TSE                        (1 << 26)   // TCP Segmentation Enable
+#define DCMD_RS                         (1 << 27)   // Report Status
+#define DCMD_DEXT                       (1 << 29)   // Extension
+
+#define POPTS_IXSM                      (1 << 0)    // Insert IP Checksum
+#define POPTS_TXSM                      (1 << 1)    // Insert TCP/UDP Checksum
+
+#define TX_MAX_DATA_PER_DESC            4096        // Largest buffer per data descriptor
+#define TX_DESC_PER_PACKET              (2 + NET_LARGE_BUF_SIZE / TX_MAX_DATA_PER_DESC + NET_BUF_MAX_FRAGS)
+
 // ------------------------------------------------------------------------------------------------
 // Transmit Status
 
@@ -73,29 +162,123 @@ typedef struct TransDesc
 #define TSTA_LC                         (1 << 2)    // Late Collision
 #define LSTA_TU                         (1 << 3)    // Transmit Underrun
 
+// ------------------------------------------------------------------------------------------------
+// Supported Devices
+
+#define MODEL_MSIX                      (1 << 0)    // MSI-X with per-queue causes
+#define MODEL_RSS                       (1 << 1)    // Receive side scaling
+
+typedef struct EthIntelModel
+{
+    u16 deviceId;
+    const char *name;
+    uint queueCount;
+    uint flags;
+} EthIntelModel;
+
+static const EthIntelModel s_models[] =
+{
+    { 0x100e, "82540EM", 1, 0 },
+    { 0x1503, "82579V", 1, 0 },
+    { 0x10d3, "82574L", 2, MODEL_MSIX | MODEL_RSS },
+    { 0x10f6, "82574LA", 2, MODEL_MSIX | MODEL_RSS },
+    { 0 },
+};
+
 // ------------------------------------------------------------------------------------------------
 // Device State
 
-typedef struct EthIntelDevice
+typedef struct EthIntelQueue
 {
-    u8 *mmioAddr;
+    struct EthIntelDevice *dev;
+    uint index;
+    uint regOffset;                     // offset of this queue's ring registers
+
+    // receive ring
     uint rxRead;
-    uint txWrite;
     RecvDesc *rxDescs;
-    TransDesc *txDescs;
     NetBuf *rxBufs[RX_DESC_COUNT];
+
+    // transmit ring
+    uint txWrite;                       // next descriptor to fill
+    uint txClean;                       // oldest descriptor not yet reaped
+    uint txTail;                        // last value written to TDT
+    uint txContext;                     // tucss/tucso of the loaded offload context, 0 if none
+    TransDesc *txDescs;
     NetBuf *txBufs[TX_DESC_COUNT];
+
+    // software queue used while the ring is full
+    Link txQueue;
+    uint txQueueCount;
+    uint txQueueDrops;
+
+    // interrupt state
+    u32 intrMask;                       // IMS bits that signal this queue
+    volatile bool pollMode;             // set by the interrupt handler, cleared once idle
+    volatile uint intrCount;
+    u32 nextWatchdog;
+
+    // counters
+    uint rxPackets;
+    uint txPackets;
+} EthIntelQueue;
+
+typedef struct EthIntelDevice
+{
+    Link link;
+    char name[8];
+    u8 *mmioAddr;
+    const EthIntelModel *model;
+
+    EthIntelQueue queues[MAX_QUEUES];
+    uint queueCount;
+
+    // interrupt state
+    uint vector;                        // 0 if the device is only polled
+    uint intrMode;
+    uint itr;
+    uint rdtr;
+    uint radv;
+
+    // receive filter
+    u32 rctlFilter;                     // promiscuous bits merged into RCTL
+
+    // receive buffer sizing
+    uint mtu;
+    uint rxBufSize;                     // data space of receive buffers, matches RCTL.BSIZE
+    bool rxExtended;                    // extended descriptors, required for RSS
 } EthIntelDevice;
 
-static EthIntelDevice s_device;
+static Link s_devices = { &s_devices, &s_devices };
+
+// ------------------------------------------------------------------------------------------------
+// Interrupt Modes
+
+#define INTR_NONE                       0
+#define INTR_LEGACY                     1
+#define INTR_MSI                        2
+#define INTR_MSIX                       3
+
+static const char *s_intrModeStrs[] =
+{
+    "none",
+    "ioapic",
+    "msi",
+    "msix",
+};
 
 // ------------------------------------------------------------------------------------------------
 // Registers
 
 #define REG_CTRL                        0x0000      // Device Control
 #define REG_EERD                        0x0014      // EEPROM Read
+#define REG_CTRL_EXT                    0x0018      // Extended Device Control
 #define REG_ICR                         0x00c0      // Interrupt Cause Read
+#define REG_ITR                         0x00c4      // Interrupt Throttling
 #define REG_IMS                         0x00d0      // Interrupt Mask Set/Read
+#define REG_IMC                         0x00d8      // Interrupt Mask Clear
+#define REG_EIAC                        0x00dc      // Extended Interrupt Auto Clear
+#define REG_IVAR                        0x00e4      // Interrupt Vector Allocation
 #define REG_RCTL                        0x0100      // Receive Control
 #define REG_TCTL                        0x0400      // Transmit Control
 #define REG_RDBAL                       0x2800      // Receive Descriptor Base Low
@@ -103,20 +286,111 @@ static EthIntelDevice s_device;
 #define REG_RDLEN                       0x2808      // Receive Descriptor Length
 #define REG_RDH                         0x2810      // Receive Descriptor Head
 #define REG_RDT                         0x2818      // Receive Descriptor Tail
+#define REG_RDTR                        0x2820      // Receive Delay Timer
+#define REG_RADV                        0x282c      // Receive Interrupt Absolute Delay Timer
 #define REG_TDBAL                       0x3800      // Transmit Descriptor Base Low
 #define REG_TDBAH                       0x3804      // Transmit Descriptor Base High
 #define REG_TDLEN                       0x3808      // Transmit Descriptor Length
 #define REG_TDH                         0x3810      // Transmit Descriptor Head
 #define REG_TDT                         0x3818      // Transmit Descriptor Tail
+#define REG_TARC                        0x3840      // Transmit Arbitration Count
+#define REG_CRCERRS                     0x4000      // CRC Error Count
+#define REG_ALGNERRC                    0x4004      // Alignment Error Count
+#define REG_RXERRC                      0x400c      // RX Error Count
+#define REG_MPC                         0x4010      // Missed Packets Count
+#define REG_COLC                        0x4028      // Collision Count
+#define REG_RLEC                        0x4040      // Receive Length Error Count
+#define REG_GPRC                        0x4074      // Good Packets Received Count
+#define REG_GPTC                        0x4080      // Good Packets Transmitted Count
+#define REG_GORCL                       0x4088      // Good Octets Received Count Low
+#define REG_GORCH                       0x408c      // Good Octets Received Count High
+#define REG_GOTCL                       0x4090      // Good Octets Transmitted Count Low
+#define REG_GOTCH                       0x4094      // Good Octets Transmitted Count High
+#define REG_RNBC                        0x40a0      // Receive No Buffers Count
+#define REG_QUEUE_STRIDE                0x0100      // Offset between queue ring registers
+#define REG_RXCSUM                      0x5000      // Receive Checksum Control
+#define REG_RFCTL                       0x5008      // Receive Filter Control
 #define REG_MTA                         0x5200      // Multicast Table Array
 #define REG_RAL                         0x5400      // Receive Address Low
 #define REG_RAH                         0x5404      // Receive Address High
+#define REG_RA_STRIDE                   8           // Offset between receive address slots
+#define REG_MRQC                        0x5818      // Multiple Receive Queues Command
+#define REG_RETA                        0x5c00      // Redirection Table
+#define REG_RSSRK                       0x5c80      // RSS Random Key
 
 // ------------------------------------------------------------------------------------------------
 // Control Register
 
 #define CTRL_SLU                        (1 << 6)    // Set Link Up
 
+// ------------------------------------------------------------------------------------------------
+// Interrupt Cause
+
+#define ICR_TXDW                        (1 << 0)    // Transmit Descriptor Written Back
+#define ICR_TXQE                        (1 << 1)    // Transmit Queue Empty
+#define ICR_LSC                         (1 << 2)    // Link Status Change
+#define ICR_RXDMT0                      (1 << 4)    // Receive Descriptor Minimum Threshold
+#define ICR_RXO                         (1 << 6)    // Receiver Overrun
+#define ICR_RXT0                        (1 << 7)    // Receiver Timer Interrupt
+
+#define ICR_RXQ0                        (1 << 20)   // Receive Queue 0 (MSI-X)
+#define ICR_TXQ0                        (1 << 22)   // Transmit Queue 0 (MSI-X)
+#define ICR_OTHER                       (1 << 24)   // Other causes (MSI-X)
+
+#define IMS_RX                          (ICR_RXT0 | ICR_RXO | ICR_RXDMT0 | ICR_LSC)
+
+// ------------------------------------------------------------------------------------------------
+// IVAR Register
+
+#define IVAR_VALID                      0x8         // Per field allocation valid
+#define IVAR_RXQ0_SHIFT                 0
+#define IVAR_TXQ0_SHIFT                 8
+#define IVAR_OTHER_SHIFT                16
+#define IVAR_QUEUE_SHIFT                4           // Queue 1 fields follow queue 0
+
+#define CTRL_EXT_PBA_SUPPORT            (1u << 31)  // Required for MSI-X
+
+// ------------------------------------------------------------------------------------------------
+// Receive Address Filters
+
+#define RA_SLOTS                        16          // Exact match slots, slot 0 holds ethAddr
+#define RAH_AV                          (1u << 31)  // Address Valid
+#define MTA_REGS                        128         // 4096 bit multicast hash table
+
+// ------------------------------------------------------------------------------------------------
+// RXCSUM Register
+
+#define RXCSUM_IPOFL                    (1 << 8)    // IP Checksum Offload Enable
+#define RXCSUM_TUOFL                    (1 << 9)    // TCP/UDP Checksum Offload Enable
+#define RXCSUM_PCSD                     (1 << 13)   // Packet Checksum Disable, reports RSS hash
+
+// ------------------------------------------------------------------------------------------------
+// RFCTL Register
+
+#define RFCTL_EXSTEN                    (1 << 15)   // Extended Status Enable
+
+// ------------------------------------------------------------------------------------------------
+// RSS
+
+#define MRQC_RSS_ENABLE                 0x00000001
+#define MRQC_TCP_IPV4                   (1 << 16)   // Hash TCP/IPv4 4-tuple
+#define MRQC_IPV4                       (1 << 17)   // Hash IPv4 addresses
+
+#define RETA_ENTRIES                    128
+#define RETA_QUEUE_SHIFT                7           // Queue index bit within each entry
+
+#define TARC_ENABLE                     (1 << 10)   // Queue participates in arbitration
+
+// Microsoft reference key, gives a well distributed Toeplitz hash
+static const u8 s_rssKey[40] =
+{
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
 // ------------------------------------------------------------------------------------------------
 // EERD Register
 
@@ -186,66 +460,849 @@ static u16 EepromRead(u8 *mmioAddr, u8 eepromAddr)
 }
 
 // ------------------------------------------------------------------------------------------------
-static void EthIntelPoll(NetIntf *intf)
+static void EthIntelTxReap(EthIntelQueue *q)
 {
-    RecvDesc *desc = &s_device.rxDescs[s_device.rxRead];
+    // Release buffers for every descriptor the hardware has finished with
+    while (q->txClean != q->txWrite)
+    {
+        TransDesc *desc = &q->txDescs[q->txClean];
+        if (~desc->status & TSTA_DD)
+        {
+            break;
+        }
 
-    while (desc->status & RSTA_DD)
+        // Context descriptors have no buffer
+        NetBuf *buf = q->txBufs[q->txClean];
+        if (buf)
+        {
+            NetReleaseBuf(buf);
+            q->txBufs[q->txClean] = 0;
+        }
+
+        q->txClean = (q->txClean + 1) & (TX_DESC_COUNT - 1);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool EthIntelTxFull(EthIntelQueue *q)
+{
+    // Keep room for the largest descriptor sequence a packet can need
+    uint used = (q->txWrite - q->txClean) & (TX_DESC_COUNT - 1);
+    return used + TX_DESC_PER_PACKET >= TX_DESC_COUNT;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelTxContext(EthIntelQueue *q, uint css, uint cso)
+{
+    // The hardware keeps the last context, so only reload it when the offsets change
+    uint context = css | (cso << 8);
+    if (q->txContext == context)
+    {
+        return;
+    }
+
+    TransContextDesc *desc = (TransContextDesc *)&q->txDescs[q->txWrite];
+
+    desc->ipcss = 0;
+    desc->ipcso = 0;
+    desc->ipcse = 0;
+    desc->tucss = css;
+    desc->tucso = cso;
+    desc->tucse = 0;                    // checksum to the end of the packet
+    desc->cmdLen = DTYP_CONTEXT | TUCMD_TCP | TUCMD_IP | TUCMD_RS | TUCMD_DEXT;
+    desc->status = 0;
+    desc->hdrLen = 0;
+    desc->mss = 0;
+    q->txBufs[q->txWrite] = 0;
+
+    q->txWrite = (q->txWrite + 1) & (TX_DESC_COUNT - 1);
+    q->txContext = context;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelTxData(EthIntelQueue *q, NetBuf *buf, u32 cmd, u8 popts)
+{
+    // Data descriptors for each fragment, the chain is released with the last one
+    for (NetBuf *frag = buf; frag; frag = frag->next)
     {
-        if (desc->errors)
+        u8 *p = frag->start;
+        while (p < frag->end)
         {
-            ConsolePrint("Packet Error: (0x%x)\n", desc->errors);
+            uint len = frag->end - p;
+            if (len > TX_MAX_DATA_PER_DESC)
+            {
+                len = TX_MAX_DATA_PER_DESC;
+            }
+
+            TransDataDesc *desc = (TransDataDesc *)&q->txDescs[q->txWrite];
+
+            desc->addr = (u64)(uintptr_t)p;
+            desc->cmdLen = len | DTYP_DATA | DCMD_IFCS | DCMD_RS | DCMD_DEXT | cmd;
+            desc->status = 0;
+            desc->popts = popts;
+            desc->special = 0;
+            q->txBufs[q->txWrite] = 0;
+
+            p += len;
+            if (p == frag->end && !frag->next)
+            {
+                desc->cmdLen |= DCMD_EOP;
+                q->txBufs[q->txWrite] = buf;
+            }
+
+            q->txWrite = (q->txWrite + 1) & (TX_DESC_COUNT - 1);
         }
-        else
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelTxTso(EthIntelQueue *q, NetBuf *buf)
+{
+    // Frame is Ethernet + IPv4 + TCP; the TCP header is the checksum start
+    u8 *ip = buf->start + sizeof(EthHeader);
+    u8 *tcp = buf->csumStart;
+    uint ipcss = ip - buf->start;
+    uint tucss = tcp - buf->start;
+    uint hdrLen = tucss + (((TcpHeader *)tcp)->off >> 2);
+    uint payLen = NetBufLen(buf) - hdrLen;
+
+    // Hardware fills in per segment IP length and checksum, and expects a TCP checksum
+    // seed without the length, so remove it from the pseudo header sum
+    Ipv4Header *ipHdr = (Ipv4Header *)ip;
+    u16 *tcpChecksum = (u16 *)(tcp + buf->csumOffset);
+    u16 tcpLen = NetSwap16(payLen + hdrLen - tucss);
+
+    ipHdr->len = 0;
+    ipHdr->checksum = 0;
+    *tcpChecksum = NetChecksumFold(*tcpChecksum + (u16)~tcpLen);
+
+    TransContextDesc *ctx = (TransContextDesc *)&q->txDescs[q->txWrite];
+
+    ctx->ipcss = ipcss;
+    ctx->ipcso = ipcss + 10;            // offset of IPv4 header checksum
+    ctx->ipcse = tucss - 1;
+    ctx->tucss = tucss;
+    ctx->tucso = tucss + buf->csumOffset;
+    ctx->tucse = 0;
+    ctx->cmdLen = payLen | DTYP_CONTEXT | TUCMD_TCP | TUCMD_IP | TUCMD_TSE | TUCMD_RS | TUCMD_DEXT;
+    ctx->status = 0;
+    ctx->hdrLen = hdrLen;
+    ctx->mss = buf->gsoSize;
+    q->txBufs[q->txWrite] = 0;
+
+    q->txWrite = (q->txWrite + 1) & (TX_DESC_COUNT - 1);
+
+    // The segmentation context replaced any checksum context
+    q->txContext = 0;
+
+    EthIntelTxData(q, buf, DCMD_TSE, POPTS_TXSM | POPTS_IXSM);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelTxPost(EthIntelQueue *q, NetBuf *buf)
+{
+    // Write new tx descriptors; the tail is updated later for the whole batch
+    uint len = buf->end - buf->start;
+
+    if (buf->gsoSize)
+    {
+        EthIntelTxTso(q, buf);
+    }
+    else if (buf->csumFlags & NET_CSUM_PARTIAL)
+    {
+        // Hardware completes the checksum seeded with the pseudo header sum
+        uint css = buf->csumStart - buf->start;
+        EthIntelTxContext(q, css, css + buf->csumOffset);
+
+        EthIntelTxData(q, buf, 0, POPTS_TXSM);
+    }
+    else if (len > TX_MAX_DATA_PER_DESC || buf->next)
+    {
+        // Jumbo frame or chain spanning several descriptors
+        EthIntelTxData(q, buf, 0, 0);
+    }
+    else
+    {
+        TransDesc *desc = &q->txDescs[q->txWrite];
+
+        desc->addr = (u64)(uintptr_t)buf->start;
+        desc->len = len;
+        desc->cso = 0;
+        desc->cmd = CMD_EOP | CMD_IFCS | CMD_RS;
+        desc->status = 0;
+        desc->css = 0;
+        desc->special = 0;
+        q->txBufs[q->txWrite] = buf;
+
+        q->txWrite = (q->txWrite + 1) & (TX_DESC_COUNT - 1);
+    }
+
+    ++q->txPackets;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelTxFlush(EthIntelQueue *q)
+{
+    EthIntelTxReap(q);
+
+    // Move queued packets into free descriptors
+    while (!ListIsEmpty(&q->txQueue) && !EthIntelTxFull(q))
+    {
+        NetBuf *buf = LinkData(q->txQueue.next, NetBuf, link);
+        LinkRemove(&buf->link);
+        --q->txQueueCount;
+
+        EthIntelTxPost(q, buf);
+    }
+
+    // Single doorbell write for everything posted since the last flush
+    if (q->txTail != q->txWrite)
+    {
+        for (uint i = q->txTail; i != q->txWrite; i = (i + 1) & (TX_DESC_COUNT - 1))
+        {
+            NetBuf *buf = q->txBufs[i];
+            if (buf)
+            {
+                LatencyStamp(buf, LAT_TX_DEVICE);
+                LatencyRecord(buf, LAT_TX_SEND, LAT_TX_DEVICE);
+            }
+        }
+
+        q->txTail = q->txWrite;
+        MmioWrite32(q->dev->mmioAddr + q->regOffset + REG_TDT, q->txWrite);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static u32 EthIntelRxStatus(EthIntelQueue *q, RecvDesc *desc, uint *len)
+{
+    // Status and errors in the extended layout, whichever format the ring uses
+    if (q->dev->rxExtended)
+    {
+        RecvDescExt *ext = (RecvDescExt *)desc;
+        *len = ext->len;
+        return ext->staterr;
+    }
+
+    *len = desc->len;
+    return desc->status | ((u32)desc->errors << RERR_SHIFT);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelRxPost(EthIntelQueue *q, RecvDesc *desc, NetBuf *buf)
+{
+    desc->addr = (u64)(uintptr_t)buf->start;
+
+    if (q->dev->rxExtended)
+    {
+        ((RecvDescExt *)desc)->staterr = 0;
+    }
+    else
+    {
+        desc->status = 0;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static uint EthIntelRx(NetIntf *intf, EthIntelQueue *q, uint budget)
+{
+    uint total = 0;
+
+    while (budget)
+    {
+        uint limit = budget < RX_BURST_SIZE ? budget : RX_BURST_SIZE;
+
+        // Gather a burst of completed descriptors
+        uint first = q->rxRead;
+        uint count = 0;
+        while (count < limit)
+        {
+            uint len;
+            RecvDesc *desc = &q->rxDescs[(first + count) & (RX_DESC_COUNT - 1)];
+            if (~EthIntelRxStatus(q, desc, &len) & RSTA_DD)
+            {
+                break;
+            }
+
+            ++count;
+        }
+
+        if (!count)
+        {
+            break;
+        }
+
+        budget -= count;
+        total += count;
+
+        // Pass packets up the stack, noting which buffers are still referenced
+        uint replaceCount = 0;
+        for (uint i = 0; i < count; ++i)
         {
-            NetBuf *buf = s_device.rxBufs[s_device.rxRead];
-            buf->end = buf->start + desc->len;
+            uint index = (first + i) & (RX_DESC_COUNT - 1);
+            RecvDesc *desc = &q->rxDescs[index];
+            NetBuf *buf = q->rxBufs[index];
+
+            uint len;
+            u32 status = EthIntelRxStatus(q, desc, &len);
+
+            if (status >> RERR_SHIFT)
+            {
+                NetIntfDrop(intf, NET_DROP_RX_ERROR);
+            }
+            else
+            {
+                buf->end = buf->start + len;
+
+                // Errors are reported above, so a calculated checksum is a valid one
+                buf->csumFlags = 0;
+                if (~status & RSTA_IXSM)
+                {
+                    if (status & RSTA_IPCS)
+                    {
+                        buf->csumFlags |= NET_CSUM_IP_VALID;
+                    }
+
+                    if (status & RSTA_TCPCS)
+                    {
+                        buf->csumFlags |= NET_CSUM_L4_VALID;
+                    }
+                }
+                ++q->rxPackets;
+
+                if (XdpRecv(intf, buf))
+                {
+                    CaptureTap(intf, buf);
+                    LatencyStartRx(buf);
+                    GroRecv(intf, buf);
+                }
+
+                if (buf->refCount > 1)
+                {
+                    NetReleaseBuf(buf);
+                    q->rxBufs[index] = 0;
+                    ++replaceCount;
+                }
+            }
+        }
+
+        // Deliver segments coalesced during this burst
+        GroFlush();
+
+        // Refill the ring in bulk; unreferenced buffers are reused in place
+        NetBuf *newBufs[RX_BURST_SIZE];
+        NetAllocBufs(newBufs, replaceCount, q->dev->rxBufSize);
+
+        NetBuf **newBuf = newBufs;
+        for (uint i = 0; i < count; ++i)
+        {
+            uint index = (first + i) & (RX_DESC_COUNT - 1);
+            RecvDesc *desc = &q->rxDescs[index];
+            NetBuf *buf = q->rxBufs[index];
+
+            if (!buf)
+            {
+                buf = *newBuf++;
+                q->rxBufs[index] = buf;
+            }
+
+            buf->start = (u8 *)buf + NET_BUF_START;
+            buf->end = buf->start;
+
+            EthIntelRxPost(q, desc, buf);
+        }
+
+        // Return the whole burst to the hardware with a single tail write
+        q->rxRead = (first + count) & (RX_DESC_COUNT - 1);
+        MmioWrite32(q->dev->mmioAddr + q->regOffset + REG_RDT, (q->rxRead - 1) & (RX_DESC_COUNT - 1));
+    }
+
+    return total;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelIntr(void *ctx)
+{
+    EthIntelDevice *dev = ctx;
+
+    u32 icr = MmioRead32(dev->mmioAddr + REG_ICR);
+    if (!icr)
+    {
+        return;     // shared legacy line raised by another device
+    }
+
+    // Mask the device and defer all work to the poll loop
+    MmioWrite32(dev->mmioAddr + REG_IMC, ~0u);
+
+    for (uint i = 0; i < dev->queueCount; ++i)
+    {
+        EthIntelQueue *q = &dev->queues[i];
+        q->pollMode = true;
+        ++q->intrCount;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelQueueIntr(void *ctx)
+{
+    // Mask just this queue; the poll loop drains it while the other keeps interrupting
+    EthIntelQueue *q = ctx;
+
+    MmioWrite32(q->dev->mmioAddr + REG_IMC, q->intrMask);
+    q->pollMode = true;
+    ++q->intrCount;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelOtherIntr(void *ctx)
+{
+    EthIntelDevice *dev = ctx;
+
+    // Link status changes need no action, just clear the cause
+    MmioRead32(dev->mmioAddr + REG_ICR);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelPollQueue(NetIntf *intf, EthIntelQueue *q)
+{
+    if (!q->pollMode)
+    {
+        // Waiting for an interrupt - only push out new transmits until the watchdog is due
+        if ((int)(g_pitTicks - q->nextWatchdog) < 0)
+        {
+            if (q->txTail != q->txWrite || q->txQueueCount)
+            {
+                EthIntelTxFlush(q);
+            }
+
+            return;
+        }
+
+        q->nextWatchdog = g_pitTicks + WATCHDOG_INTERVAL;
+    }
+
+    uint count = EthIntelRx(intf, q, RX_POLL_BUDGET);
+
+    // Transmit packets sent since the last poll, including replies generated above
+    EthIntelTxFlush(q);
+
+    // Return to interrupt mode once a poll finds the ring empty
+    if (q->dev->vector && q->pollMode && !count)
+    {
+        q->pollMode = false;
+        q->nextWatchdog = g_pitTicks + WATCHDOG_INTERVAL;
+        MmioWrite32(q->dev->mmioAddr + REG_IMS, q->intrMask);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelPoll(NetIntf *intf)
+{
+    EthIntelDevice *dev = intf->dev;
+
+    for (uint i = 0; i < dev->queueCount; ++i)
+    {
+        EthIntelPollQueue(intf, &dev->queues[i]);
+    }
+}
 
-            EthRecv(intf, buf);
+// ------------------------------------------------------------------------------------------------
+static EthIntelQueue *EthIntelTxQueue(EthIntelDevice *dev, const NetBuf *buf)
+{
+    // Keep each IPv4 flow on one queue so its packets stay in order
+    if (dev->queueCount == 1)
+    {
+        return &dev->queues[0];
+    }
+
+    return &dev->queues[EthFlowHash(buf) % dev->queueCount];
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelSend(NetIntf *intf, NetBuf *buf)
+{
+    EthIntelQueue *q = EthIntelTxQueue(intf->dev, buf);
 
+    CaptureTap(intf, buf);
+    EthIntelTxReap(q);
+
+    // Keep ordering behind packets already waiting for ring space
+    if (!ListIsEmpty(&q->txQueue) || EthIntelTxFull(q))
+    {
+        if (q->txQueueCount >= TX_QUEUE_LIMIT)
+        {
+            ++q->txQueueDrops;
+            NetIntfDrop(intf, NET_DROP_RING_FULL);
             NetReleaseBuf(buf);
-            buf = NetAllocBuf();
-            desc->addr = (u64)(uintptr_t)buf->start;
+            return;
         }
 
-        desc->status = 0;
+        LinkBefore(&q->txQueue, &buf->link);
+        ++q->txQueueCount;
+        return;
+    }
 
-        MmioWrite32(s_device.mmioAddr + REG_RDT, s_device.rxRead);
+    EthIntelTxPost(q, buf);
 
-        s_device.rxRead = (s_device.rxRead + 1) & (RX_DESC_COUNT - 1);
-        desc = &s_device.rxDescs[s_device.rxRead];
+    // Ring the doorbell once a batch has built up rather than per packet
+    if (((q->txWrite - q->txTail) & (TX_DESC_COUNT - 1)) >= TX_BATCH_SIZE)
+    {
+        EthIntelTxFlush(q);
     }
 }
 
 // ------------------------------------------------------------------------------------------------
-static void EthIntelSend(NetBuf *buf)
+static u64 EthIntelReadStat64(u8 *mmioAddr, uint reg)
+{
+    // The low half must be read first; reading the high half clears the counter
+    u64 lo = MmioRead32(mmioAddr + reg);
+    u64 hi = MmioRead32(mmioAddr + reg + 4);
+    return lo | (hi << 32);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelUpdateStats(NetIntf *intf)
+{
+    EthIntelDevice *dev = intf->dev;
+    u8 *mmioAddr = dev->mmioAddr;
+    NetIntfStats *stats = &intf->stats;
+
+    // Statistics registers clear on read, so accumulate them
+    stats->hwRxPackets += MmioRead32(mmioAddr + REG_GPRC);
+    stats->hwRxBytes += EthIntelReadStat64(mmioAddr, REG_GORCL);
+    stats->hwTxPackets += MmioRead32(mmioAddr + REG_GPTC);
+    stats->hwTxBytes += EthIntelReadStat64(mmioAddr, REG_GOTCL);
+    stats->hwRxMissed += MmioRead32(mmioAddr + REG_MPC);
+    stats->hwRxNoBuf += MmioRead32(mmioAddr + REG_RNBC);
+    stats->hwRxCrcErrors += MmioRead32(mmioAddr + REG_CRCERRS);
+    stats->hwRxLengthErrors += MmioRead32(mmioAddr + REG_RLEC);
+    stats->hwRxErrors += MmioRead32(mmioAddr + REG_RXERRC) + MmioRead32(mmioAddr + REG_ALGNERRC);
+    stats->hwTxCollisions += MmioRead32(mmioAddr + REG_COLC);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelRxInit(EthIntelQueue *q)
 {
-    TransDesc *desc = &s_device.txDescs[s_device.txWrite];
-    NetBuf *oldBuf = s_device.txBufs[s_device.txWrite];
+    u8 *regs = q->dev->mmioAddr + q->regOffset;
 
-    // Wait until packet is sent
-    while (!(desc->status & 0xf))
+    // The ring is kept when buffers are resized for a new MTU
+    if (!q->rxDescs)
     {
-        PitWait(1);
+        q->rxDescs = VMAlloc(RX_DESC_COUNT * sizeof(RecvDesc));
     }
 
-    // Free packet that was sent with this descriptor.
-    // TODO - free packets earlier?
+    RecvDesc *rxDescs = q->rxDescs;
 
-    if (oldBuf)
+    for (uint i = 0; i < RX_DESC_COUNT; ++i)
     {
-        NetReleaseBuf(oldBuf);
+        NetBuf *buf = NetAllocBufSize(q->dev->rxBufSize);
+
+        q->rxBufs[i] = buf;
+
+        EthIntelRxPost(q, rxDescs + i, buf);
     }
 
-    // Write new tx descriptor
-    desc->addr = (u64)(uintptr_t)buf->start;
-    desc->len = buf->end - buf->start;
-    desc->cmd = CMD_EOP | CMD_IFCS | CMD_RS;
-    desc->status = 0;
-    s_device.txBufs[s_device.txWrite] = buf;
+    q->rxRead = 0;
 
-    s_device.txWrite = (s_device.txWrite + 1) & (TX_DESC_COUNT - 1);
-    MmioWrite32(s_device.mmioAddr + REG_TDT, s_device.txWrite);
+    MmioWrite32(regs + REG_RDBAL, (uintptr_t)rxDescs);
+    MmioWrite32(regs + REG_RDBAH, (uintptr_t)rxDescs >> 32);
+    MmioWrite32(regs + REG_RDLEN, RX_DESC_COUNT * 16);
+    MmioWrite32(regs + REG_RDH, 0);
+    MmioWrite32(regs + REG_RDT, RX_DESC_COUNT - 1);
+}
+
+// ------------------------------------------------------------------------------------------------
+static u32 EthIntelRxSize(EthIntelDevice *dev, uint mtu)
+{
+    // Smallest hardware buffer size that holds a whole frame; returns the RCTL bits
+    uint frameSize = mtu + ETH_FRAME_OVERHEAD;
+
+    dev->mtu = mtu;
+    if (frameSize <= 2048)
+    {
+        dev->rxBufSize = 2048;
+        return RCTL_BSIZE_2048;
+    }
+    else if (frameSize <= 4096)
+    {
+        dev->rxBufSize = 4096;
+        return RCTL_BSIZE_4096 | RCTL_LPE;
+    }
+    else if (frameSize <= 8192)
+    {
+        dev->rxBufSize = 8192;
+        return RCTL_BSIZE_8192 | RCTL_LPE;
+    }
+    else
+    {
+        dev->rxBufSize = 16384;
+        return RCTL_BSIZE_16384 | RCTL_LPE;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelRxEnable(EthIntelDevice *dev)
+{
+    MmioWrite32(dev->mmioAddr + REG_RCTL,
+          RCTL_EN
+        | RCTL_LBM_NONE
+        | RTCL_RDMTS_HALF
+        | RCTL_MO_36
+        | RCTL_BAM
+        | RCTL_SECRC
+        | dev->rctlFilter
+        | EthIntelRxSize(dev, dev->mtu)
+        );
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelWriteRa(u8 *mmioAddr, uint slot, const EthAddr *addr)
+{
+    u8 *reg = mmioAddr + REG_RAL + slot * REG_RA_STRIDE;
+
+    if (!addr)
+    {
+        MmioWrite32(reg + (REG_RAH - REG_RAL), 0);
+        return;
+    }
+
+    const u8 *n = addr->n;
+    MmioWrite32(reg, n[0] | (n[1] << 8) | (n[2] << 16) | ((u32)n[3] << 24));
+    MmioWrite32(reg + (REG_RAH - REG_RAL), n[4] | (n[5] << 8) | RAH_AV);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelUpdateFilter(NetIntf *intf)
+{
+    EthIntelDevice *dev = intf->dev;
+    u8 *mmioAddr = dev->mmioAddr;
+
+    // Exact unicast matches after the station address in slot 0
+    for (uint slot = 1; slot < RA_SLOTS; ++slot)
+    {
+        uint i = slot - 1;
+        EthIntelWriteRa(mmioAddr, slot, i < intf->ucastCount ? &intf->ucastAddrs[i] : 0);
+    }
+
+    // Multicast hash from address bits 47:36 (RCTL.MO = 0)
+    u32 mta[MTA_REGS];
+    memset(mta, 0, sizeof(mta));
+
+    for (uint i = 0; i < intf->mcastCount; ++i)
+    {
+        const u8 *n = intf->mcastAddrs[i].n;
+        uint hash = ((n[4] >> 4) | (n[5] << 4)) & 0xfff;
+
+        mta[hash >> 5] |= 1 << (hash & 0x1f);
+    }
+
+    for (uint i = 0; i < MTA_REGS; ++i)
+    {
+        MmioWrite32(mmioAddr + REG_MTA + i * 4, mta[i]);
+    }
+
+    // Promiscuous capture for tracing
+    dev->rctlFilter = intf->promisc ? RCTL_UPE | RCTL_MPE : 0;
+
+    u32 rctl = MmioRead32(mmioAddr + REG_RCTL) & ~(RCTL_UPE | RCTL_MPE);
+    MmioWrite32(mmioAddr + REG_RCTL, rctl | dev->rctlFilter);
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool EthIntelSetMtu(NetIntf *intf, uint mtu)
+{
+    EthIntelDevice *dev = intf->dev;
+
+    if (mtu > ETH_MAX_MTU)
+    {
+        return false;
+    }
+
+    // Stop the receiver and swap every ring buffer for one of the new size
+    u8 *mmioAddr = dev->mmioAddr;
+    MmioWrite32(mmioAddr + REG_RCTL, MmioRead32(mmioAddr + REG_RCTL) & ~RCTL_EN);
+
+    EthIntelRxSize(dev, mtu);
+
+    for (uint i = 0; i < dev->queueCount; ++i)
+    {
+        EthIntelQueue *q = &dev->queues[i];
+
+        for (uint j = 0; j < RX_DESC_COUNT; ++j)
+        {
+            NetReleaseBuf(q->rxBufs[j]);
+        }
+
+        EthIntelRxInit(q);
+    }
+
+    EthIntelRxEnable(dev);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelTxInit(EthIntelQueue *q)
+{
+    u8 *regs = q->dev->mmioAddr + q->regOffset;
+
+    TransDesc *txDescs = VMAlloc(TX_DESC_COUNT * sizeof(TransDesc));
+    q->txDescs = txDescs;
+
+    TransDesc *txDesc = txDescs;
+    TransDesc *txEnd = txDesc + TX_DESC_COUNT;
+    memset(txDesc, 0, TX_DESC_COUNT * 16);
+
+    for (; txDesc != txEnd; ++txDesc)
+    {
+        txDesc->status = TSTA_DD;      // mark descriptor as 'complete'
+    }
+
+    q->txWrite = 0;
+    q->txClean = 0;
+    q->txTail = 0;
+    q->txContext = 0;
+    LinkInit(&q->txQueue);
+
+    MmioWrite32(regs + REG_TDBAL, (uintptr_t)txDescs);
+    MmioWrite32(regs + REG_TDBAH, (uintptr_t)txDescs >> 32);
+    MmioWrite32(regs + REG_TDLEN, TX_DESC_COUNT * 16);
+    MmioWrite32(regs + REG_TDH, 0);
+    MmioWrite32(regs + REG_TDT, 0);
+
+    if (q->dev->queueCount > 1)
+    {
+        MmioWrite32(regs + REG_TARC, MmioRead32(regs + REG_TARC) | TARC_ENABLE);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelRssInit(EthIntelDevice *dev)
+{
+    u8 *mmioAddr = dev->mmioAddr;
+
+    // Toeplitz key
+    for (uint i = 0; i < sizeof(s_rssKey); i += 4)
+    {
+        u32 val = s_rssKey[i] | (s_rssKey[i + 1] << 8) | (s_rssKey[i + 2] << 16) | (s_rssKey[i + 3] << 24);
+        MmioWrite32(mmioAddr + REG_RSSRK + i, val);
+    }
+
+    // Spread hash buckets evenly across the queues, four entries per register
+    for (uint i = 0; i < RETA_ENTRIES; i += 4)
+    {
+        u32 val = 0;
+        for (uint j = 0; j < 4; ++j)
+        {
+            uint queue = (i + j) % dev->queueCount;
+            val |= (queue << RETA_QUEUE_SHIFT) << (j * 8);
+        }
+
+        MmioWrite32(mmioAddr + REG_RETA + i, val);
+    }
+
+    MmioWrite32(mmioAddr + REG_MRQC, MRQC_RSS_ENABLE | MRQC_TCP_IPV4 | MRQC_IPV4);
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool EthIntelMsixInit(EthIntelDevice *dev, uint id)
+{
+    // One vector per queue plus one for other causes.  All are delivered to the boot CPU,
+    // which runs the poll loop that processes every queue.
+    uint vectors[MAX_QUEUES + 1];
+    uint apicIds[MAX_QUEUES + 1];
+    uint count = dev->queueCount + 1;
+
+    for (uint i = 0; i < dev->queueCount; ++i)
+    {
+        vectors[i] = IntrAlloc(EthIntelQueueIntr, &dev->queues[i]);
+        apicIds[i] = LocalApicGetId();
+    }
+
+    vectors[dev->queueCount] = IntrAlloc(EthIntelOtherIntr, dev);
+    apicIds[dev->queueCount] = LocalApicGetId();
+
+    for (uint i = 0; i < count; ++i)
+    {
+        if (!vectors[i])
+        {
+            return false;
+        }
+    }
+
+    if (!PciEnableMsix(id, count, vectors, apicIds))
+    {
+        return false;
+    }
+
+    // Map queue causes to table entries
+    u32 ivar = (IVAR_VALID | dev->queueCount) << IVAR_OTHER_SHIFT;
+    for (uint i = 0; i < dev->queueCount; ++i)
+    {
+        dev->queues[i].intrMask = ICR_RXQ0 << i;
+
+        ivar |= (IVAR_VALID | i) << (IVAR_RXQ0_SHIFT + i * IVAR_QUEUE_SHIFT);
+        ivar |= (IVAR_VALID | i) << (IVAR_TXQ0_SHIFT + i * IVAR_QUEUE_SHIFT);
+    }
+
+    u8 *mmioAddr = dev->mmioAddr;
+    MmioWrite32(mmioAddr + REG_CTRL_EXT, MmioRead32(mmioAddr + REG_CTRL_EXT) | CTRL_EXT_PBA_SUPPORT);
+    MmioWrite32(mmioAddr + REG_IVAR, ivar);
+    MmioWrite32(mmioAddr + REG_EIAC, ICR_RXQ0 * ((1 << dev->queueCount) - 1));
+    MmioWrite32(mmioAddr + REG_IMS, ICR_OTHER | ICR_LSC);
+
+    dev->vector = vectors[0];
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelIntrInit(EthIntelDevice *dev, uint id)
+{
+    for (uint i = 0; i < dev->queueCount; ++i)
+    {
+        EthIntelQueue *q = &dev->queues[i];
+        q->pollMode = true;
+        q->intrMask = IMS_RX;
+    }
+
+    if (dev->model->flags & MODEL_MSIX && EthIntelMsixInit(dev, id))
+    {
+        dev->intrMode = INTR_MSIX;
+        return;
+    }
+
+    // Otherwise prefer MSI, falling back to the legacy line through the I/O APIC
+    dev->vector = IntrAlloc(EthIntelIntr, dev);
+    if (dev->vector)
+    {
+        u8 irq = PciRead8(id, PCI_CONFIG_INTERRUPT_LINE);
+
+        if (PciEnableMsi(id, dev->vector, LocalApicGetId()))
+        {
+            dev->intrMode = INTR_MSI;
+        }
+        else if (irq != 0xff)
+        {
+            IntrRouteIrq(irq, dev->vector);
+            dev->intrMode = INTR_LEGACY;
+        }
+        else
+        {
+            dev->vector = 0;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthIntelModeration(EthIntelDevice *dev, uint itr, uint rdtr, uint radv)
+{
+    dev->itr = itr;
+    dev->rdtr = rdtr;
+    dev->radv = radv;
+
+    // ITR counts in 256ns units, the receive timers in 1.024us units
+    MmioWrite32(dev->mmioAddr + REG_ITR, itr * 1000 / 256);
+    MmioWrite32(dev->mmioAddr + REG_RDTR, rdtr * 1000 / 1024);
+    MmioWrite32(dev->mmioAddr + REG_RADV, radv * 1000 / 1024);
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -257,12 +1314,18 @@ void EthIntelInit(uint id, PciDeviceInfo *info)
         return;
     }
 
-    if (!(info->deviceId == 0x100e || info->deviceId == 0x1503))
+    const EthIntelModel *model = s_models;
+    while (model->deviceId && model->deviceId != info->deviceId)
+    {
+        ++model;
+    }
+
+    if (!model->deviceId)
     {
         return;
     }
 
-    ConsolePrint("Initializing Intel Gigabit Ethernet\n");
+    ConsolePrint("Initializing Intel Gigabit Ethernet %s\n", model->name);
 
     // Base I/O Address
     PciBar bar;
@@ -273,11 +1336,24 @@ void EthIntelInit(uint id, PciDeviceInfo *info)
         return;
     }
 
+    // Each port gets its own rings and register window
     u8 *mmioAddr = (u8 *)bar.u.address;
-    s_device.mmioAddr = mmioAddr;
+    EthIntelDevice *dev = VMAlloc(sizeof(EthIntelDevice));
+    memset(dev, 0, sizeof(EthIntelDevice));
+    LinkBefore(&s_devices, &dev->link);
+    EthIntfName(dev->name, sizeof(dev->name));
 
-    // IRQ
-    //u8 irq = PciRead8(id, PCI_CONFIG_INTERRUPT_LINE);
+    dev->mmioAddr = mmioAddr;
+    dev->model = model;
+    dev->queueCount = model->queueCount;
+
+    for (uint i = 0; i < dev->queueCount; ++i)
+    {
+        EthIntelQueue *q = &dev->queues[i];
+        q->dev = dev;
+        q->index = i;
+        q->regOffset = i * REG_QUEUE_STRIDE;
+    }
 
     // MAC address
     EthAddr localAddr;
@@ -311,78 +1387,63 @@ void EthIntelInit(uint id, PciDeviceInfo *info)
     char macStr[18];
     EthAddrToStr(macStr, sizeof(macStr), &localAddr);
 
-    ConsolePrint("MAC = %s\n", macStr);
+    ConsolePrint("%s MAC = %s\n", dev->name, macStr);
 
     // Set Link Up
     MmioWrite32(mmioAddr + REG_CTRL, MmioRead32(mmioAddr + REG_CTRL) | CTRL_SLU);
 
-    // Clear Multicast Table Array
-    for (int i = 0; i < 128; ++i)
+    // Only the station address in slot 0 and broadcasts are accepted until filters are added
+    EthIntelWriteRa(mmioAddr, 0, &localAddr);
+    for (uint slot = 1; slot < RA_SLOTS; ++slot)
     {
-        MmioWrite32(mmioAddr + REG_MTA + (i * 4), 0);
+        EthIntelWriteRa(mmioAddr, slot, 0);
     }
 
-    // Enable interrupts (TODO - only enable specific types as some of these are reserved bits)
-    //MmioWrite32(mmioAddr + REG_IMS, 0x1ffff);
+    for (uint i = 0; i < MTA_REGS; ++i)
+    {
+        MmioWrite32(mmioAddr + REG_MTA + (i * 4), 0);
+    }
 
-    // Clear all interrupts
+    // Interrupts stay masked until the first poll finds the receive ring empty
+    MmioWrite32(mmioAddr + REG_IMC, ~0u);
     MmioRead32(mmioAddr + REG_ICR);
 
-    // Allocate memory
-    RecvDesc *rxDescs = VMAlloc(RX_DESC_COUNT * sizeof(RecvDesc));
-    TransDesc *txDescs = VMAlloc(TX_DESC_COUNT * sizeof(TransDesc));
+    EthIntelModeration(dev, DEFAULT_ITR, DEFAULT_RDTR, DEFAULT_RADV);
+    EthIntelIntrInit(dev, id);
 
-    s_device.rxDescs = rxDescs;
-    s_device.txDescs = txDescs;
+    // Receive Setup - RSS needs extended descriptors, which report the hash in place of the
+    // packet checksum, while checksum status remains in the extended status
+    EthIntelRxSize(dev, NET_DEFAULT_MTU);
 
-    // Receive Setup
-    for (uint i = 0; i < RX_DESC_COUNT; ++i)
+    u32 rxcsum = RXCSUM_IPOFL | RXCSUM_TUOFL;
+    if (dev->queueCount > 1 && (model->flags & MODEL_RSS))
     {
-        NetBuf *buf = NetAllocBuf();
+        dev->rxExtended = true;
+        MmioWrite32(mmioAddr + REG_RFCTL, MmioRead32(mmioAddr + REG_RFCTL) | RFCTL_EXSTEN);
+        rxcsum |= RXCSUM_PCSD;
+    }
 
-        s_device.rxBufs[i] = buf;
+    for (uint i = 0; i < dev->queueCount; ++i)
+    {
+        EthIntelRxInit(&dev->queues[i]);
+    }
 
-        RecvDesc *rxDesc = rxDescs + i;
-        rxDesc->addr = (u64)(uintptr_t)buf->start;
-        rxDesc->status = 0;
+    if (dev->rxExtended)
+    {
+        EthIntelRssInit(dev);
     }
 
-    s_device.rxRead = 0;
+    // Verify IP and TCP/UDP checksums in hardware
+    MmioWrite32(mmioAddr + REG_RXCSUM, rxcsum);
 
-    MmioWrite32(mmioAddr + REG_RDBAL, (uintptr_t)rxDescs);
-    MmioWrite32(mmioAddr + REG_RDBAH, (uintptr_t)rxDescs >> 32);
-    MmioWrite32(mmioAddr + REG_RDLEN, RX_DESC_COUNT * 16);
-    MmioWrite32(mmioAddr + REG_RDH, 0);
-    MmioWrite32(mmioAddr + REG_RDT, RX_DESC_COUNT - 1);
-    MmioWrite32(mmioAddr + REG_RCTL,
-          RCTL_EN
-        | RCTL_SBP
-        | RCTL_UPE
-        | RCTL_MPE
-        | RCTL_LBM_NONE
-        | RTCL_RDMTS_HALF
-        | RCTL_BAM
-        | RCTL_SECRC
-        | RCTL_BSIZE_2048
-        );
+    EthIntelRxEnable(dev);
 
     // Transmit Setup
-    TransDesc *txDesc = txDescs;
-    TransDesc *txEnd = txDesc + TX_DESC_COUNT;
-    memset(txDesc, 0, TX_DESC_COUNT * 16);
-
-    for (; txDesc != txEnd; ++txDesc)
+    for (uint i = 0; i < dev->queueCount; ++i)
     {
-        txDesc->status = TSTA_DD;      // mark descriptor as 'complete'
+        EthIntelTxInit(&dev->queues[i]);
     }
 
-    s_device.txWrite = 0;
-
-    MmioWrite32(mmioAddr + REG_TDBAL, (uintptr_t)txDescs);
-    MmioWrite32(mmioAddr + REG_TDBAH, (uintptr_t)txDescs >> 32);
-    MmioWrite32(mmioAddr + REG_TDLEN, TX_DESC_COUNT * 16);
-    MmioWrite32(mmioAddr + REG_TDH, 0);
-    MmioWrite32(mmioAddr + REG_TDT, 0);
     MmioWrite32(mmioAddr + REG_TCTL,
           TCTL_EN
         | TCTL_PSP
@@ -395,10 +1456,50 @@ void EthIntelInit(uint id, PciDeviceInfo *info)
     NetIntf *intf = NetIntfCreate();
     intf->ethAddr = localAddr;
     intf->ipAddr = g_nullIpv4Addr;
-    intf->name = "eth";
+    intf->name = dev->name;
+    intf->dev = dev;
+    intf->caps = NET_INTF_TX_CSUM | NET_INTF_GSO | NET_INTF_TSO | NET_INTF_SG;
     intf->poll = EthIntelPoll;
     intf->send = EthSendIntf;
     intf->devSend = EthIntelSend;
+    intf->setMtu = EthIntelSetMtu;
+    intf->updateFilter = EthIntelUpdateFilter;
+    intf->updateStats = EthIntelUpdateStats;
+
+    // Discard counts from before the driver took over
+    EthIntelUpdateStats(intf);
+    memset(&intf->stats, 0, sizeof(intf->stats));
 
     NetIntfAdd(intf);
 }
+
+// ------------------------------------------------------------------------------------------------
+void EthIntelSetModeration(uint itr, uint rdtr, uint radv)
+{
+    EthIntelDevice *dev;
+    ListForEach(dev, s_devices, link)
+    {
+        EthIntelModeration(dev, itr, rdtr, radv);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void EthIntelPrintIntr()
+{
+    EthIntelDevice *dev;
+    ListForEach(dev, s_devices, link)
+    {
+        ConsolePrint("%s: %s vector=0x%x (%s)\n",
+            dev->name, dev->model->name, dev->vector, s_intrModeStrs[dev->intrMode]);
+        ConsolePrint("itr=%uus rdtr=%uus radv=%uus\n", dev->itr, dev->rdtr, dev->radv);
+
+        for (uint i = 0; i < dev->queueCount; ++i)
+        {
+            EthIntelQueue *q = &dev->queues[i];
+
+            ConsolePrint("queue %u: mode=%s interrupts=%u rx=%u tx=%u txdrops=%u\n",
+                i, q->pollMode ? "poll" : "interrupt", q->intrCount,
+                q->rxPackets, q->txPackets, q->txQueueDrops);
+        }
+    }
+}
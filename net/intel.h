@@ -7,3 +7,6 @@
 #include "pci/driver.h"
 
 void EthIntelInit(uint id, PciDeviceInfo *info);
+
+void EthIntelSetModeration(uint itr, uint rdtr, uint radv);
+void EthIntelPrintIntr();
@@ -3,6 +3,7 @@
 // ------------------------------------------------------------------------------------------------
 
 #include "net/intf.h"
+#include "console/console.h"
 #include "mem/vm.h"
 #include "stdlib/string.h"
 
@@ -10,6 +11,82 @@
 // Globals
 
 Link g_netIntfList = { &g_netIntfList, &g_netIntfList };
+u64 g_netDrops[NET_DROP_COUNT];
+
+static u64 s_netDropsMark[NET_DROP_COUNT];
+
+static const char *s_dropNames[NET_DROP_COUNT] =
+{
+    "header",
+    "filter",
+    "ethertype",
+    "checksum",
+    "fragment",
+    "too-long",
+    "protocol",
+    "no-port",
+    "socket-full",
+    "no-route",
+    "no-dest",
+    "arp-overflow",
+    "no-buf",
+    "ring-full",
+    "rx-error",
+    "hook",
+};
+
+// ------------------------------------------------------------------------------------------------
+static void NetIntfUpdateFilter(NetIntf *intf)
+{
+    if (intf->updateFilter)
+    {
+        intf->updateFilter(intf);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static int NetFindAddr(const EthAddr *addrs, uint count, const EthAddr *addr)
+{
+    for (uint i = 0; i < count; ++i)
+    {
+        if (EthAddrEq(&addrs[i], addr))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool NetAddAddr(EthAddr *addrs, uint *count, uint max, const EthAddr *addr)
+{
+    if (NetFindAddr(addrs, *count, addr) >= 0)
+    {
+        return true;
+    }
+
+    if (*count == max)
+    {
+        return false;
+    }
+
+    addrs[(*count)++] = *addr;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool NetRemoveAddr(EthAddr *addrs, uint *count, const EthAddr *addr)
+{
+    int index = NetFindAddr(addrs, *count, addr);
+    if (index < 0)
+    {
+        return false;
+    }
+
+    addrs[index] = addrs[--(*count)];
+    return true;
+}
 
 // ------------------------------------------------------------------------------------------------
 NetIntf *NetIntfCreate()
@@ -17,6 +94,7 @@ NetIntf *NetIntfCreate()
     NetIntf *intf = VMAlloc(sizeof(NetIntf));
     memset(intf, 0, sizeof(NetIntf));
     LinkInit(&intf->link);
+    intf->mtu = NET_DEFAULT_MTU;
 
     return intf;
 }
@@ -26,3 +104,190 @@ void NetIntfAdd(NetIntf *intf)
 {
     LinkBefore(&g_netIntfList, &intf->link);
 }
+
+// ------------------------------------------------------------------------------------------------
+NetIntf *NetIntfFind(const char *name)
+{
+    NetIntf *intf;
+    ListForEach(intf, g_netIntfList, link)
+    {
+        if (strcmp(intf->name, name) == 0)
+        {
+            return intf;
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool NetIntfSetMtu(NetIntf *intf, uint mtu)
+{
+    if (mtu < NET_MIN_MTU || !intf->setMtu)
+    {
+        return false;
+    }
+
+    // The device checks its own limit and resizes receive buffers
+    if (!intf->setMtu(intf, mtu))
+    {
+        return false;
+    }
+
+    intf->mtu = mtu;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool NetIntfJoinMulticast(NetIntf *intf, const EthAddr *addr)
+{
+    // Group bit must be set
+    if (~addr->n[0] & 1)
+    {
+        return false;
+    }
+
+    if (!NetAddAddr(intf->mcastAddrs, &intf->mcastCount, NET_INTF_MCAST_MAX, addr))
+    {
+        return false;
+    }
+
+    NetIntfUpdateFilter(intf);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void NetIntfLeaveMulticast(NetIntf *intf, const EthAddr *addr)
+{
+    if (NetRemoveAddr(intf->mcastAddrs, &intf->mcastCount, addr))
+    {
+        NetIntfUpdateFilter(intf);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+bool NetIntfAddUnicast(NetIntf *intf, const EthAddr *addr)
+{
+    if (addr->n[0] & 1)
+    {
+        return false;
+    }
+
+    if (!NetAddAddr(intf->ucastAddrs, &intf->ucastCount, NET_INTF_UCAST_MAX, addr))
+    {
+        return false;
+    }
+
+    NetIntfUpdateFilter(intf);
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void NetIntfRemoveUnicast(NetIntf *intf, const EthAddr *addr)
+{
+    if (NetRemoveAddr(intf->ucastAddrs, &intf->ucastCount, addr))
+    {
+        NetIntfUpdateFilter(intf);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void NetIntfSetPromisc(NetIntf *intf, bool enable)
+{
+    if (intf->promisc != enable)
+    {
+        intf->promisc = enable;
+        NetIntfUpdateFilter(intf);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+bool NetIntfAcceptAddr(const NetIntf *intf, const EthAddr *addr)
+{
+    // Software version of the filter programmed into the device
+    if (addr->n[0] & 1)
+    {
+        return EthAddrEq(addr, &g_broadcastEthAddr) ||
+            NetFindAddr(intf->mcastAddrs, intf->mcastCount, addr) >= 0;
+    }
+
+    return EthAddrEq(addr, &intf->ethAddr) ||
+        NetFindAddr(intf->ucastAddrs, intf->ucastCount, addr) >= 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+void NetIntfDrop(NetIntf *intf, uint reason)
+{
+    // Drops before an interface is known, such as a missing route, only count globally
+    ++g_netDrops[reason];
+
+    if (intf)
+    {
+        ++intf->stats.drops[reason];
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void NetPrintCounter(const char *name, u64 value, u64 mark)
+{
+    ConsolePrint("  %-14s %14llu %12llu\n", name, value, value - mark);
+}
+
+// ------------------------------------------------------------------------------------------------
+void NetIntfPrintStats(NetIntf *intf)
+{
+    if (intf->updateStats)
+    {
+        intf->updateStats(intf);
+    }
+
+    const NetIntfStats *s = &intf->stats;
+    const NetIntfStats *m = &intf->statsMark;
+
+    ConsolePrint("%-16s %14s %12s\n", intf->name, "total", "delta");
+    NetPrintCounter("rx packets", s->rxPackets, m->rxPackets);
+    NetPrintCounter("rx bytes", s->rxBytes, m->rxBytes);
+    NetPrintCounter("tx packets", s->txPackets, m->txPackets);
+    NetPrintCounter("tx bytes", s->txBytes, m->txBytes);
+
+    if (intf->updateStats)
+    {
+        NetPrintCounter("hw rx packets", s->hwRxPackets, m->hwRxPackets);
+        NetPrintCounter("hw rx bytes", s->hwRxBytes, m->hwRxBytes);
+        NetPrintCounter("hw tx packets", s->hwTxPackets, m->hwTxPackets);
+        NetPrintCounter("hw tx bytes", s->hwTxBytes, m->hwTxBytes);
+        NetPrintCounter("hw rx missed", s->hwRxMissed, m->hwRxMissed);
+        NetPrintCounter("hw rx no-buf", s->hwRxNoBuf, m->hwRxNoBuf);
+        NetPrintCounter("hw rx crc", s->hwRxCrcErrors, m->hwRxCrcErrors);
+        NetPrintCounter("hw rx length", s->hwRxLengthErrors, m->hwRxLengthErrors);
+        NetPrintCounter("hw rx errors", s->hwRxErrors, m->hwRxErrors);
+        NetPrintCounter("hw tx colls", s->hwTxCollisions, m->hwTxCollisions);
+    }
+
+    // Only reasons that have occurred
+    for (uint i = 0; i < NET_DROP_COUNT; ++i)
+    {
+        if (s->drops[i])
+        {
+            NetPrintCounter(s_dropNames[i], s->drops[i], m->drops[i]);
+        }
+    }
+
+    intf->statsMark = intf->stats;
+}
+
+// ------------------------------------------------------------------------------------------------
+void NetPrintDrops()
+{
+    ConsolePrint("%-16s %14s %12s\n", "all drops", "total", "delta");
+
+    for (uint i = 0; i < NET_DROP_COUNT; ++i)
+    {
+        if (g_netDrops[i])
+        {
+            NetPrintCounter(s_dropNames[i], g_netDrops[i], s_netDropsMark[i]);
+        }
+
+        s_netDropsMark[i] = g_netDrops[i];
+    }
+}
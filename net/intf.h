@@ -8,6 +8,57 @@
 #include "net/buf.h"
 #include "stdlib/link.h"
 
+// ------------------------------------------------------------------------------------------------
+// Configuration
+
+#define NET_INTF_MCAST_MAX      32          // Multicast groups joined per interface
+#define NET_INTF_UCAST_MAX      15          // Unicast addresses in addition to ethAddr
+
+// ------------------------------------------------------------------------------------------------
+// Drop Reasons
+
+#define NET_DROP_HEADER         0       // Truncated or malformed header
+#define NET_DROP_FILTER         1       // Destination address not accepted
+#define NET_DROP_ETHERTYPE      2       // No handler for the ethertype
+#define NET_DROP_CHECKSUM       3       // IPv4, TCP or UDP checksum mismatch
+#define NET_DROP_FRAGMENT       4       // IPv4 fragments are not reassembled
+#define NET_DROP_TOO_LONG       5       // Frame larger than the receive buffer or IP length
+#define NET_DROP_PROTOCOL       6       // No handler for the IP protocol
+#define NET_DROP_NO_PORT        7       // No connection or socket for the destination port
+#define NET_DROP_SOCKET_FULL    8       // Socket receive queue full
+#define NET_DROP_NO_ROUTE       9       // No route to the destination
+#define NET_DROP_NO_DEST        10      // No link-layer destination for the protocol
+#define NET_DROP_ARP_OVERFLOW   11      // Pending queue of an unresolved address full
+#define NET_DROP_NO_BUF         12      // Buffer allocation failed
+#define NET_DROP_RING_FULL      13      // Device transmit ring and queue full
+#define NET_DROP_RX_ERROR       14      // Device reported a receive error
+#define NET_DROP_HOOK           15      // Dropped by the receive hook, see net/xdp.h
+#define NET_DROP_COUNT          16
+
+// ------------------------------------------------------------------------------------------------
+// Net Interface Statistics
+
+typedef struct NetIntfStats
+{
+    u64 rxPackets;
+    u64 rxBytes;
+    u64 txPackets;
+    u64 txBytes;
+    u64 drops[NET_DROP_COUNT];
+
+    // device counters, accumulated by updateStats where the hardware keeps them
+    u64 hwRxPackets;
+    u64 hwRxBytes;
+    u64 hwTxPackets;
+    u64 hwTxBytes;
+    u64 hwRxMissed;                     // no free descriptor
+    u64 hwRxNoBuf;                      // descriptor ring ran empty
+    u64 hwRxCrcErrors;
+    u64 hwRxLengthErrors;
+    u64 hwRxErrors;                     // symbol, sequence and alignment errors
+    u64 hwTxCollisions;
+} NetIntfStats;
+
 // ------------------------------------------------------------------------------------------------
 // Net Interface
 
@@ -18,19 +69,66 @@ typedef struct NetIntf
     Ipv4Addr ipAddr;
     Ipv4Addr broadcastAddr;
     const char *name;
+    uint caps;                          // NET_INTF_* offload capabilities
+    uint mtu;                           // largest IP datagram sent or received
+    void *dev;                          // driver instance state
+    struct NetIntf *master;             // aggregate this port receives for, 0 if none
 
     void (*poll)(struct NetIntf *intf);
     void (*send)(struct NetIntf *intf, const void *dstAddr, u16 etherType, NetBuf *buf);
-    void (*devSend)(NetBuf *buf);
+    void (*devSend)(struct NetIntf *intf, NetBuf *buf);
+    bool (*setMtu)(struct NetIntf *intf, uint mtu);     // null if the MTU is fixed
+
+    // receive filter, programmed into the device by updateFilter
+    EthAddr mcastAddrs[NET_INTF_MCAST_MAX];
+    uint mcastCount;
+    EthAddr ucastAddrs[NET_INTF_UCAST_MAX];
+    uint ucastCount;
+    bool promisc;
+    void (*updateFilter)(struct NetIntf *intf);
+
+    // counters, and their values at the last NetIntfPrintStats
+    NetIntfStats stats;
+    NetIntfStats statsMark;
+    void (*updateStats)(struct NetIntf *intf);        // null if the device keeps no counters
+
+    // XDP_* verdict on each raw received frame before the stack sees it, null if none
+    uint (*rxHook)(struct NetIntf *intf, NetBuf *buf, struct NetIntf **target);
+    void *rxHookCtx;
 } NetIntf;
 
+#define NET_DEFAULT_MTU         1500
+#define NET_MIN_MTU             68
+
+// ------------------------------------------------------------------------------------------------
+// Interface Capabilities
+
+#define NET_INTF_TX_CSUM        0x01    // Device completes partial TCP/UDP checksums
+#define NET_INTF_GSO            0x02    // Send path accepts TCP super-segments
+#define NET_INTF_TSO            0x04    // Device segments TCP super-segments itself
+#define NET_INTF_SG             0x08    // Device gathers a frame from a NetBuf chain
+
 // ------------------------------------------------------------------------------------------------
 // Globals
 
 extern Link g_netIntfList;
+extern u64 g_netDrops[NET_DROP_COUNT];      // Drops on all interfaces, and those before routing
 
 // ------------------------------------------------------------------------------------------------
 // Functions
 
 NetIntf *NetIntfCreate();
 void NetIntfAdd(NetIntf *intf);
+NetIntf *NetIntfFind(const char *name);
+bool NetIntfSetMtu(NetIntf *intf, uint mtu);
+
+bool NetIntfJoinMulticast(NetIntf *intf, const EthAddr *addr);
+void NetIntfLeaveMulticast(NetIntf *intf, const EthAddr *addr);
+bool NetIntfAddUnicast(NetIntf *intf, const EthAddr *addr);
+void NetIntfRemoveUnicast(NetIntf *intf, const EthAddr *addr);
+void NetIntfSetPromisc(NetIntf *intf, bool enable);
+bool NetIntfAcceptAddr(const NetIntf *intf, const EthAddr *addr);
+
+void NetIntfDrop(NetIntf *intf, uint reason);
+void NetIntfPrintStats(NetIntf *intf);
+void NetPrintDrops();
@@ -6,6 +6,7 @@
 #include "net/checksum.h"
 #include "net/eth.h"
 #include "net/icmp.h"
+#include "net/latency.h"
 #include "net/net.h"
 #include "net/route.h"
 #include "net/swap.h"
@@ -18,11 +19,13 @@
 // ------------------------------------------------------------------------------------------------
 void Ipv4Recv(NetIntf *intf, NetBuf *pkt)
 {
+    LatencyStamp(pkt, LAT_RX_IPV4);
     Ipv4Print(pkt);
 
     // Validate packet header
     if (pkt->start + sizeof(Ipv4Header) > pkt->end)
     {
+        NetIntfDrop(intf, NET_DROP_HEADER);
         return;
     }
 
@@ -31,6 +34,22 @@ void Ipv4Recv(NetIntf *intf, NetBuf *pkt)
     uint version = (hdr->verIhl >> 4) & 0xf;
     if (version != 4)
     {
+        NetIntfDrop(intf, NET_DROP_HEADER);
+        return;
+    }
+
+    // Validate header checksum unless the hardware already has
+    uint ihl = (hdr->verIhl) & 0xf;
+    if (ihl < 5 || pkt->start + (ihl << 2) > pkt->end)
+    {
+        NetIntfDrop(intf, NET_DROP_HEADER);
+        return;
+    }
+
+    if (~pkt->csumFlags & NET_CSUM_IP_VALID &&
+        NetChecksum(pkt->start, pkt->start + (ihl << 2)))
+    {
+        NetIntfDrop(intf, NET_DROP_CHECKSUM);
         return;
     }
 
@@ -40,22 +59,21 @@ void Ipv4Recv(NetIntf *intf, NetBuf *pkt)
     // Fragments are not handled yet
     if (fragment)
     {
+        NetIntfDrop(intf, NET_DROP_FRAGMENT);
         return;
     }
 
     // Jump to packet data
-    uint ihl = (hdr->verIhl) & 0xf;
-
-    // Update packet end
-    u8 *ipEnd = pkt->start + NetSwap16(hdr->len);
-    if (ipEnd > pkt->end)
+    // Update packet end, which may lie in a later fragment of a chain built by GRO
+    uint ipLen = NetSwap16(hdr->len);
+    if (ipLen > NetBufLen(pkt))
     {
-        ConsolePrint("IP Packet too long\n");
+        NetIntfDrop(intf, NET_DROP_TOO_LONG);
         return;
     }
 
+    NetBufTrim(pkt, ipLen);
     pkt->start += ihl << 2;
-    pkt->end = ipEnd;
 
     // Dispatch based on protocol
     switch (hdr->protocol)
@@ -71,6 +89,10 @@ void Ipv4Recv(NetIntf *intf, NetBuf *pkt)
     case IP_PROTOCOL_UDP:
         UdpRecv(intf, hdr, pkt);
         break;
+
+    default:
+        NetIntfDrop(intf, NET_DROP_PROTOCOL);
+        break;
     }
 }
 
@@ -78,13 +100,15 @@ void Ipv4Recv(NetIntf *intf, NetBuf *pkt)
 void Ipv4SendIntf(NetIntf *intf, const Ipv4Addr *nextAddr,
     const Ipv4Addr *dstAddr, u8 protocol, NetBuf *pkt)
 {
+    LatencyStamp(pkt, LAT_TX_IPV4);
+
     // IPv4 Header
     pkt->start -= sizeof(Ipv4Header);
 
     Ipv4Header *hdr = (Ipv4Header *)pkt->start;
     hdr->verIhl = (4 << 4) | 5;
     hdr->tos = 0;
-    hdr->len = NetSwap16(pkt->end - pkt->start);
+    hdr->len = NetSwap16(NetBufLen(pkt));
     hdr->id = NetSwap16(0);
     hdr->offset = NetSwap16(0);
     hdr->ttl = 64;
@@ -93,8 +117,7 @@ void Ipv4SendIntf(NetIntf *intf, const Ipv4Addr *nextAddr,
     hdr->src = intf->ipAddr;
     hdr->dst = *dstAddr;
 
-    uint checksum = NetChecksum(pkt->start, pkt->start + sizeof(Ipv4Header));
-    hdr->checksum = NetSwap16(checksum);
+    hdr->checksum = NetChecksum(pkt->start, pkt->start + sizeof(Ipv4Header));
 
     Ipv4Print(pkt);
 
@@ -112,6 +135,11 @@ void Ipv4Send(const Ipv4Addr *dstAddr, u8 protocol, NetBuf *pkt)
 
         Ipv4SendIntf(route->intf, nextAddr, dstAddr, protocol, pkt);
     }
+    else
+    {
+        NetIntfDrop(0, NET_DROP_NO_ROUTE);
+        NetReleaseBuf(pkt);
+    }
 }
 
 // ------------------------------------------------------------------------------------------------
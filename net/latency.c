@@ -0,0 +1,159 @@
+// ------------------------------------------------------------------------------------------------
+// net/latency.c
+// ------------------------------------------------------------------------------------------------
+
+#include "net/latency.h"
+#include "console/console.h"
+#include "stdlib/string.h"
+
+// ------------------------------------------------------------------------------------------------
+// Histograms - one per stage followed by end to end totals for each direction
+
+#define LAT_RX_TOTAL        LAT_STAGE_COUNT
+#define LAT_TX_TOTAL        (LAT_STAGE_COUNT + 1)
+#define LAT_HIST_COUNT      (LAT_STAGE_COUNT + 2)
+
+typedef struct LatencyHist
+{
+    u64 sum;
+    u32 count;
+    u32 max;
+    u32 buckets[LAT_BUCKET_COUNT];
+} LatencyHist;
+
+static LatencyHist s_hists[LAT_HIST_COUNT];
+
+static const char *s_histNames[LAT_HIST_COUNT] =
+{
+    "rx-driver",
+    "rx-eth",
+    "rx-ipv4",
+    "rx-l4",
+    "rx-deliver",
+    "tx-send",
+    "tx-ipv4",
+    "tx-eth",
+    "tx-device",
+    "rx-total",
+    "tx-total",
+};
+
+// ------------------------------------------------------------------------------------------------
+static void LatencyAdd(LatencyHist *hist, u32 cycles)
+{
+    ++hist->buckets[31 - __builtin_clz(cycles | 1)];
+    ++hist->count;
+    hist->sum += cycles;
+
+    if (hist->max < cycles)
+    {
+        hist->max = cycles;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static u64 LatencyPercentile(const LatencyHist *hist, uint percent)
+{
+    // Upper bound of the bucket holding the requested sample
+    u64 target = ((u64)hist->count * percent + 99) / 100;
+    u64 seen = 0;
+
+    for (uint i = 0; i < LAT_BUCKET_COUNT; ++i)
+    {
+        seen += hist->buckets[i];
+        if (seen >= target)
+        {
+            return TscCyclesToNs(2ull << i);
+        }
+    }
+
+    return TscCyclesToNs(hist->max);
+}
+
+// ------------------------------------------------------------------------------------------------
+void LatencyRecord(const NetBuf *buf, uint first, uint last)
+{
+    u32 origin = 0;
+    u32 prev = 0;
+
+    for (uint stage = first; stage <= last; ++stage)
+    {
+        u32 stamp = buf->stamps[stage];
+        if (!stamp)
+        {
+            continue;
+        }
+
+        if (prev)
+        {
+            LatencyAdd(&s_hists[stage], stamp - prev);
+        }
+        else
+        {
+            origin = stamp;
+        }
+
+        prev = stamp;
+    }
+
+    if (prev != origin)
+    {
+        LatencyAdd(&s_hists[first < LAT_TX_SEND ? LAT_RX_TOTAL : LAT_TX_TOTAL], prev - origin);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void LatencyReset()
+{
+    memset(s_hists, 0, sizeof(s_hists));
+}
+
+// ------------------------------------------------------------------------------------------------
+void LatencyPrint()
+{
+    ConsolePrint("stage        samples     mean      p50      p99      max (ns)\n");
+
+    for (uint i = 0; i < LAT_HIST_COUNT; ++i)
+    {
+        const LatencyHist *hist = &s_hists[i];
+        if (!hist->count)
+        {
+            continue;
+        }
+
+        ConsolePrint("%-10s %9u %8u %8u %8u %8u\n",
+            s_histNames[i], hist->count,
+            (uint)TscCyclesToNs(hist->sum / hist->count),
+            (uint)LatencyPercentile(hist, 50),
+            (uint)LatencyPercentile(hist, 99),
+            (uint)TscCyclesToNs(hist->max));
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+bool LatencyPrintStage(const char *name)
+{
+    for (uint i = 0; i < LAT_HIST_COUNT; ++i)
+    {
+        if (strcmp(name, s_histNames[i]) != 0)
+        {
+            continue;
+        }
+
+        const LatencyHist *hist = &s_hists[i];
+
+        ConsolePrint("%s: %u samples\n", name, hist->count);
+        for (uint bucket = 0; bucket < LAT_BUCKET_COUNT; ++bucket)
+        {
+            if (hist->buckets[bucket])
+            {
+                ConsolePrint("  < %8u ns %9u\n",
+                    (uint)TscCyclesToNs(2ull << bucket), hist->buckets[bucket]);
+            }
+        }
+
+        return true;
+    }
+
+    return false;
+}
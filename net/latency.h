@@ -0,0 +1,54 @@
+// ------------------------------------------------------------------------------------------------
+// net/latency.h
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "net/buf.h"
+#include "cpu/tsc.h"
+
+// ------------------------------------------------------------------------------------------------
+// Stages
+//
+// Each buffer carries one time stamp per stage. A sample is the time from the previous stamped
+// stage of the same direction, so paths that skip a stage still attribute their time correctly.
+
+#define LAT_RX_DRIVER       0       // Frame taken from the receive ring
+#define LAT_RX_ETH          1       // EthRecv
+#define LAT_RX_IPV4         2       // Ipv4Recv
+#define LAT_RX_L4           3       // TcpRecv or UdpRecv
+#define LAT_RX_DELIVER      4       // Application callback or socket queue
+#define LAT_TX_SEND         5       // TcpSend or UdpSend
+#define LAT_TX_IPV4         6       // Ipv4SendIntf
+#define LAT_TX_ETH          7       // EthSendIntf
+#define LAT_TX_DEVICE       8       // Doorbell write covering the frame
+#define LAT_STAGE_COUNT     NET_BUF_STAMP_COUNT
+
+#define LAT_BUCKET_COUNT    32      // Power of two cycle buckets
+
+// ------------------------------------------------------------------------------------------------
+// Functions
+
+void LatencyRecord(const NetBuf *buf, uint first, uint last);
+void LatencyReset();
+void LatencyPrint();
+bool LatencyPrintStage(const char *name);
+
+// ------------------------------------------------------------------------------------------------
+static inline void LatencyStamp(NetBuf *buf, uint stage)
+{
+    // Low half of the TSC, good for latencies under a second; zero marks an unstamped stage
+    buf->stamps[stage] = (u32)TscRead() | 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+static inline void LatencyStartRx(NetBuf *buf)
+{
+    // Receive rings reuse buffers in place, so clear stamps left by the previous frame
+    for (uint stage = LAT_RX_ETH; stage <= LAT_RX_DELIVER; ++stage)
+    {
+        buf->stamps[stage] = 0;
+    }
+
+    LatencyStamp(buf, LAT_RX_DRIVER);
+}
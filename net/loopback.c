@@ -9,15 +9,43 @@
 #include "net/ipv6.h"
 #include "net/intf.h"
 #include "net/route.h"
+#include "console/console.h"
 
 // ------------------------------------------------------------------------------------------------
-static void LoopPoll(NetIntf *intf)
+// Receive Ring
+//
+// Sends are queued and delivered by the next poll, so replies generated while receiving do not
+// recurse back through the send path.
+
+typedef struct LoopEntry
 {
-}
+    NetBuf *pkt;
+    u16 etherType;
+} LoopEntry;
+
+static LoopEntry s_ring[LOOP_RING_SIZE];
+static uint s_head;                     // free running indices
+static uint s_tail;
+static uint s_maxDepth;
+
+static NetIntf *s_intf;
 
 // ------------------------------------------------------------------------------------------------
-static void LoopSend(NetIntf *intf, const void *dstAddr, u16 etherType, NetBuf *pkt)
+static void LoopRecv(NetIntf *intf, u16 etherType, NetBuf *pkt)
 {
+    ++intf->stats.rxPackets;
+    intf->stats.rxBytes += pkt->end - pkt->start;
+
+    // Headers were built here, and partial checksums are never completed as nothing leaves
+    if (pkt->csumFlags & NET_CSUM_PARTIAL)
+    {
+        pkt->csumFlags = NET_CSUM_IP_VALID | NET_CSUM_L4_VALID;
+    }
+    else
+    {
+        pkt->csumFlags = NET_CSUM_IP_VALID;
+    }
+
     // Route packet by protocol
     switch (etherType)
     {
@@ -32,11 +60,66 @@ static void LoopSend(NetIntf *intf, const void *dstAddr, u16 etherType, NetBuf *
     case ET_IPV6:
         Ipv6Recv(intf, pkt);
         break;
+
+    default:
+        NetIntfDrop(intf, NET_DROP_ETHERTYPE);
+        break;
     }
 
     NetReleaseBuf(pkt);
 }
 
+// ------------------------------------------------------------------------------------------------
+static void LoopPoll(NetIntf *intf)
+{
+    // Packets queued by the replies below wait for the next poll
+    uint end = s_head;
+    if (end - s_tail > LOOP_POLL_BUDGET)
+    {
+        end = s_tail + LOOP_POLL_BUDGET;
+    }
+
+    while (s_tail != end)
+    {
+        LoopEntry *entry = &s_ring[s_tail & (LOOP_RING_SIZE - 1)];
+        ++s_tail;
+
+        LoopRecv(intf, entry->etherType, entry->pkt);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void LoopSend(NetIntf *intf, const void *dstAddr, u16 etherType, NetBuf *pkt)
+{
+    if (s_head - s_tail == LOOP_RING_SIZE)
+    {
+        NetIntfDrop(intf, NET_DROP_RING_FULL);
+        NetReleaseBuf(pkt);
+        return;
+    }
+
+    // Receive paths expect contiguous packets
+    pkt = NetLinearizeBuf(pkt);
+    if (!pkt)
+    {
+        NetIntfDrop(intf, NET_DROP_NO_BUF);
+        return;
+    }
+
+    ++intf->stats.txPackets;
+    intf->stats.txBytes += pkt->end - pkt->start;
+
+    LoopEntry *entry = &s_ring[s_head & (LOOP_RING_SIZE - 1)];
+    entry->pkt = pkt;
+    entry->etherType = etherType;
+    ++s_head;
+
+    if (s_head - s_tail > s_maxDepth)
+    {
+        s_maxDepth = s_head - s_tail;
+    }
+}
+
 // ------------------------------------------------------------------------------------------------
 void LoopbackInit()
 {
@@ -48,12 +131,35 @@ void LoopbackInit()
     intf->ethAddr = g_nullEthAddr;
     intf->ipAddr = ipAddr;
     intf->name = "loop";
+    intf->caps = NET_INTF_TX_CSUM;
     intf->poll = LoopPoll;
     intf->send = LoopSend;
     intf->devSend = 0;
 
     NetIntfAdd(intf);
+    s_intf = intf;
 
     // Add routing entries
     NetAddRoute(&ipAddr, &subnetMask, 0, intf);
 }
+
+// ------------------------------------------------------------------------------------------------
+void LoopbackSetCsumOffload(bool enable)
+{
+    if (enable)
+    {
+        s_intf->caps |= NET_INTF_TX_CSUM;
+    }
+    else
+    {
+        s_intf->caps &= ~NET_INTF_TX_CSUM;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void LoopbackPrint()
+{
+    ConsolePrint("loop: queued=%d max=%d checksums=%s\n",
+        s_head - s_tail, s_maxDepth,
+        s_intf->caps & NET_INTF_TX_CSUM ? "skipped" : "computed");
+}
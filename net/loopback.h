@@ -4,4 +4,19 @@
 
 #pragma once
 
+#include "stdlib/types.h"
+
+// ------------------------------------------------------------------------------------------------
+// Configuration
+
+#define LOOP_RING_SIZE          512         // Packets waiting for delivery
+#define LOOP_POLL_BUDGET        64          // Packets delivered per poll
+
+// ------------------------------------------------------------------------------------------------
+// Functions
+
 void LoopbackInit();
+
+// With offload on, TCP and UDP leave partial checksums that the receiver trusts
+void LoopbackSetCsumOffload(bool enable);
+void LoopbackPrint();
@@ -4,9 +4,14 @@
 
 #include "net/net.h"
 #include "net/arp.h"
+#include "net/capture.h"
+#include "net/checksum.h"
 #include "net/dhcp.h"
+#include "net/dns.h"
 #include "net/loopback.h"
+#include "net/port.h"
 #include "net/tcp.h"
+#include "cpu/detect.h"
 
 // ------------------------------------------------------------------------------------------------
 // Globals
@@ -16,8 +21,11 @@ u8 g_netTrace = 0;
 // ------------------------------------------------------------------------------------------------
 void NetInit()
 {
+    NetChecksumInit(g_cpuFeatures);
+    NetPortInit();
     LoopbackInit();
     ArpInit();
+    DnsInit();
     TcpInit();
 
     // Initialize interfaces
@@ -42,5 +50,8 @@ void NetPoll()
         intf->poll(intf);
     }
 
+    ArpPoll();
+    DnsPoll();
     TcpPoll();
+    CapturePoll();
 }
@@ -43,10 +43,21 @@ typedef struct NtpHeader
 #define MODE_SERVER                     4
 
 // ------------------------------------------------------------------------------------------------
-void NtpRecv(NetIntf *intf, const NetBuf *pkt)
+// Static Variables
+
+static UdpSocket *s_ntpSocket;
+
+// ------------------------------------------------------------------------------------------------
+static void NtpRecv(UdpSocket *sock, NetIntf *intf,
+    const Ipv4Addr *srcAddr, u16 srcPort, const NetBuf *pkt)
 {
     NtpPrint(pkt);
 
+    if (srcPort != PORT_NTP)
+    {
+        return;
+    }
+
     if (pkt->start + sizeof(NtpHeader) > pkt->end)
     {
         return;
@@ -68,6 +79,19 @@ void NtpRecv(NetIntf *intf, const NetBuf *pkt)
 // ------------------------------------------------------------------------------------------------
 void NtpSend(const Ipv4Addr *dstAddr)
 {
+    if (!s_ntpSocket)
+    {
+        s_ntpSocket = UdpCreate();
+        s_ntpSocket->onRecv = NtpRecv;
+
+        if (!UdpBind(s_ntpSocket, 0, 0))
+        {
+            UdpClose(s_ntpSocket);
+            s_ntpSocket = 0;
+            return;
+        }
+    }
+
     NetBuf *pkt = NetAllocBuf();
 
     NtpHeader *hdr = (NtpHeader *)pkt->start;
@@ -84,10 +108,9 @@ void NtpSend(const Ipv4Addr *dstAddr)
     hdr->sendTimestamp = NetSwap64(0);
 
     pkt->end += sizeof(NtpHeader);
-    uint srcPort = NetEphemeralPort();
 
     NtpPrint(pkt);
-    UdpSend(dstAddr, PORT_NTP, srcPort, pkt);
+    UdpSend(dstAddr, PORT_NTP, s_ntpSocket->localPort, pkt);
 }
 
 // ------------------------------------------------------------------------------------------------
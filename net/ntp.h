@@ -7,7 +7,6 @@
 #include "net/intf.h"
 
 // ------------------------------------------------------------------------------------------------
-void NtpRecv(NetIntf *intf, const NetBuf *pkt);
 void NtpSend(const Ipv4Addr *dstAddr);
 
 void NtpPrint(const NetBuf *pkt);
@@ -3,12 +3,153 @@
 // ------------------------------------------------------------------------------------------------
 
 #include "net/port.h"
+#include "cpu/tsc.h"
 
-static u16 s_nextPort = 49152;
+// ------------------------------------------------------------------------------------------------
+// Globals
+
+static u32 s_bitmaps[PORT_SPACE_COUNT][PORT_EPHEMERAL_COUNT / 32];     // set bits are allocated
+static uint s_inUse[PORT_SPACE_COUNT];
+static u16 s_perturb[PORT_SPACE_COUNT][PORT_PERTURB_SIZE];
+
+static u64 s_rngState = 0x9e3779b97f4a7c15ull;
+static u32 s_offsetKey;
+static u32 s_perturbKey;
+
+// ------------------------------------------------------------------------------------------------
+u32 NetRandom()
+{
+    // xorshift64*
+    u64 x = s_rngState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    s_rngState = x;
+
+    return (x * 0x2545f4914f6cdd1dull) >> 32;
+}
+
+// ------------------------------------------------------------------------------------------------
+static u32 NetPortMix(u32 h)
+{
+    // MurmurHash3 finalizer - every input bit affects every output bit
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+// ------------------------------------------------------------------------------------------------
+static u32 NetPortHash(const Ipv4Addr *localAddr, const Ipv4Addr *remoteAddr, u16 remotePort,
+    u32 key)
+{
+    u32 h = key;
+    h = NetPortMix(h ^ (localAddr ? localAddr->u.bits : 0));
+    h = NetPortMix(h ^ remoteAddr->u.bits);
+    h = NetPortMix(h ^ remotePort);
+
+    return h;
+}
+
+// ------------------------------------------------------------------------------------------------
+void NetPortInit()
+{
+    // Keys are picked at boot so port sequences cannot be predicted across machines
+    s_rngState ^= TscRead() * 0x9e3779b97f4a7c15ull;
+    if (!s_rngState)
+    {
+        s_rngState = 1;
+    }
+
+    s_offsetKey = NetRandom();
+    s_perturbKey = NetRandom();
+}
+
+// ------------------------------------------------------------------------------------------------
+u16 NetEphemeralPort(uint space, const Ipv4Addr *localAddr, const Ipv4Addr *remoteAddr,
+    u16 remotePort, bool (*inUse)(u16 port))
+{
+    u32 *bitmap = s_bitmaps[space];
+    u16 *perturb = 0;
+    uint offset;
+
+    if (remoteAddr)
+    {
+        // Each destination gets its own sequence, advanced past the ports it has probed so
+        // reconnecting quickly does not land on a port the peer still holds in TIME-WAIT
+        offset = NetPortHash(localAddr, remoteAddr, remotePort, s_offsetKey);
+        perturb = &s_perturb[space][NetPortHash(localAddr, remoteAddr, remotePort, s_perturbKey) &
+            (PORT_PERTURB_SIZE - 1)];
+        offset += *perturb;
+    }
+    else
+    {
+        offset = NetRandom();
+    }
+
+    uint index = offset & (PORT_EPHEMERAL_COUNT - 1);
+    uint probes = 0;
+
+    while (probes < PORT_EPHEMERAL_COUNT)
+    {
+        // Skip the rest of a fully allocated word at once
+        u32 word = bitmap[index >> 5];
+        if (word == ~0u)
+        {
+            uint skip = 32 - (index & 31);
+            probes += skip;
+            index = (index + skip) & (PORT_EPHEMERAL_COUNT - 1);
+            continue;
+        }
+
+        ++probes;
+
+        u32 bit = 1u << (index & 31);
+        u16 port = PORT_EPHEMERAL_FIRST + index;
+
+        if (~word & bit && (!inUse || !inUse(port)))
+        {
+            bitmap[index >> 5] = word | bit;
+            ++s_inUse[space];
+
+            if (perturb)
+            {
+                *perturb += probes;
+            }
+
+            return port;
+        }
+
+        index = (index + 1) & (PORT_EPHEMERAL_COUNT - 1);
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+void NetReleasePort(uint space, u16 port)
+{
+    if (port < PORT_EPHEMERAL_FIRST)
+    {
+        return;
+    }
+
+    uint index = port - PORT_EPHEMERAL_FIRST;
+    u32 bit = 1u << (index & 31);
+    u32 *word = &s_bitmaps[space][index >> 5];
+
+    if (*word & bit)
+    {
+        *word &= ~bit;
+        --s_inUse[space];
+    }
+}
 
 // ------------------------------------------------------------------------------------------------
-u16 NetEphemeralPort()
+uint NetPortsInUse(uint space)
 {
-    // TODO - check for collisions with active connections.
-    return s_nextPort++;
+    return s_inUse[space];
 }
@@ -4,7 +4,7 @@
 
 #pragma once
 
-#include "stdlib/types.h"
+#include "net/addr.h"
 
 // ------------------------------------------------------------------------------------------------
 // Internet Ports
@@ -15,8 +15,35 @@
 #define PORT_NTP                        123
 
 #define PORT_OSHELPER                   4950
+#define PORT_CAPTURE                    4951
+
+// ------------------------------------------------------------------------------------------------
+// Ephemeral Ports - the IANA dynamic range
+
+#define PORT_EPHEMERAL_FIRST            49152
+#define PORT_EPHEMERAL_LAST             65535
+#define PORT_EPHEMERAL_COUNT            (PORT_EPHEMERAL_LAST - PORT_EPHEMERAL_FIRST + 1)
+
+#define PORT_PERTURB_SIZE               256         // RFC 6056 algorithm 4 table entries
+
+// Separate port spaces
+#define PORT_SPACE_TCP                  0
+#define PORT_SPACE_UDP                  1
+#define PORT_SPACE_COUNT                2
 
 // ------------------------------------------------------------------------------------------------
 // Functions
 
-u16 NetEphemeralPort();
+void NetPortInit();
+
+// Allocates an unused port, or returns 0 if the range is exhausted.  With a remote address the
+// search starts from a keyed hash of the endpoints (RFC 6056 algorithm 4), otherwise from a
+// random offset.  inUse, if given, rejects ports held by bindings the bitmap does not track.
+u16 NetEphemeralPort(uint space, const Ipv4Addr *localAddr, const Ipv4Addr *remoteAddr,
+    u16 remotePort, bool (*inUse)(u16 port));
+void NetReleasePort(uint space, u16 port);
+uint NetPortsInUse(uint space);
+
+// Values from the generator keyed by NetPortInit, for identifiers an off-path attacker should
+// not be able to guess.
+u32 NetRandom();
@@ -0,0 +1,90 @@
+// ------------------------------------------------------------------------------------------------
+// net/port_test.c
+// ------------------------------------------------------------------------------------------------
+
+#include "test/test.h"
+#include "net/port.h"
+
+// ------------------------------------------------------------------------------------------------
+static u8 s_seen[PORT_EPHEMERAL_COUNT];
+static u16 s_reserved;
+
+// ------------------------------------------------------------------------------------------------
+static bool ReservedInUse(u16 port)
+{
+    return port == s_reserved;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TestExhaust(uint space, const Ipv4Addr *localAddr, const Ipv4Addr *remoteAddr)
+{
+    for (uint i = 0; i < PORT_EPHEMERAL_COUNT; ++i)
+    {
+        s_seen[i] = 0;
+    }
+
+    // Every port is handed out exactly once
+    for (uint i = 0; i < PORT_EPHEMERAL_COUNT; ++i)
+    {
+        u16 port = NetEphemeralPort(space, localAddr, remoteAddr, 80, 0);
+        ASSERT_TRUE(port >= PORT_EPHEMERAL_FIRST);
+        ASSERT_EQ_UINT(s_seen[port - PORT_EPHEMERAL_FIRST], 0);
+        s_seen[port - PORT_EPHEMERAL_FIRST] = 1;
+    }
+
+    ASSERT_EQ_UINT(NetPortsInUse(space), PORT_EPHEMERAL_COUNT);
+    ASSERT_EQ_UINT(NetEphemeralPort(space, localAddr, remoteAddr, 80, 0), 0);
+
+    // A released port is the only one available
+    NetReleasePort(space, 50000);
+    ASSERT_EQ_UINT(NetPortsInUse(space), PORT_EPHEMERAL_COUNT - 1);
+    ASSERT_EQ_UINT(NetEphemeralPort(space, localAddr, remoteAddr, 80, 0), 50000);
+
+    // Release everything
+    for (uint port = PORT_EPHEMERAL_FIRST; port <= PORT_EPHEMERAL_LAST; ++port)
+    {
+        NetReleasePort(space, port);
+    }
+
+    ASSERT_EQ_UINT(NetPortsInUse(space), 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+int main(int argc, const char **argv)
+{
+    Ipv4Addr localAddr = { { { 10, 0, 2, 15 } } };
+    Ipv4Addr remoteAddr = { { { 10, 0, 2, 2 } } };
+
+    NetPortInit();
+
+    TestExhaust(PORT_SPACE_UDP, 0, 0);
+    TestExhaust(PORT_SPACE_TCP, &localAddr, &remoteAddr);
+
+    // Port spaces are independent
+    u16 port = NetEphemeralPort(PORT_SPACE_TCP, &localAddr, &remoteAddr, 80, 0);
+    ASSERT_EQ_UINT(NetPortsInUse(PORT_SPACE_TCP), 1);
+    ASSERT_EQ_UINT(NetPortsInUse(PORT_SPACE_UDP), 0);
+
+    // Repeated connections to one destination do not reuse the port just released
+    NetReleasePort(PORT_SPACE_TCP, port);
+    u16 next = NetEphemeralPort(PORT_SPACE_TCP, &localAddr, &remoteAddr, 80, 0);
+    ASSERT_TRUE(next != port);
+    NetReleasePort(PORT_SPACE_TCP, next);
+
+    // Ports bound outside the allocator are skipped
+    s_reserved = NetEphemeralPort(PORT_SPACE_UDP, 0, 0, 0, 0);
+    NetReleasePort(PORT_SPACE_UDP, s_reserved);
+
+    for (uint i = 0; i < PORT_EPHEMERAL_COUNT - 1; ++i)
+    {
+        ASSERT_TRUE(NetEphemeralPort(PORT_SPACE_UDP, 0, 0, 0, ReservedInUse) != s_reserved);
+    }
+
+    ASSERT_EQ_UINT(NetEphemeralPort(PORT_SPACE_UDP, 0, 0, 0, ReservedInUse), 0);
+
+    // Ports outside the range are ignored on release
+    NetReleasePort(PORT_SPACE_UDP, 80);
+    ASSERT_EQ_UINT(NetPortsInUse(PORT_SPACE_UDP), PORT_EPHEMERAL_COUNT - 1);
+
+    return EXIT_SUCCESS;
+}
@@ -28,18 +28,27 @@ void RlogPrint(const char *fmt, ...)
 
     uint len = strlen(msg) + 1;
 
-    // For each interface, broadcast a packet
+    // For each interface, broadcast a clone sharing one copy of the message
+    NetBuf *msgBuf = 0;
+
     NetIntf *intf;
     ListForEach(intf, g_netIntfList, link)
     {
         if (!Ipv4AddrEq(&intf->broadcastAddr, &g_nullIpv4Addr))
         {
-            NetBuf *pkt = NetAllocBuf();
-
-            strcpy((char *)pkt->start, msg);
-            pkt->end += len;
-
-            UdpSend(&intf->broadcastAddr, PORT_OSHELPER, PORT_OSHELPER, pkt);
+            if (!msgBuf)
+            {
+                msgBuf = NetAllocBuf();
+                memcpy(msgBuf->start, msg, len);
+                msgBuf->end += len;
+            }
+
+            UdpSendIntf(intf, &intf->broadcastAddr, PORT_OSHELPER, PORT_OSHELPER, NetCloneBuf(msgBuf));
         }
     }
+
+    if (msgBuf)
+    {
+        NetReleaseBuf(msgBuf);
+    }
 }
@@ -0,0 +1,414 @@
+// ------------------------------------------------------------------------------------------------
+// net/sim.c
+// ------------------------------------------------------------------------------------------------
+
+#include "net/sim.h"
+#include "net/arp.h"
+#include "net/eth.h"
+#include "net/gro.h"
+#include "net/ipv4.h"
+#include "net/latency.h"
+#include "net/route.h"
+#include "net/swap.h"
+#include "net/tcp.h"
+#include "stdlib/string.h"
+#include "time/pit.h"
+
+#include <stdlib.h>
+
+// ------------------------------------------------------------------------------------------------
+// Link Direction
+
+typedef struct SimFlow
+{
+    Ipv4Addr srcAddr;
+    Ipv4Addr dstAddr;
+    u16 srcPort;
+    u16 dstPort;
+    u32 sndMax;                         // end of the highest data seen
+} SimFlow;
+
+typedef struct SimPipe
+{
+    NetIntf *dst;
+    SimLinkConfig config;
+    SimLinkStats stats;
+    u64 busyUntil;                      // when the last queued frame finishes serializing
+    SimFlow flows[SIM_MAX_FLOWS];
+    uint flowCount;
+} SimPipe;
+
+// ------------------------------------------------------------------------------------------------
+// Frame on the wire
+
+typedef struct SimFrame
+{
+    Link link;
+    u64 arrival;
+    SimPipe *pipe;
+    NetBuf *buf;
+} SimFrame;
+
+// ------------------------------------------------------------------------------------------------
+// Globals
+
+volatile u32 g_pitTicks;
+u64 g_simTime;
+
+static Link s_inFlight = { &s_inFlight, &s_inFlight };     // sorted by arrival
+static u64 s_nextTick;
+static u64 s_rngState;
+static uint s_intfCount;
+
+// ------------------------------------------------------------------------------------------------
+static u32 SimRandom()
+{
+    // xorshift64*
+    u64 x = s_rngState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    s_rngState = x;
+
+    return (x * 0x2545f4914f6cdd1dull) >> 32;
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool SimChance(uint ppm)
+{
+    return ppm && SimRandom() % 1000000 < ppm;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void SimSetTime(u64 time)
+{
+    g_simTime = time;
+    g_pitTicks = time / SIM_NS_PER_TICK;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void SimCountRetransmit(SimPipe *pipe, const NetBuf *buf)
+{
+    // Data starting below what a flow has already sent must be a retransmission
+    const u8 *p = buf->start;
+    const u8 *end = buf->end;
+
+    if (end - p < sizeof(EthHeader) + sizeof(Ipv4Header))
+    {
+        return;
+    }
+
+    const EthHeader *ethHdr = (const EthHeader *)p;
+    const Ipv4Header *ipHdr = (const Ipv4Header *)(p + sizeof(EthHeader));
+    if (NetSwap16(ethHdr->etherType) != ET_IPV4 || ipHdr->protocol != IP_PROTOCOL_TCP)
+    {
+        return;
+    }
+
+    uint ipLen = NetSwap16(ipHdr->len);
+    uint ihl = (ipHdr->verIhl & 0xf) << 2;
+    const TcpHeader *tcpHdr = (const TcpHeader *)((const u8 *)ipHdr + ihl);
+    if ((const u8 *)(tcpHdr + 1) > end || ihl + sizeof(TcpHeader) > ipLen)
+    {
+        return;
+    }
+
+    uint dataLen = ipLen - ihl - (tcpHdr->off >> 4) * 4;
+    if (!dataLen || dataLen > ipLen)
+    {
+        return;
+    }
+
+    u16 srcPort = NetSwap16(tcpHdr->srcPort);
+    u16 dstPort = NetSwap16(tcpHdr->dstPort);
+    u32 seq = NetSwap32(tcpHdr->seq);
+
+    SimFlow *flow = 0;
+    for (uint i = 0; i < pipe->flowCount; ++i)
+    {
+        SimFlow *cur = &pipe->flows[i];
+        if (cur->srcPort == srcPort && cur->dstPort == dstPort &&
+            Ipv4AddrEq(&cur->srcAddr, &ipHdr->src) && Ipv4AddrEq(&cur->dstAddr, &ipHdr->dst))
+        {
+            flow = cur;
+            break;
+        }
+    }
+
+    if (!flow)
+    {
+        if (pipe->flowCount == SIM_MAX_FLOWS)
+        {
+            return;
+        }
+
+        flow = &pipe->flows[pipe->flowCount++];
+        flow->srcAddr = ipHdr->src;
+        flow->dstAddr = ipHdr->dst;
+        flow->srcPort = srcPort;
+        flow->dstPort = dstPort;
+        flow->sndMax = seq;
+    }
+
+    if (SEQ_LT(seq, flow->sndMax))
+    {
+        ++pipe->stats.tcpRetransmits;
+    }
+
+    if (SEQ_GT(seq + dataLen, flow->sndMax))
+    {
+        flow->sndMax = seq + dataLen;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void SimQueueFrame(SimPipe *pipe, NetBuf *buf, u64 arrival)
+{
+    SimFrame *frame = malloc(sizeof(SimFrame));
+    frame->arrival = arrival;
+    frame->pipe = pipe;
+    frame->buf = buf;
+
+    // Frames arriving together keep the order they were sent in
+    Link *it = s_inFlight.prev;
+    while (it != &s_inFlight)
+    {
+        SimFrame *prev = LinkData(it, SimFrame, link);
+        if (prev->arrival <= arrival)
+        {
+            break;
+        }
+
+        it = it->prev;
+    }
+
+    LinkAfter(it, &frame->link);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void SimDevSend(NetIntf *intf, NetBuf *buf)
+{
+    SimPipe *pipe = intf->dev;
+    SimLinkConfig *config = &pipe->config;
+
+    // The wire carries one contiguous frame
+    buf = NetLinearizeBuf(buf);
+    if (!buf)
+    {
+        NetIntfDrop(intf, NET_DROP_NO_BUF);
+        return;
+    }
+
+    uint len = buf->end - buf->start;
+    ++pipe->stats.frames;
+    pipe->stats.bytes += len;
+
+    SimCountRetransmit(pipe, buf);
+
+    // Serialize behind frames already queued, dropping the tail if the backlog is full
+    u64 start = pipe->busyUntil > g_simTime ? pipe->busyUntil : g_simTime;
+    u64 txTime = 0;
+
+    if (config->bitsPerSec)
+    {
+        if (config->queueLimit &&
+            (start - g_simTime) * config->bitsPerSec / 8000000000ull + len > config->queueLimit)
+        {
+            ++pipe->stats.queueDrops;
+            NetReleaseBuf(buf);
+            return;
+        }
+
+        txTime = (u64)(len + SIM_FRAME_OVERHEAD) * 8000000000ull / config->bitsPerSec;
+    }
+
+    pipe->busyUntil = start + txTime;
+
+    if (SimChance(config->lossPpm))
+    {
+        ++pipe->stats.lost;
+        NetReleaseBuf(buf);
+        return;
+    }
+
+    u64 arrival = pipe->busyUntil + config->delay;
+
+    if (SimChance(config->dupPpm))
+    {
+        NetBuf *dup = NetAllocBufSize(len);
+        if (dup)
+        {
+            memcpy(dup->start, buf->start, len);
+            dup->end = dup->start + len;
+
+            ++pipe->stats.duplicated;
+            SimQueueFrame(pipe, dup, arrival);
+        }
+    }
+
+    if (SimChance(config->reorderPpm))
+    {
+        ++pipe->stats.reordered;
+        arrival += config->reorderDelay;
+    }
+
+    SimQueueFrame(pipe, buf, arrival);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void SimPoll(NetIntf *intf)
+{
+    // Frames are delivered by SimRunUntil as the clock reaches them
+}
+
+// ------------------------------------------------------------------------------------------------
+static void SimDeliver()
+{
+    // Deliver every frame due now as one receive burst, including replies to them sent
+    // across links without delay
+    while (!ListIsEmpty(&s_inFlight))
+    {
+        SimFrame *frame = LinkData(s_inFlight.next, SimFrame, link);
+        if (frame->arrival > g_simTime)
+        {
+            break;
+        }
+
+        LinkRemove(&frame->link);
+
+        SimPipe *pipe = frame->pipe;
+        NetBuf *buf = frame->buf;
+        free(frame);
+
+        ++pipe->stats.delivered;
+
+        // Checksums are verified in software as on a device without offloads, unless the
+        // link models one that verifies them
+        buf->csumFlags = 0;
+        if (pipe->config.rxCsumOffload)
+        {
+            buf->csumFlags = NET_CSUM_IP_VALID | NET_CSUM_L4_VALID;
+        }
+        LatencyStartRx(buf);
+        GroRecv(pipe->dst, buf);
+        NetReleaseBuf(buf);
+    }
+
+    GroFlush();
+}
+
+// ------------------------------------------------------------------------------------------------
+void SimInit(u32 seed)
+{
+    s_rngState = 0x9e3779b97f4a7c15ull ^ seed;
+    SimSetTime(0);
+    s_nextTick = SIM_NS_PER_TICK;
+
+    ArpInit();
+    TcpInit();
+}
+
+// ------------------------------------------------------------------------------------------------
+NetIntf *SimCreateIntf(const char *name, const Ipv4Addr *ipAddr)
+{
+    EthAddr ethAddr = { { 0x02, 0x00, 0x00, 0x00, 0x00, ++s_intfCount } };
+
+    NetIntf *intf = NetIntfCreate();
+    intf->ethAddr = ethAddr;
+    intf->ipAddr = *ipAddr;
+    intf->name = name;
+    intf->poll = SimPoll;
+    intf->send = EthSendIntf;
+    intf->devSend = SimDevSend;
+
+    SimPipe *pipe = malloc(sizeof(SimPipe));
+    memset(pipe, 0, sizeof(SimPipe));
+    intf->dev = pipe;
+
+    NetIntfAdd(intf);
+
+    return intf;
+}
+
+// ------------------------------------------------------------------------------------------------
+void SimConnect(NetIntf *a, NetIntf *b, const SimLinkConfig *config)
+{
+    Ipv4Addr hostMask = { { { 255, 255, 255, 255 } } };
+
+    ((SimPipe *)a->dev)->dst = b;
+    ((SimPipe *)b->dev)->dst = a;
+    SimSetLink(a, b, config);
+
+    // Each end reaches the other directly
+    NetAddRoute(&b->ipAddr, &hostMask, 0, a);
+    NetAddRoute(&a->ipAddr, &hostMask, 0, b);
+}
+
+// ------------------------------------------------------------------------------------------------
+void SimSetLink(NetIntf *a, NetIntf *b, const SimLinkConfig *config)
+{
+    SimPipe *pipes[2] = { a->dev, b->dev };
+
+    for (uint i = 0; i < 2; ++i)
+    {
+        SimPipe *pipe = pipes[i];
+        pipe->config = *config;
+        memset(&pipe->stats, 0, sizeof(pipe->stats));
+        pipe->flowCount = 0;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+bool SimRunUntil(bool (*step)(void *ctx), void *ctx, u64 timeout)
+{
+    u64 end = g_simTime + timeout;
+
+    for (;;)
+    {
+        if (step && step(ctx))
+        {
+            return true;
+        }
+
+        // Jump to the next frame arrival or timer tick
+        u64 next = s_nextTick;
+        if (!ListIsEmpty(&s_inFlight))
+        {
+            SimFrame *frame = LinkData(s_inFlight.next, SimFrame, link);
+            if (frame->arrival < next)
+            {
+                next = frame->arrival;
+            }
+        }
+
+        if (next > end)
+        {
+            SimSetTime(end);
+            return false;
+        }
+
+        SimSetTime(next);
+        SimDeliver();
+
+        if (g_simTime >= s_nextTick)
+        {
+            s_nextTick += SIM_NS_PER_TICK;
+
+            ArpPoll();
+            TcpPoll();
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+void SimRun(u64 duration)
+{
+    SimRunUntil(0, 0, duration);
+}
+
+// ------------------------------------------------------------------------------------------------
+const SimLinkStats *SimGetStats(NetIntf *intf)
+{
+    SimPipe *pipe = intf->dev;
+    return &pipe->stats;
+}
@@ -0,0 +1,66 @@
+// ------------------------------------------------------------------------------------------------
+// net/sim.h
+// ------------------------------------------------------------------------------------------------
+//
+// Simulated Ethernet links for host builds.  Interfaces are joined by a virtual wire that
+// models bandwidth, delay, loss, reordering and duplication, and a virtual clock drives
+// g_pitTicks, so the whole stack runs deterministically inside one process.
+
+#pragma once
+
+#include "net/intf.h"
+
+// ------------------------------------------------------------------------------------------------
+// Configuration
+
+#define SIM_NS_PER_TICK         1000000     // g_pitTicks are milliseconds
+#define SIM_FRAME_OVERHEAD      24          // Preamble, FCS and inter-frame gap on the wire
+#define SIM_MAX_FLOWS           16          // TCP flows tracked per direction for retransmits
+
+// ------------------------------------------------------------------------------------------------
+// Link Model - applied to each direction separately
+
+typedef struct SimLinkConfig
+{
+    u64 bitsPerSec;                     // 0 for unlimited
+    u64 delay;                          // propagation delay (ns)
+    uint lossPpm;                       // frames lost, parts per million
+    uint reorderPpm;                    // frames held back by reorderDelay
+    u64 reorderDelay;                   // (ns)
+    uint dupPpm;                        // frames delivered twice
+    uint queueLimit;                    // bytes waiting to serialize before tail drop, 0 if none
+    bool rxCsumOffload;                 // deliver checksums as verified, letting GRO merge
+} SimLinkConfig;
+
+typedef struct SimLinkStats
+{
+    u64 frames;                         // handed to the link
+    u64 bytes;
+    u64 delivered;
+    u64 lost;
+    u64 queueDrops;
+    u64 reordered;
+    u64 duplicated;
+    u64 tcpRetransmits;                 // segments starting below data already sent on the flow
+} SimLinkStats;
+
+// ------------------------------------------------------------------------------------------------
+// Globals
+
+extern u64 g_simTime;                   // virtual clock (ns)
+
+// ------------------------------------------------------------------------------------------------
+// Functions
+
+void SimInit(u32 seed);
+NetIntf *SimCreateIntf(const char *name, const Ipv4Addr *ipAddr);
+void SimConnect(NetIntf *a, NetIntf *b, const SimLinkConfig *config);
+void SimSetLink(NetIntf *a, NetIntf *b, const SimLinkConfig *config);      // resets stats
+
+// Advances the clock, delivering frames and running stack timers.  step is called after each
+// event so workloads can send more, and ends the run by returning true.  Returns false if
+// timeout ns pass first.
+bool SimRunUntil(bool (*step)(void *ctx), void *ctx, u64 timeout);
+void SimRun(u64 duration);
+
+const SimLinkStats *SimGetStats(NetIntf *intf);     // frames sent by intf
@@ -0,0 +1,578 @@
+// ------------------------------------------------------------------------------------------------
+// net/sim_test.c
+// ------------------------------------------------------------------------------------------------
+
+#include "test/test.h"
+#include "net/arp.h"
+#include "net/dns.h"
+#include "net/port.h"
+#include "net/sim.h"
+#include "net/tcp.h"
+#include "net/udp.h"
+#include "stdlib/string.h"
+#include "time/pit.h"
+#include "time/time.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MS                      1000000ull
+#define US                      1000ull
+
+#define BULK_SIZE               (1024 * 1024)
+#define RPC_COUNT               1000
+#define RPC_REQUEST_SIZE        64
+#define RPC_RESPONSE_SIZE       1024
+
+// ------------------------------------------------------------------------------------------------
+// Mocked dependencies
+
+u8 g_netTrace;
+
+void RtcGetTime(DateTime *dt)
+{
+    SplitTime(dt, 0, 0);
+}
+
+void ConsolePrint(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+}
+
+void *VMAlloc(uint size)
+{
+    return malloc(size);
+}
+
+void *VMAllocAlign(uint size, uint align)
+{
+    return malloc(size);
+}
+
+uint SmpCpuIndex()
+{
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Scenarios
+
+typedef struct Scenario
+{
+    const char *name;
+    SimLinkConfig link;
+    bool lossless;
+} Scenario;
+
+static const Scenario s_scenarios[] =
+{
+    //                bits/s       delay     loss  reorder  delay    dup    queue  offload
+    { "1G 50us",    { 1000000000, 50 * US                              }, true },
+    { "gro 50us",   { 0,          50 * US,   0,    0,       0,     0,     0,     true }, true },
+    { "100M 1ms",   { 100000000,  1 * MS                               }, true },
+    { "reorder 1%", { 1000000000, 50 * US,   0,    10000,   20 * US      }, true },
+    { "dup 1%",     { 1000000000, 50 * US,   0,    0,       0,     10000 }, true },
+    { "loss 0.1%",  { 1000000000, 50 * US,   1000                      }, false },
+};
+
+#define SCENARIO_COUNT (sizeof(s_scenarios) / sizeof(s_scenarios[0]))
+
+static NetIntf *s_hostA;
+static NetIntf *s_hostB;
+static Ipv4Addr s_addrA = { { { 10, 0, 0, 1 } } };
+static Ipv4Addr s_addrB = { { { 10, 0, 0, 2 } } };
+static u16 s_nextPort = 5000;
+
+static u8 s_pattern[2048 + 256];        // byte i is i & 0xff, sent from any offset
+
+// ------------------------------------------------------------------------------------------------
+// Connections - a client on A and the server it connected to on B
+
+typedef struct ConnPair
+{
+    TcpConn *client;
+    TcpConn *server;
+} ConnPair;
+
+// ------------------------------------------------------------------------------------------------
+static bool Established(void *ctx)
+{
+    ConnPair *pair = ctx;
+    return pair->client->state == TCP_ESTABLISHED && pair->server->state == TCP_ESTABLISHED;
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool OpenConns(ConnPair *pair, void *ctx,
+    void (*onClientData)(TcpConn *conn, const u8 *data, uint len),
+    void (*onServerData)(TcpConn *conn, const u8 *data, uint len))
+{
+    u16 port = s_nextPort++;
+
+    pair->server = TcpCreate();
+    pair->server->ctx = ctx;
+    pair->server->onData = onServerData;
+    ASSERT_TRUE(TcpListen(pair->server, &s_addrB, port));
+
+    pair->client = TcpCreate();
+    pair->client->ctx = ctx;
+    pair->client->onData = onClientData;
+    ASSERT_TRUE(TcpConnect(pair->client, &s_addrB, port));
+
+    return SimRunUntil(Established, pair, 100 * MS);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void CloseConns(ConnPair *pair)
+{
+    TcpClose(pair->client);
+    TcpClose(pair->server);
+    SimRun(20 * MS);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void SendPaced(TcpConn *conn, uint *offset, uint end)
+{
+    // TcpSend does not hold data back for the peer's window, so pace to it here
+    while (*offset < end)
+    {
+        uint len = end - *offset;
+        if (len > conn->mss)
+        {
+            len = conn->mss;
+        }
+
+        if (conn->sndNxt - conn->sndUna + len > conn->sndWnd)
+        {
+            break;
+        }
+
+        TcpSend(conn, &s_pattern[*offset & 0xff], len);
+        *offset += len;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void PrintLink(const SimLinkStats *stats)
+{
+    printf("  frames=%llu lost=%llu queueDrops=%llu reordered=%llu duplicated=%llu"
+        " retransmits=%llu\n",
+        stats->frames, stats->lost, stats->queueDrops, stats->reordered, stats->duplicated,
+        stats->tcpRetransmits);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Bulk transfer from A to B
+
+typedef struct Bulk
+{
+    ConnPair pair;
+    uint sent;
+    uint received;
+    uint corrupt;
+} Bulk;
+
+static void BulkRecv(TcpConn *conn, const u8 *data, uint len)
+{
+    Bulk *bulk = conn->ctx;
+
+    for (uint i = 0; i < len; ++i)
+    {
+        if (data[i] != (u8)(bulk->received + i))
+        {
+            ++bulk->corrupt;
+        }
+    }
+
+    bulk->received += len;
+}
+
+static bool BulkStep(void *ctx)
+{
+    Bulk *bulk = ctx;
+
+    SendPaced(bulk->pair.client, &bulk->sent, BULK_SIZE);
+    return bulk->received == BULK_SIZE;
+}
+
+// ------------------------------------------------------------------------------------------------
+static u64 RunBulk(const Scenario *scenario)
+{
+    Bulk bulk;
+    memset(&bulk, 0, sizeof(bulk));
+
+    SimSetLink(s_hostA, s_hostB, &scenario->link);
+
+    if (!OpenConns(&bulk.pair, &bulk, 0, BulkRecv))
+    {
+        printf("bulk %-12s connection failed\n", scenario->name);
+        ASSERT_TRUE(!scenario->lossless);
+        return 0;
+    }
+
+    u64 start = g_simTime;
+    clock_t cpuStart = clock();
+
+    bool done = SimRunUntil(BulkStep, &bulk, 10000 * MS);
+
+    u64 elapsed = g_simTime - start;
+    clock_t cpu = clock() - cpuStart;
+
+    if (done)
+    {
+        printf("bulk %-12s %8llu Mbit/s  %6llu us  host cpu %ld us\n",
+            scenario->name, (u64)BULK_SIZE * 8000 / elapsed, elapsed / US,
+            (long)((u64)cpu * 1000000 / CLOCKS_PER_SEC));
+    }
+    else
+    {
+        printf("bulk %-12s stalled after %u of %u bytes\n",
+            scenario->name, bulk.received, BULK_SIZE);
+    }
+
+    PrintLink(SimGetStats(s_hostA));
+
+    ASSERT_EQ_UINT(bulk.corrupt, 0);
+    if (scenario->lossless)
+    {
+        ASSERT_TRUE(done);
+        ASSERT_EQ_UINT(SimGetStats(s_hostA)->tcpRetransmits, 0);
+    }
+
+    CloseConns(&bulk.pair);
+    return elapsed;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Request/response - A sends a request, B answers, A sends the next on receiving the answer
+
+typedef struct Rpc
+{
+    ConnPair pair;
+    uint requestSent;
+    uint requestRecv;
+    uint responseSent;
+    uint responseRecv;
+    uint completed;
+    bool outstanding;
+    u64 sentAt;
+    u64 samples[RPC_COUNT];
+} Rpc;
+
+static void RpcServerRecv(TcpConn *conn, const u8 *data, uint len)
+{
+    Rpc *rpc = conn->ctx;
+
+    rpc->requestRecv += len;
+    while (rpc->requestRecv >= RPC_REQUEST_SIZE)
+    {
+        rpc->requestRecv -= RPC_REQUEST_SIZE;
+        rpc->responseSent = 0;
+        SendPaced(conn, &rpc->responseSent, RPC_RESPONSE_SIZE);
+    }
+}
+
+static void RpcClientRecv(TcpConn *conn, const u8 *data, uint len)
+{
+    Rpc *rpc = conn->ctx;
+
+    rpc->responseRecv += len;
+    if (rpc->responseRecv >= RPC_RESPONSE_SIZE)
+    {
+        rpc->responseRecv -= RPC_RESPONSE_SIZE;
+        rpc->samples[rpc->completed++] = g_simTime - rpc->sentAt;
+        rpc->outstanding = false;
+    }
+}
+
+static bool RpcStep(void *ctx)
+{
+    Rpc *rpc = ctx;
+
+    if (!rpc->outstanding && rpc->completed < RPC_COUNT)
+    {
+        rpc->sentAt = g_simTime;
+        rpc->outstanding = true;
+        rpc->requestSent = 0;
+        SendPaced(rpc->pair.client, &rpc->requestSent, RPC_REQUEST_SIZE);
+    }
+
+    // Finish a response held back by the window
+    SendPaced(rpc->pair.server, &rpc->responseSent, RPC_RESPONSE_SIZE);
+
+    return rpc->completed == RPC_COUNT;
+}
+
+static int CompareU64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void RunRpc(const Scenario *scenario)
+{
+    Rpc *rpc = malloc(sizeof(Rpc));
+    memset(rpc, 0, sizeof(Rpc));
+    rpc->responseSent = RPC_RESPONSE_SIZE;
+
+    SimSetLink(s_hostA, s_hostB, &scenario->link);
+
+    if (!OpenConns(&rpc->pair, rpc, RpcClientRecv, RpcServerRecv))
+    {
+        printf("rpc  %-12s connection failed\n", scenario->name);
+        ASSERT_TRUE(!scenario->lossless);
+        free(rpc);
+        return;
+    }
+
+    bool done = SimRunUntil(RpcStep, rpc, 10000 * MS);
+
+    if (rpc->completed)
+    {
+        u64 *samples = rpc->samples;
+        uint n = rpc->completed;
+        qsort(samples, n, sizeof(u64), CompareU64);
+
+        printf("rpc  %-12s %8u done    p50 %llu us  p99 %llu us  max %llu us\n",
+            scenario->name, n, samples[n / 2] / US, samples[n * 99 / 100] / US,
+            samples[n - 1] / US);
+    }
+
+    if (!done)
+    {
+        printf("rpc  %-12s stalled after %u of %u requests\n",
+            scenario->name, rpc->completed, RPC_COUNT);
+    }
+
+    PrintLink(SimGetStats(s_hostA));
+
+    if (scenario->lossless)
+    {
+        ASSERT_TRUE(done);
+        ASSERT_EQ_UINT(SimGetStats(s_hostA)->tcpRetransmits, 0);
+        ASSERT_EQ_UINT(SimGetStats(s_hostB)->tcpRetransmits, 0);
+    }
+
+    CloseConns(&rpc->pair);
+    free(rpc);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TestUdp()
+{
+    SimLinkConfig link = { 1000000000, 50 * US };
+    SimSetLink(s_hostA, s_hostB, &link);
+
+    UdpSocket *server = UdpCreate();
+    ASSERT_TRUE(UdpBind(server, &s_addrB, 7));
+
+    // Overlapping bindings are refused whichever is made first
+    UdpSocket *other = UdpCreate();
+    ASSERT_TRUE(!UdpBind(other, &s_addrB, 7));
+    ASSERT_TRUE(!UdpBind(other, 0, 7));
+    ASSERT_TRUE(UdpBind(other, 0, 8));
+
+    UdpSocket *specific = UdpCreate();
+    ASSERT_TRUE(!UdpBind(specific, &s_addrB, 8));
+    UdpClose(specific);
+    UdpClose(other);
+
+    UdpSocket *client = UdpCreate();
+    ASSERT_TRUE(UdpBind(client, 0, 0));
+
+    // The first datagram waits for ARP resolution
+    ASSERT_TRUE(UdpSendTo(client, &s_addrB, 7, "hello", 5));
+    SimRun(1 * MS);
+
+    char buf[16];
+    Ipv4Addr srcAddr;
+    u16 srcPort;
+    ASSERT_EQ_INT(UdpRecvFrom(server, buf, sizeof(buf), &srcAddr, &srcPort), 5);
+    ASSERT_TRUE(memcmp(buf, "hello", 5) == 0);
+    ASSERT_TRUE(Ipv4AddrEq(&srcAddr, &s_addrA));
+
+    // Request, reply and datagram each cross once, and the clock drives the stack timers
+    ASSERT_EQ_UINT(SimGetStats(s_hostA)->frames, 2);
+    ASSERT_EQ_UINT(SimGetStats(s_hostB)->frames, 1);
+    ASSERT_EQ_UINT(g_pitTicks, g_simTime / SIM_NS_PER_TICK);
+
+    // Datagrams are bounded by the route's MTU, not the buffer size
+    static u8 big[NET_DEFAULT_MTU];
+    uint maxLen = NET_DEFAULT_MTU - sizeof(Ipv4Header) - sizeof(UdpHeader);
+    ASSERT_TRUE(!UdpSendTo(client, &s_addrB, 7, big, maxLen + 1));
+    ASSERT_TRUE(UdpSendTo(client, &s_addrB, 7, big, maxLen));
+    SimRun(1 * MS);
+    ASSERT_EQ_INT(UdpRecvFrom(server, big, sizeof(big), &srcAddr, &srcPort), (int)maxLen);
+
+    UdpClose(client);
+    UdpClose(server);
+}
+
+// ------------------------------------------------------------------------------------------------
+typedef struct DnsQuery
+{
+    u8 data[512];
+    int len;
+    u16 port;
+} DnsQuery;
+
+static Ipv4Addr s_dnsResult;
+static uint s_dnsCallbacks;
+
+static void OnResolve(void *ctx, const char *host, const Ipv4Addr *addr)
+{
+    ++s_dnsCallbacks;
+    s_dnsResult = addr ? *addr : g_nullIpv4Addr;
+}
+
+static void DnsAnswer(UdpSocket *server, DnsQuery *query, u16 id, const Ipv4Addr *addr)
+{
+    // Echo the question with one A record pointing back at it
+    static const u8 answer[] =
+    {
+        0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x04,
+    };
+
+    u8 reply[512];
+    memcpy(reply, query->data, query->len);
+    reply[0] = id >> 8;
+    reply[1] = id;
+    reply[2] |= 0x80;
+    reply[7] = 1;
+    memcpy(reply + query->len, answer, sizeof(answer));
+    memcpy(reply + query->len + sizeof(answer), addr, sizeof(Ipv4Addr));
+
+    uint len = query->len + sizeof(answer) + sizeof(Ipv4Addr);
+    ASSERT_TRUE(UdpSendTo(server, &s_addrA, query->port, reply, len));
+    SimRun(1 * MS);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TestDns()
+{
+    SimLinkConfig link = { 1000000000, 50 * US };
+    SimSetLink(s_hostA, s_hostB, &link);
+
+    UdpSocket *server = UdpCreate();
+    ASSERT_TRUE(UdpBind(server, &s_addrB, PORT_DNS));
+
+    DnsInit();
+    g_dnsServer = s_addrB;
+    uint portsInUse = NetPortsInUse(PORT_SPACE_UDP);
+
+    DnsQuery queries[2];
+    DnsResolve("a.example", OnResolve, 0);
+    DnsResolve("b.example", OnResolve, 0);
+    SimRun(1 * MS);
+
+    for (uint i = 0; i < 2; ++i)
+    {
+        DnsQuery *query = &queries[i];
+        Ipv4Addr srcAddr;
+        query->len = UdpRecvFrom(server, query->data, sizeof(query->data), &srcAddr,
+            &query->port);
+        ASSERT_TRUE(query->len > 12);
+    }
+
+    // Queries in flight together use different ports and IDs
+    u16 id = (queries[0].data[0] << 8) | queries[0].data[1];
+    ASSERT_TRUE(queries[0].port != queries[1].port);
+    ASSERT_TRUE(memcmp(queries[0].data, queries[1].data, 2) != 0);
+    ASSERT_EQ_UINT(NetPortsInUse(PORT_SPACE_UDP), portsInUse + 2);
+
+    // A reply with the wrong ID is ignored
+    Ipv4Addr forged = { { { 6, 6, 6, 6 } } };
+    DnsAnswer(server, &queries[0], id + 1, &forged);
+    ASSERT_EQ_UINT(s_dnsCallbacks, 0);
+
+    // The real reply resolves the name and releases the query's port
+    Ipv4Addr addr = { { { 10, 0, 0, 80 } } };
+    DnsAnswer(server, &queries[0], id, &addr);
+    ASSERT_EQ_UINT(s_dnsCallbacks, 1);
+    ASSERT_TRUE(Ipv4AddrEq(&s_dnsResult, &addr));
+    ASSERT_EQ_UINT(NetPortsInUse(PORT_SPACE_UDP), portsInUse + 1);
+
+    // Later lookups come from the cache
+    DnsResolve("A.example", OnResolve, 0);
+    ASSERT_EQ_UINT(s_dnsCallbacks, 2);
+
+    UdpClose(server);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TestArpFailure()
+{
+    // Everything sent from here on is lost
+    SimLinkConfig link = { 1000000000, 50 * US, 1000000 };
+    SimSetLink(s_hostA, s_hostB, &link);
+
+    // A stale mapping stays usable while it is probed
+    SimRun((ARP_REACHABLE_TIME + ARP_POLL_INTERVAL) * MS);
+    ASSERT_TRUE(ArpLookupEthAddr(&s_addrB) != 0);
+
+    // and is forgotten once the probes go unanswered
+    SimRun((ARP_MAX_PROBES + 1) * ARP_RETRANS_TIME * MS);
+    ASSERT_TRUE(ArpLookupEthAddr(&s_addrB) == 0);
+
+    // Sends queued for an address that never resolves are dropped
+    UdpSocket *client = UdpCreate();
+    ASSERT_TRUE(UdpBind(client, 0, 0));
+
+    u64 drops = s_hostA->stats.drops[NET_DROP_NO_DEST];
+    ASSERT_TRUE(UdpSendTo(client, &s_addrB, 7, "hello", 5));
+    SimRun((ARP_MAX_PROBES + 1) * ARP_RETRANS_TIME * MS);
+    ASSERT_EQ_UINT(s_hostA->stats.drops[NET_DROP_NO_DEST], drops + 1);
+
+    // Only the unicast probes and broadcast requests left, never the datagram
+    ASSERT_EQ_UINT(SimGetStats(s_hostA)->frames, ARP_MAX_PROBES + ARP_MAX_PROBES);
+
+    UdpClose(client);
+}
+
+// ------------------------------------------------------------------------------------------------
+int main(int argc, const char **argv)
+{
+    for (uint i = 0; i < sizeof(s_pattern); ++i)
+    {
+        s_pattern[i] = i;
+    }
+
+    SimInit(1);
+    s_hostA = SimCreateIntf("simA", &s_addrA);
+    s_hostB = SimCreateIntf("simB", &s_addrB);
+
+    SimLinkConfig link = { 0 };
+    SimConnect(s_hostA, s_hostB, &link);
+
+    TestUdp();
+    TestDns();
+
+    u64 first = 0;
+    for (uint i = 0; i < SCENARIO_COUNT; ++i)
+    {
+        u64 elapsed = RunBulk(&s_scenarios[i]);
+        if (i == 0)
+        {
+            first = elapsed;
+        }
+    }
+
+    // The same link gives the same timing
+    ASSERT_EQ_UINT(RunBulk(&s_scenarios[0]), first);
+
+    for (uint i = 0; i < SCENARIO_COUNT; ++i)
+    {
+        RunRpc(&s_scenarios[i]);
+    }
+
+    TestArpFailure();
+
+    return EXIT_SUCCESS;
+}
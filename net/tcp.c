@@ -6,6 +6,7 @@
 #include "net/buf.h"
 #include "net/checksum.h"
 #include "net/ipv4.h"
+#include "net/latency.h"
 #include "net/net.h"
 #include "net/port.h"
 #include "net/route.h"
@@ -117,11 +118,11 @@ static void TcpPrint(const NetBuf *pkt)
     u16 checksum = NetSwap16(hdr->checksum);
     u16 urgent = NetSwap16(hdr->urgent);
 
-    u16 checksum2 = NetChecksum(pkt->start - sizeof(ChecksumHeader), pkt->end);
+    u16 checksum2 = NetChecksumFinal(NetChecksumAccBuf(pkt, pkt->start - sizeof(ChecksumHeader), 0));
 
     uint hdrLen = hdr->off >> 2;
     //const u8 *data = (pkt->start + hdrLen);
-    uint dataLen = (pkt->end - pkt->start) - hdrLen;
+    uint dataLen = NetBufLen(pkt) - hdrLen;
 
     ConsolePrint("  TCP: src=%s:%d dst=%s:%d\n",
             srcAddrStr, srcPort, dstAddrStr, dstPort);
@@ -189,13 +190,23 @@ static void TcpFree(TcpConn *conn)
         NetReleaseBuf(pkt);
     }
 
+    NetReleasePort(PORT_SPACE_TCP, conn->localPort);
     LinkMoveBefore(&s_freeConns, &conn->link);
 }
 
+// ------------------------------------------------------------------------------------------------
+static uint TcpLocalMss(TcpConn *conn)
+{
+    return conn->intf->mtu - sizeof(Ipv4Header) - sizeof(TcpHeader);
+}
+
 // ------------------------------------------------------------------------------------------------
 static void TcpSendPacket(TcpConn *conn, u32 seq, u8 flags, const void *data, uint count)
 {
-    NetBuf *pkt = NetAllocBuf();
+    // Room for the header and MSS option; data beyond one MSS is a super-segment,
+    // split by the device or just before it
+    NetBuf *pkt = NetAllocBufSize(sizeof(TcpHeader) + 4 + count);
+    LatencyStamp(pkt, LAT_TX_SEND);
 
     // Header
     TcpHeader *hdr = (TcpHeader *)pkt->start;
@@ -217,7 +228,7 @@ static void TcpSendPacket(TcpConn *conn, u32 seq, u8 flags, const void *data, ui
         // Maximum Segment Size
         p[0] = OPT_MSS;
         p[1] = 4;
-        *(u16 *)(p + 2) = NetSwap16(1460);
+        *(u16 *)(p + 2) = NetSwap16(TcpLocalMss(conn));
         p += p[1];
     }
 
@@ -229,8 +240,24 @@ static void TcpSendPacket(TcpConn *conn, u32 seq, u8 flags, const void *data, ui
 
     hdr->off = (p - pkt->start) << 2;
 
-    // Data
-    memcpy(p, data, count);
+    if (count > conn->mss)
+    {
+        pkt->gsoSize = conn->mss;
+    }
+
+    // Data - summed as it is copied unless the device or segmentation completes the checksum
+    bool partial = pkt->gsoSize || conn->intf->caps & NET_INTF_TX_CSUM;
+    uint dataSum = 0;
+
+    if (partial)
+    {
+        memcpy(p, data, count);
+    }
+    else
+    {
+        dataSum = NetChecksumCopy(p, data, count, 0);
+    }
+
     pkt->end = p + count;
 
     // Pseudo Header
@@ -241,9 +268,22 @@ static void TcpSendPacket(TcpConn *conn, u32 seq, u8 flags, const void *data, ui
     phdr->protocol = IP_PROTOCOL_TCP;
     phdr->len = NetSwap16(pkt->end - pkt->start);
 
-    // Checksum
-    u16 checksum = NetChecksum(pkt->start - sizeof(ChecksumHeader), pkt->end);
-    hdr->checksum = NetSwap16(checksum);
+    // Checksum - offloaded devices and super-segments only need the pseudo header sum
+    if (partial)
+    {
+        uint sum = NetChecksumAcc(pkt->start - sizeof(ChecksumHeader), pkt->start, 0);
+        hdr->checksum = NetChecksumFold(sum);
+
+        pkt->csumFlags = NET_CSUM_PARTIAL;
+        pkt->csumStart = pkt->start;
+        pkt->csumOffset = (u8 *)&hdr->checksum - pkt->start;
+    }
+    else
+    {
+        // Options end on a 4 byte boundary, so the data sum lines up with the header sum
+        uint sum = NetChecksumAcc(pkt->start - sizeof(ChecksumHeader), p, dataSum);
+        hdr->checksum = NetChecksumFinal(sum);
+    }
 
     // Transmit
     TcpPrint(pkt);
@@ -261,11 +301,26 @@ static void TcpSendPacket(TcpConn *conn, u32 seq, u8 flags, const void *data, ui
 static TcpConn *TcpFind(const Ipv4Addr *srcAddr, u16 srcPort,
     const Ipv4Addr *dstAddr, u16 dstPort)
 {
+    // Prefer an established connection over a listening one
+    TcpConn *listener = 0;
+
     TcpConn *conn;
     ListForEach(conn, g_tcpActiveConns, link)
     {
-        if (srcPort == conn->remotePort &&
-            dstPort == conn->localPort &&
+        if (dstPort != conn->localPort)
+        {
+            continue;
+        }
+
+        if (conn->state == TCP_LISTEN)
+        {
+            if (Ipv4AddrEq(dstAddr, &conn->localAddr) ||
+                Ipv4AddrEq(&g_nullIpv4Addr, &conn->localAddr))
+            {
+                listener = conn;
+            }
+        }
+        else if (srcPort == conn->remotePort &&
             Ipv4AddrEq(srcAddr, &conn->remoteAddr) &&
             Ipv4AddrEq(dstAddr, &conn->localAddr))
         {
@@ -273,7 +328,7 @@ static TcpConn *TcpFind(const Ipv4Addr *srcAddr, u16 srcPort,
         }
     }
 
-    return 0;
+    return listener;
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -342,6 +397,67 @@ static void TcpRecvClosed(ChecksumHeader *phdr, TcpHeader *hdr)
     }
 }
 
+// ------------------------------------------------------------------------------------------------
+static void TcpRecvMss(TcpConn *conn, const TcpHeader *hdr)
+{
+    const u8 *p = (const u8 *)hdr + sizeof(TcpHeader);
+    const u8 *end = (const u8 *)hdr + (hdr->off >> 2);
+
+    TcpOptions opt;
+    conn->mss = TCP_DEFAULT_MSS;
+    if (TcpParseOptions(&opt, p, end) && opt.mss)
+    {
+        uint localMss = TcpLocalMss(conn);
+        conn->mss = opt.mss < localMss ? opt.mss : localMss;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void TcpRecvListen(TcpConn *conn, ChecksumHeader *phdr, TcpHeader *hdr)
+{
+    // Nothing can be acknowledged yet, and resets are ignored
+    if (hdr->flags & (TCP_RST | TCP_ACK))
+    {
+        TcpRecvClosed(phdr, hdr);
+        return;
+    }
+
+    if (~hdr->flags & TCP_SYN)
+    {
+        return;
+    }
+
+    const NetRoute *route = NetFindRoute(&phdr->src);
+    if (!route)
+    {
+        return;
+    }
+
+    // The listening connection becomes the new one; there is no accept queue
+    conn->intf = route->intf;
+    conn->localAddr = phdr->dst;
+    conn->nextAddr = *NetNextAddr(route, &phdr->src);
+    conn->remoteAddr = phdr->src;
+    conn->remotePort = hdr->srcPort;
+
+    conn->irs = hdr->seq;
+    conn->rcvNxt = hdr->seq + 1;
+    conn->rcvWnd = TCP_WINDOW_SIZE;
+    TcpRecvMss(conn, hdr);
+
+    u32 isn = s_baseIsn + g_pitTicks * 250;
+
+    conn->iss = isn;
+    conn->sndUna = isn;
+    conn->sndNxt = isn;
+    conn->sndWnd = hdr->windowSize;
+    conn->sndWl1 = hdr->seq;
+    conn->sndWl2 = 0;
+
+    TcpSetState(conn, TCP_SYN_RECEIVED);
+    TcpSendPacket(conn, conn->sndNxt, TCP_SYN | TCP_ACK, 0, 0);
+}
+
 // ------------------------------------------------------------------------------------------------
 static void TcpRecvSynSent(TcpConn *conn, TcpHeader *hdr)
 {
@@ -379,6 +495,7 @@ static void TcpRecvSynSent(TcpConn *conn, TcpHeader *hdr)
 
         conn->irs = hdr->seq;
         conn->rcvNxt = hdr->seq + 1;
+        TcpRecvMss(conn, hdr);
 
         if (flags & TCP_ACK)
         {
@@ -544,7 +661,7 @@ static void TcpRecvInsert(TcpConn *conn, NetBuf *pkt)
     NetBuf *cur;
     NetBuf *next;
 
-    uint dataLen = pkt->end - pkt->start;
+    uint dataLen = NetBufLen(pkt);
     uint pktEnd = pkt->seq + dataLen;
 
     // Find location to insert packet
@@ -560,7 +677,7 @@ static void TcpRecvInsert(TcpConn *conn, NetBuf *pkt)
     if (cur->link.prev != &conn->resequence)
     {
         prev = LinkData(cur->link.prev, NetBuf, link);
-        uint prev_end = prev->seq + prev->end - prev->start;
+        uint prev_end = prev->seq + NetBufLen(prev);
 
         if (SEQ_GE(prev_end, pktEnd))
         {
@@ -571,7 +688,7 @@ static void TcpRecvInsert(TcpConn *conn, NetBuf *pkt)
         else if (SEQ_GT(prev_end, pkt->seq))
         {
             // Trim previous packet by overlap with this packet
-            prev->end -= prev_end - pkt->seq;
+            NetBufTrim(prev, pkt->seq - prev->seq);
         }
     }
 
@@ -591,7 +708,7 @@ static void TcpRecvInsert(TcpConn *conn, NetBuf *pkt)
     while (&cur->link != &conn->resequence)
     {
         uint pktEnd = pkt->seq + dataLen;
-        uint curEnd = cur->seq + cur->end - cur->start;
+        uint curEnd = cur->seq + NetBufLen(cur);
 
         if (SEQ_LT(pktEnd, cur->seq))
         {
@@ -602,7 +719,7 @@ static void TcpRecvInsert(TcpConn *conn, NetBuf *pkt)
         if (SEQ_LT(pktEnd, curEnd))
         {
             // Partial overlap - trim
-            pkt->end -= pktEnd - cur->seq;
+            NetBufTrim(pkt, cur->seq - pkt->seq);
             break;
         }
 
@@ -629,12 +746,19 @@ static void TcpRecvProcess(TcpConn *conn)
             break;
         }
 
-        uint dataLen = pkt->end - pkt->start;
-        conn->rcvNxt += dataLen;
+        conn->rcvNxt += NetBufLen(pkt);
 
-        if (conn->onData)
+        LatencyStamp(pkt, LAT_RX_DELIVER);
+        LatencyRecord(pkt, LAT_RX_DRIVER, LAT_RX_DELIVER);
+
+        // Segments merged by GRO arrive as a chain, each fragment is delivered in place
+        for (NetBuf *frag = pkt; frag && conn->onData; frag = frag->next)
         {
-            conn->onData(conn, pkt->start, dataLen);
+            uint dataLen = frag->end - frag->start;
+            if (dataLen)
+            {
+                conn->onData(conn, frag->start, dataLen);
+            }
         }
 
         LinkRemove(&pkt->link);
@@ -726,7 +850,7 @@ static void TcpRecvGeneral(TcpConn *conn, TcpHeader *hdr, NetBuf *pkt)
     // Process segments not in the CLOSED, LISTEN, or SYN-SENT states.
 
     uint flags = hdr->flags;
-    uint dataLen = pkt->end - pkt->start;
+    uint dataLen = NetBufLen(pkt);
 
     // Check that sequence and segment data is acceptable
     if (!(SEQ_LE(conn->rcvNxt, hdr->seq) && SEQ_LE(hdr->seq + dataLen, conn->rcvNxt + conn->rcvWnd)))
@@ -781,9 +905,12 @@ static void TcpRecvGeneral(TcpConn *conn, TcpHeader *hdr, NetBuf *pkt)
 // ------------------------------------------------------------------------------------------------
 void TcpRecv(NetIntf *intf, const Ipv4Header *ipHdr, NetBuf *pkt)
 {
+    LatencyStamp(pkt, LAT_RX_L4);
+
     // Validate packet header
     if (pkt->start + sizeof(TcpHeader) > pkt->end)
     {
+        NetIntfDrop(intf, NET_DROP_HEADER);
         return;
     }
 
@@ -797,13 +924,15 @@ void TcpRecv(NetIntf *intf, const Ipv4Header *ipHdr, NetBuf *pkt)
     phdr->dst = dstAddr;
     phdr->reserved = 0;
     phdr->protocol = protocol;
-    phdr->len = NetSwap16(pkt->end - pkt->start);
+    phdr->len = NetSwap16(NetBufLen(pkt));
 
     TcpPrint(pkt);
 
     // Validate checksum
-    if (NetChecksum(pkt->start - sizeof(ChecksumHeader), pkt->end))
+    if (~pkt->csumFlags & NET_CSUM_L4_VALID &&
+        NetChecksumFinal(NetChecksumAccBuf(pkt, pkt->start - sizeof(ChecksumHeader), 0)))
     {
+        NetIntfDrop(intf, NET_DROP_CHECKSUM);
         return;
     }
 
@@ -816,6 +945,7 @@ void TcpRecv(NetIntf *intf, const Ipv4Header *ipHdr, NetBuf *pkt)
     TcpConn *conn = TcpFind(&phdr->src, hdr->srcPort, &phdr->dst, hdr->dstPort);
     if (!conn || conn->state == TCP_CLOSED)
     {
+        NetIntfDrop(intf, NET_DROP_NO_PORT);
         TcpRecvClosed(phdr, hdr);
         return;
     }
@@ -823,6 +953,7 @@ void TcpRecv(NetIntf *intf, const Ipv4Header *ipHdr, NetBuf *pkt)
     // Process packet by state
     if (conn->state == TCP_LISTEN)
     {
+        TcpRecvListen(conn, phdr, hdr);
     }
     else if (conn->state == TCP_SYN_SENT)
     {
@@ -872,12 +1003,28 @@ TcpConn *TcpCreate()
 {
     TcpConn *conn = TcpAlloc();
     memset(conn, 0, sizeof(TcpConn));
+    LinkInit(&conn->link);              // TcpClose works before connecting or listening
     conn->resequence.next = &conn->resequence;
     conn->resequence.prev = &conn->resequence;
 
     return conn;
 }
 
+// ------------------------------------------------------------------------------------------------
+static bool TcpPortInUse(u16 port)
+{
+    TcpConn *conn;
+    ListForEach(conn, g_tcpActiveConns, link)
+    {
+        if (conn->localPort == port)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 // ------------------------------------------------------------------------------------------------
 bool TcpConnect(TcpConn *conn, const Ipv4Addr *addr, u16 port)
 {
@@ -890,12 +1037,19 @@ bool TcpConnect(TcpConn *conn, const Ipv4Addr *addr, u16 port)
 
     NetIntf *intf = route->intf;
 
+    // Ports stay allocated until the connection is freed, after TIME-WAIT
+    u16 localPort = NetEphemeralPort(PORT_SPACE_TCP, &intf->ipAddr, addr, port, TcpPortInUse);
+    if (!localPort)
+    {
+        return false;
+    }
+
     // Initialize connection
     conn->intf = intf;
     conn->localAddr = intf->ipAddr;
     conn->nextAddr = *NetNextAddr(route, addr);
     conn->remoteAddr = *addr;
-    conn->localPort = NetEphemeralPort();
+    conn->localPort = localPort;
     conn->remotePort = port;
 
     u32 isn = s_baseIsn + g_pitTicks * 250;
@@ -907,6 +1061,7 @@ bool TcpConnect(TcpConn *conn, const Ipv4Addr *addr, u16 port)
     conn->sndWl1 = 0;
     conn->sndWl2 = 0;
     conn->iss = isn;
+    conn->mss = TCP_DEFAULT_MSS;
 
     conn->rcvNxt = 0;
     conn->rcvWnd = TCP_WINDOW_SIZE;
@@ -923,6 +1078,33 @@ bool TcpConnect(TcpConn *conn, const Ipv4Addr *addr, u16 port)
     return true;
 }
 
+// ------------------------------------------------------------------------------------------------
+bool TcpListen(TcpConn *conn, const Ipv4Addr *addr, u16 port)
+{
+    if (!addr)
+    {
+        addr = &g_nullIpv4Addr;
+    }
+
+    // One listener per port
+    TcpConn *other;
+    ListForEach(other, g_tcpActiveConns, link)
+    {
+        if (other->state == TCP_LISTEN && other->localPort == port)
+        {
+            return false;
+        }
+    }
+
+    conn->localAddr = *addr;
+    conn->localPort = port;
+
+    LinkBefore(&g_tcpActiveConns, &conn->link);
+    TcpSetState(conn, TCP_LISTEN);
+
+    return true;
+}
+
 // ------------------------------------------------------------------------------------------------
 void TcpClose(TcpConn *conn)
 {
@@ -976,5 +1158,21 @@ void TcpClose(TcpConn *conn)
 // ------------------------------------------------------------------------------------------------
 void TcpSend(TcpConn *conn, const void *data, uint count)
 {
-    TcpSendPacket(conn, conn->sndNxt, TCP_ACK, data, count);
+    // Segments are at most one MSS unless the interface takes super-segments
+    uint maxSeg = conn->mss;
+    if (conn->intf->caps & NET_INTF_GSO)
+    {
+        maxSeg = (TCP_GSO_MAX_SIZE / conn->mss) * conn->mss;
+    }
+
+    const u8 *p = data;
+    do
+    {
+        uint len = count < maxSeg ? count : maxSeg;
+        TcpSendPacket(conn, conn->sndNxt, TCP_ACK, p, len);
+
+        p += len;
+        count -= len;
+    }
+    while (count);
 }
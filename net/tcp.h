@@ -11,6 +11,8 @@
 
 #define TCP_WINDOW_SIZE     8192
 #define TCP_MSL             120000      // Maximum Segment Lifetime (ms)
+#define TCP_DEFAULT_MSS     536         // Send MSS when the peer does not give one
+#define TCP_GSO_MAX_SIZE    65495       // Largest super-segment payload, fits one IPv4 datagram
 
 // ------------------------------------------------------------------------------------------------
 // Sequence comparisons
@@ -103,6 +105,7 @@ typedef struct TcpConn
     u32 sndWl1;                         // segment sequence number used for last window update
     u32 sndWl2;                         // segment acknowledgment number used for last window update
     u32 iss;                            // initial send sequence number
+    u16 mss;                            // peer's maximum segment size
 
     // receive state
     u32 rcvNxt;                        // receive next
@@ -141,6 +144,12 @@ void TcpSwap(TcpHeader *hdr);
 
 TcpConn *TcpCreate();
 bool TcpConnect(TcpConn *conn, const Ipv4Addr *addr, u16 port);
+
+// The listening connection itself becomes the connection to the first peer; there is no
+// accept queue, so further SYNs to the port are refused until it listens again.  Fails if
+// the port already has a listener.
+bool TcpListen(TcpConn *conn, const Ipv4Addr *addr, u16 port);
+
 void TcpClose(TcpConn *conn);
 void TcpSend(TcpConn *conn, const void *data, uint count);
 
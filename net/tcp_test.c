@@ -3,6 +3,7 @@
 // ------------------------------------------------------------------------------------------------
 
 #include "test/test.h"
+#include "cpu/smp.h"
 #include "net/checksum.h"
 #include "net/ipv4.h"
 #include "net/loopback.h"
@@ -76,6 +77,16 @@ void *VMAlloc(uint size)
     return malloc(size);
 }
 
+void *VMAllocAlign(uint size, uint align)
+{
+    return malloc(size);
+}
+
+uint SmpCpuIndex()
+{
+    return 0;
+}
+
 // ------------------------------------------------------------------------------------------------
 static uint outError;
 
@@ -112,8 +123,7 @@ static void TcpInput(NetBuf *pkt)
     phdr->len = NetSwap16(pkt->end - pkt->start);
 
     // Checksum
-    u16 checksum = NetChecksum(pkt->start - sizeof(ChecksumHeader), pkt->end);
-    tcpHdr->checksum = NetSwap16(checksum);
+    tcpHdr->checksum = NetChecksum(pkt->start - sizeof(ChecksumHeader), pkt->end);
 
     // IP Header
     Ipv4Header *ipHdr = (Ipv4Header *)(pkt->start - sizeof(Ipv4Header));
@@ -195,7 +205,7 @@ static void TestCaseEnd()
 {
     ASSERT_TRUE(ListIsEmpty(&s_outPackets));
     ASSERT_TRUE(ListIsEmpty(&g_tcpActiveConns));
-    ASSERT_EQ_INT(g_netBufAllocCount, 0);
+    ASSERT_EQ_INT(NetBufInUse(), 0);
     ASSERT_EQ_UINT(outError, 0);
 }
 
@@ -559,6 +569,62 @@ int main(int argc, const char **argv)
 
     TestCaseEnd();
 
+    // --------------------------------------------------------------------------------------------
+    TestCaseBegin(TCP_LISTEN, "ACK", "RST sent");
+
+    conn = CreateConn();
+    ASSERT_TRUE(TcpListen(conn, 0, 80));
+
+    inPkt = NetAllocBuf();
+    inHdr = PrepareInPkt(conn, inPkt, 1000, 2000, TCP_ACK);
+    inHdr->srcPort = 100;
+    TcpInput(inPkt);
+
+    outPkt = PopPacket();
+    outHdr = (TcpHeader *)outPkt->data;
+    TcpSwap(outHdr);
+    ASSERT_EQ_UINT(outHdr->srcPort, 80);
+    ASSERT_EQ_UINT(outHdr->dstPort, 100);
+    ASSERT_EQ_UINT(outHdr->seq, 2000);
+    ASSERT_EQ_HEX8(outHdr->flags, TCP_RST);
+    free(outPkt);
+
+    ASSERT_EQ_UINT(conn->state, TCP_LISTEN);
+    TcpClose(conn);
+
+    TestCaseEnd();
+
+    // --------------------------------------------------------------------------------------------
+    TestCaseBegin(TCP_LISTEN, "SYN", "goto SYN_RECEIVED");
+
+    conn = CreateConn();
+    ASSERT_TRUE(TcpListen(conn, 0, 80));
+
+    TcpConn *other = CreateConn();
+    ASSERT_TRUE(!TcpListen(other, 0, 80));
+    TcpClose(other);
+
+    inPkt = NetAllocBuf();
+    inHdr = PrepareInPkt(conn, inPkt, 1000, 0, TCP_SYN);
+    inHdr->srcPort = 100;
+    TcpInput(inPkt);
+
+    outPkt = PopPacket();
+    outHdr = (TcpHeader *)outPkt->data;
+    TcpSwap(outHdr);
+    ASSERT_EQ_UINT(outHdr->srcPort, 80);
+    ASSERT_EQ_UINT(outHdr->dstPort, 100);
+    ASSERT_EQ_UINT(outHdr->seq, conn->iss);
+    ASSERT_EQ_UINT(outHdr->ack, 1001);
+    ASSERT_EQ_HEX8(outHdr->flags, TCP_SYN | TCP_ACK);
+    free(outPkt);
+
+    ASSERT_EQ_UINT(conn->remotePort, 100);
+    ASSERT_EQ_UINT(conn->rcvWnd, TCP_WINDOW_SIZE);
+    ExitState(conn, TCP_SYN_RECEIVED);
+
+    TestCaseEnd();
+
     // --------------------------------------------------------------------------------------------
     TestCaseBegin(TCP_SYN_SENT, "Bad ACK, no RST", "RST sent");
 
@@ -3,81 +3,257 @@
 // ------------------------------------------------------------------------------------------------
 
 #include "net/udp.h"
-#include "net/dhcp.h"
-#include "net/dns.h"
+#include "net/buf.h"
+#include "net/checksum.h"
 #include "net/ipv4.h"
+#include "net/latency.h"
 #include "net/net.h"
-#include "net/ntp.h"
 #include "net/port.h"
+#include "net/route.h"
 #include "net/swap.h"
 #include "console/console.h"
+#include "mem/vm.h"
+#include "stdlib/string.h"
+
+// ------------------------------------------------------------------------------------------------
+// Static Variables
+
+static Link s_udpSockets[UDP_HASH_SIZE];
+static Link s_freeSockets = { &s_freeSockets, &s_freeSockets };
+static bool s_udpInit;
+
+// ------------------------------------------------------------------------------------------------
+static Link *UdpBucket(u16 port)
+{
+    if (!s_udpInit)
+    {
+        for (uint i = 0; i < UDP_HASH_SIZE; ++i)
+        {
+            LinkInit(&s_udpSockets[i]);
+        }
+
+        s_udpInit = true;
+    }
+
+    return &s_udpSockets[(port ^ (port >> 6)) & (UDP_HASH_SIZE - 1)];
+}
+
+// ------------------------------------------------------------------------------------------------
+static UdpSocket *UdpFind(const Ipv4Addr *addr, u16 port)
+{
+    // Prefer a socket bound to the exact address over a wildcard socket
+    UdpSocket *wildcard = 0;
+
+    UdpSocket *sock;
+    Link *bucket = UdpBucket(port);
+    ListForEach(sock, *bucket, link)
+    {
+        if (sock->localPort == port)
+        {
+            if (Ipv4AddrEq(&sock->localAddr, addr))
+            {
+                return sock;
+            }
+            else if (Ipv4AddrEq(&sock->localAddr, &g_nullIpv4Addr))
+            {
+                wildcard = sock;
+            }
+        }
+    }
+
+    return wildcard;
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool UdpPortInUse(u16 port)
+{
+    // Bound to any address
+    UdpSocket *sock;
+    Link *bucket = UdpBucket(port);
+    ListForEach(sock, *bucket, link)
+    {
+        if (sock->localPort == port)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void UdpSendRoute(NetIntf *intf, const Ipv4Addr *nextAddr, const Ipv4Addr *dstAddr,
+    uint dstPort, uint srcPort, NetBuf *pkt)
+{
+    LatencyStamp(pkt, LAT_TX_SEND);
+
+    // UDP Header
+    pkt->start -= sizeof(UdpHeader);
+
+    UdpHeader *hdr = (UdpHeader *)pkt->start;
+    hdr->srcPort = NetSwap16(srcPort);
+    hdr->dstPort = NetSwap16(dstPort);
+    hdr->len = NetSwap16(NetBufLen(pkt));
+    hdr->checksum = 0;
+
+    // Pseudo Header
+    ChecksumHeader *phdr = (ChecksumHeader *)(pkt->start - sizeof(ChecksumHeader));
+    phdr->src = intf->ipAddr;
+    phdr->dst = *dstAddr;
+    phdr->reserved = 0;
+    phdr->protocol = IP_PROTOCOL_UDP;
+    phdr->len = hdr->len;
+
+    // Checksum - offloaded devices only need the pseudo header sum
+    if (intf->caps & NET_INTF_TX_CSUM)
+    {
+        uint sum = NetChecksumAcc(pkt->start - sizeof(ChecksumHeader), pkt->start, 0);
+        hdr->checksum = NetChecksumFold(sum);
+
+        pkt->csumFlags = NET_CSUM_PARTIAL;
+        pkt->csumStart = pkt->start;
+        pkt->csumOffset = (u8 *)&hdr->checksum - pkt->start;
+    }
+    else
+    {
+        // A computed value of zero is transmitted as all ones
+        uint sum = NetChecksumAccBuf(pkt, pkt->start - sizeof(ChecksumHeader), 0);
+        u16 checksum = NetChecksumFinal(sum);
+        hdr->checksum = checksum ? checksum : 0xffff;
+    }
+
+    UdpPrint(pkt);
+
+    Ipv4SendIntf(intf, nextAddr, dstAddr, IP_PROTOCOL_UDP, pkt);
+}
+
+// ------------------------------------------------------------------------------------------------
+static NetBuf *UdpDequeue(UdpSocket *sock, Ipv4Addr *srcAddr, u16 *srcPort)
+{
+    if (ListIsEmpty(&sock->recvQueue))
+    {
+        return 0;
+    }
+
+    NetBuf *pkt = LinkData(sock->recvQueue.next, NetBuf, link);
+    LinkRemove(&pkt->link);
+    --sock->recvCount;
+
+    // Source information is still in the headers preceding the payload
+    const UdpHeader *hdr = (const UdpHeader *)(pkt->start - sizeof(UdpHeader));
+    const ChecksumHeader *phdr = (const ChecksumHeader *)((u8 *)hdr - sizeof(ChecksumHeader));
+
+    if (srcAddr)
+    {
+        *srcAddr = phdr->src;
+    }
+
+    if (srcPort)
+    {
+        *srcPort = NetSwap16(hdr->srcPort);
+    }
+
+    return pkt;
+}
 
 // ------------------------------------------------------------------------------------------------
 void UdpRecv(NetIntf *intf, const Ipv4Header *ipHdr, NetBuf *pkt)
 {
+    LatencyStamp(pkt, LAT_RX_L4);
     UdpPrint(pkt);
 
     // Validate packet header
     if (pkt->start + sizeof(UdpHeader) > pkt->end)
     {
+        NetIntfDrop(intf, NET_DROP_HEADER);
         return;
     }
 
     const UdpHeader *hdr = (const UdpHeader *)pkt->start;
 
     u16 srcPort = NetSwap16(hdr->srcPort);
-    //u16 dstPort = NetSwap16(hdr->dstPort);
+    u16 dstPort = NetSwap16(hdr->dstPort);
+    u16 len = NetSwap16(hdr->len);
 
-    pkt->start += sizeof(UdpHeader);
+    if (len < sizeof(UdpHeader) || pkt->start + len > pkt->end)
+    {
+        NetIntfDrop(intf, NET_DROP_HEADER);
+        return;
+    }
+
+    pkt->end = pkt->start + len;
+
+    // Assemble Pseudo Header - this overwrites the end of the IPv4 header.
+    Ipv4Addr srcAddr = ipHdr->src;
+    Ipv4Addr dstAddr = ipHdr->dst;
 
-    switch (srcPort)
+    ChecksumHeader *phdr = (ChecksumHeader *)(pkt->start - sizeof(ChecksumHeader));
+    phdr->src = srcAddr;
+    phdr->dst = dstAddr;
+    phdr->reserved = 0;
+    phdr->protocol = IP_PROTOCOL_UDP;
+    phdr->len = hdr->len;
+
+    // Validate checksum if the sender computed one
+    if (hdr->checksum && ~pkt->csumFlags & NET_CSUM_L4_VALID &&
+        NetChecksum(pkt->start - sizeof(ChecksumHeader), pkt->end))
+    {
+        NetIntfDrop(intf, NET_DROP_CHECKSUM);
+        return;
+    }
+
+    // Find socket bound to the destination port
+    UdpSocket *sock = UdpFind(&dstAddr, dstPort);
+    if (!sock)
     {
-    case PORT_DNS:
-        DnsRecv(intf, pkt);
-        break;
+        NetIntfDrop(intf, NET_DROP_NO_PORT);
+        return;
+    }
+
+    pkt->start += sizeof(UdpHeader);
 
-    case PORT_BOOTP_SERVER:
-        DhcpRecv(intf, pkt);
-        break;
+    LatencyStamp(pkt, LAT_RX_DELIVER);
+    LatencyRecord(pkt, LAT_RX_DRIVER, LAT_RX_DELIVER);
 
-    case PORT_NTP:
-        NtpRecv(intf, pkt);
-        break;
+    if (sock->onRecv)
+    {
+        sock->onRecv(sock, intf, &srcAddr, srcPort, pkt);
+    }
+    else if (sock->recvCount < sock->recvMax)
+    {
+        // Increase ref count on packet and queue it for the user
+        ++pkt->refCount;
+        LinkBefore(&sock->recvQueue, &pkt->link);
+        ++sock->recvCount;
+    }
+    else
+    {
+        ++sock->recvDrops;
+        NetIntfDrop(intf, NET_DROP_SOCKET_FULL);
     }
 }
 
 // ------------------------------------------------------------------------------------------------
 void UdpSend(const Ipv4Addr *dstAddr, uint dstPort, uint srcPort, NetBuf *pkt)
 {
-    // UDP Header
-    pkt->start -= sizeof(UdpHeader);
+    const NetRoute *route = NetFindRoute(dstAddr);
 
-    UdpHeader *hdr = (UdpHeader *)pkt->start;
-    hdr->srcPort = NetSwap16(srcPort);
-    hdr->dstPort = NetSwap16(dstPort);
-    hdr->len = NetSwap16(pkt->end - pkt->start);
-    hdr->checksum = 0;  // don't compute checksum yet
+    if (!route)
+    {
+        NetIntfDrop(0, NET_DROP_NO_ROUTE);
+        NetReleaseBuf(pkt);
+        return;
+    }
 
-    UdpPrint(pkt);
+    const Ipv4Addr *nextAddr = NetNextAddr(route, dstAddr);
 
-    Ipv4Send(dstAddr, IP_PROTOCOL_UDP, pkt);
+    UdpSendRoute(route->intf, nextAddr, dstAddr, dstPort, srcPort, pkt);
 }
 
 // ------------------------------------------------------------------------------------------------
 void UdpSendIntf(NetIntf *intf, const Ipv4Addr *dstAddr, uint dstPort, uint srcPort, NetBuf *pkt)
 {
-    // UDP Header
-    pkt->start -= sizeof(UdpHeader);
-
-    UdpHeader *hdr = (UdpHeader *)pkt->start;
-    hdr->srcPort = NetSwap16(srcPort);
-    hdr->dstPort = NetSwap16(dstPort);
-    hdr->len = NetSwap16(pkt->end - pkt->start);
-    hdr->checksum = 0;  // don't compute checksum yet
-
-    UdpPrint(pkt);
-
-    Ipv4SendIntf(intf, dstAddr, dstAddr, IP_PROTOCOL_UDP, pkt);
+    UdpSendRoute(intf, dstAddr, dstAddr, dstPort, srcPort, pkt);
 }
 
 // ------------------------------------------------------------------------------------------------
@@ -103,3 +279,206 @@ void UdpPrint(const NetBuf *pkt)
     ConsolePrint("  UDP: src=%d dst=%d len=%d checksum=%d\n",
         srcPort, dstPort, len, checksum);
 }
+
+// ------------------------------------------------------------------------------------------------
+UdpSocket *UdpCreate()
+{
+    UdpSocket *sock;
+
+    Link *p = s_freeSockets.next;
+    if (p != &s_freeSockets)
+    {
+        LinkRemove(p);
+        sock = LinkData(p, UdpSocket, link);
+    }
+    else
+    {
+        sock = VMAlloc(sizeof(UdpSocket));
+    }
+
+    memset(sock, 0, sizeof(UdpSocket));
+    LinkInit(&sock->link);
+    LinkInit(&sock->recvQueue);
+    sock->recvMax = UDP_RECV_QUEUE_SIZE;
+
+    return sock;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool UdpBind(UdpSocket *sock, const Ipv4Addr *addr, u16 port)
+{
+    if (sock->localPort)
+    {
+        return false;
+    }
+
+    if (!addr)
+    {
+        addr = &g_nullIpv4Addr;
+    }
+
+    if (!port)
+    {
+        // Pick an ephemeral port that is not already bound
+        port = NetEphemeralPort(PORT_SPACE_UDP, addr, 0, 0, UdpPortInUse);
+        if (!port)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        // Fail on any overlapping binding.  UdpFind returns the same address or a wildcard,
+        // and a wildcard overlaps every address bound to the port.
+        bool overlap = Ipv4AddrEq(addr, &g_nullIpv4Addr) ?
+            UdpPortInUse(port) : UdpFind(addr, port) != 0;
+        if (overlap)
+        {
+            return false;
+        }
+    }
+
+    sock->localAddr = *addr;
+    sock->localPort = port;
+    LinkBefore(UdpBucket(port), &sock->link);
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void UdpClose(UdpSocket *sock)
+{
+    NetBuf *pkt;
+    while ((pkt = UdpDequeue(sock, 0, 0)))
+    {
+        NetReleaseBuf(pkt);
+    }
+
+    if (sock->localPort)
+    {
+        LinkRemove(&sock->link);
+        NetReleasePort(PORT_SPACE_UDP, sock->localPort);
+        sock->localPort = 0;
+    }
+
+    LinkBefore(&s_freeSockets, &sock->link);
+}
+
+// ------------------------------------------------------------------------------------------------
+bool UdpSendTo(UdpSocket *sock, const Ipv4Addr *dstAddr, u16 dstPort, const void *data, uint len)
+{
+    UdpMsg msg;
+    msg.addr = *dstAddr;
+    msg.port = dstPort;
+    msg.data = (void *)data;
+    msg.len = len;
+
+    return UdpSendBatch(sock, &msg, 1) == 1;
+}
+
+// ------------------------------------------------------------------------------------------------
+int UdpRecvFrom(UdpSocket *sock, void *data, uint len, Ipv4Addr *srcAddr, u16 *srcPort)
+{
+    UdpMsg msg;
+    msg.data = data;
+    msg.len = len;
+
+    if (!UdpRecvBatch(sock, &msg, 1))
+    {
+        return -1;
+    }
+
+    if (srcAddr)
+    {
+        *srcAddr = msg.addr;
+    }
+
+    if (srcPort)
+    {
+        *srcPort = msg.port;
+    }
+
+    return msg.len;
+}
+
+// ------------------------------------------------------------------------------------------------
+uint UdpSendBatch(UdpSocket *sock, const UdpMsg *msgs, uint count)
+{
+    // Bind to an ephemeral port on first use
+    if (!sock->localPort && !UdpBind(sock, 0, 0))
+    {
+        return 0;
+    }
+
+    // Route lookups are shared by consecutive messages to the same destination
+    const NetRoute *route = 0;
+    Ipv4Addr routeAddr = g_nullIpv4Addr;
+
+    uint sent = 0;
+    for (; sent < count; ++sent)
+    {
+        const UdpMsg *msg = &msgs[sent];
+
+        if (!route || !Ipv4AddrEq(&routeAddr, &msg->addr))
+        {
+            route = NetFindRoute(&msg->addr);
+            routeAddr = msg->addr;
+
+            if (!route)
+            {
+                break;
+            }
+        }
+
+        // Datagrams are never fragmented, so the route's MTU bounds the payload
+        if (msg->len > route->intf->mtu - sizeof(Ipv4Header) - sizeof(UdpHeader))
+        {
+            break;
+        }
+
+        // Headers go in the buffer's headroom; jumbo payloads take a larger class
+        NetBuf *pkt = NetAllocBufSize(msg->len);
+        if (!pkt)
+        {
+            break;
+        }
+
+        memcpy(pkt->start, msg->data, msg->len);
+        pkt->end += msg->len;
+
+        UdpSendRoute(route->intf, NetNextAddr(route, &msg->addr), &msg->addr,
+            msg->port, sock->localPort, pkt);
+    }
+
+    return sent;
+}
+
+// ------------------------------------------------------------------------------------------------
+uint UdpRecvBatch(UdpSocket *sock, UdpMsg *msgs, uint count)
+{
+    uint recvd = 0;
+    for (; recvd < count; ++recvd)
+    {
+        UdpMsg *msg = &msgs[recvd];
+
+        NetBuf *pkt = UdpDequeue(sock, &msg->addr, &msg->port);
+        if (!pkt)
+        {
+            break;
+        }
+
+        // Datagrams larger than the buffer are truncated
+        uint len = pkt->end - pkt->start;
+        if (len > msg->len)
+        {
+            len = msg->len;
+        }
+
+        memcpy(msg->data, pkt->start, len);
+        msg->len = len;
+
+        NetReleaseBuf(pkt);
+    }
+
+    return recvd;
+}
@@ -6,6 +6,12 @@
 
 #include "net/ipv4.h"
 
+// ------------------------------------------------------------------------------------------------
+// Configuration
+
+#define UDP_HASH_SIZE           64          // Socket table buckets (power of 2)
+#define UDP_RECV_QUEUE_SIZE     32          // Default datagrams queued per socket
+
 // ------------------------------------------------------------------------------------------------
 // UDP Header
 
@@ -18,7 +24,39 @@ typedef struct UdpHeader
 } PACKED UdpHeader;
 
 // ------------------------------------------------------------------------------------------------
-// Functions
+// UDP Socket
+
+typedef struct UdpSocket
+{
+    Link link;
+    Ipv4Addr localAddr;                 // null address accepts datagrams for any interface
+    u16 localPort;
+
+    // receive queue, used when there is no onRecv callback
+    Link recvQueue;
+    uint recvCount;
+    uint recvMax;
+    uint recvDrops;
+
+    // callbacks
+    void *ctx;
+    void (*onRecv)(struct UdpSocket *sock, NetIntf *intf,
+        const Ipv4Addr *srcAddr, u16 srcPort, const NetBuf *pkt);
+} UdpSocket;
+
+// ------------------------------------------------------------------------------------------------
+// UDP Message for batched calls
+
+typedef struct UdpMsg
+{
+    Ipv4Addr addr;
+    u16 port;
+    void *data;
+    uint len;
+} UdpMsg;
+
+// ------------------------------------------------------------------------------------------------
+// Internal Functions
 
 void UdpRecv(NetIntf *intf, const Ipv4Header *ipHdr, NetBuf *pkt);
 void UdpSend(const Ipv4Addr *dstAddr, uint dstPort, uint srcPort, NetBuf *pkt);
@@ -26,3 +64,16 @@ void UdpSendIntf(NetIntf *intf, const Ipv4Addr *dstAddr,
     uint dstPort, uint srcPort, NetBuf *pkt);
 
 void UdpPrint(const NetBuf *pkt);
+
+// ------------------------------------------------------------------------------------------------
+// User API
+
+UdpSocket *UdpCreate();
+bool UdpBind(UdpSocket *sock, const Ipv4Addr *addr, u16 port);
+void UdpClose(UdpSocket *sock);
+
+bool UdpSendTo(UdpSocket *sock, const Ipv4Addr *dstAddr, u16 dstPort, const void *data, uint len);
+int UdpRecvFrom(UdpSocket *sock, void *data, uint len, Ipv4Addr *srcAddr, u16 *srcPort);
+
+uint UdpSendBatch(UdpSocket *sock, const UdpMsg *msgs, uint count);
+uint UdpRecvBatch(UdpSocket *sock, UdpMsg *msgs, uint count);
@@ -0,0 +1,757 @@
+// ------------------------------------------------------------------------------------------------
+// net/virtio.c
+// ------------------------------------------------------------------------------------------------
+
+#include "net/virtio.h"
+#include "net/buf.h"
+#include "net/capture.h"
+#include "net/eth.h"
+#include "net/gro.h"
+#include "net/ipv4.h"
+#include "net/latency.h"
+#include "net/tcp.h"
+#include "net/xdp.h"
+#include "console/console.h"
+#include "cpu/io.h"
+#include "mem/vm.h"
+#include "pci/driver.h"
+#include "stdlib/string.h"
+
+#define QUEUE_SIZE_MAX                  256         // Entries per virtqueue (power of 2)
+#define RX_POLL_BUDGET                  64          // Packets processed per poll
+#define TX_BATCH_SIZE                   32          // Packets posted before forcing a notification
+
+// ------------------------------------------------------------------------------------------------
+// Virtio PCI Capability
+
+#define VIRTIO_PCI_CAP_COMMON_CFG       1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG       2
+#define VIRTIO_PCI_CAP_ISR_CFG          3
+#define VIRTIO_PCI_CAP_DEVICE_CFG       4
+
+#define VIRTIO_CAP_CFG_TYPE             0x03
+#define VIRTIO_CAP_BAR                  0x04
+#define VIRTIO_CAP_OFFSET               0x08
+#define VIRTIO_CAP_NOTIFY_MULTIPLIER    0x10
+
+#define PCI_CAP_VENDOR                  0x09
+
+// ------------------------------------------------------------------------------------------------
+// Common Configuration
+
+typedef struct VirtioCommonCfg
+{
+    volatile u32 deviceFeatureSelect;
+    volatile u32 deviceFeature;
+    volatile u32 driverFeatureSelect;
+    volatile u32 driverFeature;
+    volatile u16 msixConfig;
+    volatile u16 numQueues;
+    volatile u8 deviceStatus;
+    volatile u8 configGeneration;
+    volatile u16 queueSelect;
+    volatile u16 queueSize;
+    volatile u16 queueMsixVector;
+    volatile u16 queueEnable;
+    volatile u16 queueNotifyOff;
+    volatile u64 queueDesc;
+    volatile u64 queueDriver;
+    volatile u64 queueDevice;
+} PACKED VirtioCommonCfg;
+
+// ------------------------------------------------------------------------------------------------
+// Device Status
+
+#define STATUS_ACKNOWLEDGE              0x01
+#define STATUS_DRIVER                   0x02
+#define STATUS_DRIVER_OK                0x04
+#define STATUS_FEATURES_OK              0x08
+#define STATUS_FAILED                   0x80
+
+// ------------------------------------------------------------------------------------------------
+// Feature Bits
+
+#define VIRTIO_NET_F_CSUM               0           // Device handles packets with partial checksum
+#define VIRTIO_NET_F_GUEST_CSUM         1           // Driver handles packets with partial checksum
+#define VIRTIO_NET_F_MAC                5           // Device has given MAC address
+#define VIRTIO_NET_F_GUEST_TSO4         7           // Driver can receive TSOv4
+#define VIRTIO_NET_F_HOST_TSO4          11          // Device can receive TSOv4
+#define VIRTIO_NET_F_MRG_RXBUF          15          // Driver can merge receive buffers
+#define VIRTIO_NET_F_STATUS             16          // Configuration status field is available
+#define VIRTIO_RING_F_EVENT_IDX         29          // used_event and avail_event fields
+#define VIRTIO_F_VERSION_1              32          // Compliant with virtio 1.0
+
+#define FEATURE(bit)                    (1ull << (bit))
+
+// Features the driver accepts when offered
+#define DRIVER_FEATURES                 (FEATURE(VIRTIO_NET_F_CSUM) \
+                                        | FEATURE(VIRTIO_NET_F_GUEST_CSUM) \
+                                        | FEATURE(VIRTIO_NET_F_HOST_TSO4) \
+                                        | FEATURE(VIRTIO_NET_F_MAC) \
+                                        | FEATURE(VIRTIO_NET_F_MRG_RXBUF) \
+                                        | FEATURE(VIRTIO_NET_F_STATUS) \
+                                        | FEATURE(VIRTIO_RING_F_EVENT_IDX) \
+                                        | FEATURE(VIRTIO_F_VERSION_1))
+
+// ------------------------------------------------------------------------------------------------
+// Net Header
+
+typedef struct VirtioNetHeader
+{
+    u8 flags;
+    u8 gsoType;
+    u16 hdrLen;
+    u16 gsoSize;
+    u16 csumStart;
+    u16 csumOffset;
+    u16 numBuffers;
+} PACKED VirtioNetHeader;
+
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM     0x01
+#define VIRTIO_NET_HDR_F_DATA_VALID     0x02
+
+#define VIRTIO_NET_HDR_GSO_NONE         0
+#define VIRTIO_NET_HDR_GSO_TCPV4        1
+
+// ------------------------------------------------------------------------------------------------
+// Device Configuration
+
+typedef struct VirtioNetConfig
+{
+    volatile u8 mac[6];
+    volatile u16 status;
+} PACKED VirtioNetConfig;
+
+// ------------------------------------------------------------------------------------------------
+// Split Virtqueue
+
+typedef struct VirtqDesc
+{
+    volatile u64 addr;
+    volatile u32 len;
+    volatile u16 flags;
+    volatile u16 next;
+} PACKED VirtqDesc;
+
+#define VIRTQ_DESC_F_NEXT               1
+#define VIRTQ_DESC_F_WRITE              2
+
+typedef struct VirtqAvail
+{
+    volatile u16 flags;
+    volatile u16 idx;
+    volatile u16 ring[];                // followed by used_event
+} PACKED VirtqAvail;
+
+typedef struct VirtqUsedElem
+{
+    volatile u32 id;
+    volatile u32 len;
+} PACKED VirtqUsedElem;
+
+typedef struct VirtqUsed
+{
+    volatile u16 flags;
+    volatile u16 idx;
+    VirtqUsedElem ring[];               // followed by avail_event
+} PACKED VirtqUsed;
+
+#define VIRTQ_USED_F_NO_NOTIFY          1
+
+// ------------------------------------------------------------------------------------------------
+// Queue State
+
+#define QUEUE_RX                        0
+#define QUEUE_TX                        1
+
+typedef struct Virtqueue
+{
+    uint index;
+    uint size;
+    VirtqDesc *desc;
+    VirtqAvail *avail;
+    VirtqUsed *used;
+    volatile u16 *notifyAddr;
+
+    u16 availIdx;                       // next avail ring slot to fill
+    u16 notifiedIdx;                    // avail index at the last notification
+    u16 usedIdx;                        // next used ring entry to consume
+
+    // free descriptors
+    u16 freeIds[QUEUE_SIZE_MAX];
+    uint freeCount;
+
+    NetBuf *bufs[QUEUE_SIZE_MAX];
+} Virtqueue;
+
+// ------------------------------------------------------------------------------------------------
+// Device State
+
+typedef struct EthVirtioDevice
+{
+    char name[8];
+    VirtioCommonCfg *common;
+    VirtioNetConfig *config;
+    u8 *notifyBase;
+    u32 notifyMultiplier;
+    u64 features;
+
+    Virtqueue rxQueue;
+    Virtqueue txQueue;
+    uint rxBufSize;                     // data space of receive buffers
+    NetBuf *rxChain;                    // packet spanning several receive buffers
+    uint rxChainLeft;                   // buffers still to come for rxChain
+
+    uint rxPackets;
+    uint txPackets;
+} EthVirtioDevice;
+
+// ------------------------------------------------------------------------------------------------
+static void *VirtioCapAddr(uint id, uint cap)
+{
+    PciBar bar;
+    PciGetBar(&bar, id, PciRead8(id, cap + VIRTIO_CAP_BAR));
+    if (bar.flags & PCI_BAR_IO)
+    {
+        return 0;
+    }
+
+    return (u8 *)bar.u.address + PciRead32(id, cap + VIRTIO_CAP_OFFSET);
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool VirtioFindCaps(EthVirtioDevice *dev, uint id)
+{
+    if (~PciRead16(id, PCI_CONFIG_STATUS) & PCI_STATUS_CAP_LIST)
+    {
+        return false;
+    }
+
+    // Walk vendor specific capabilities for the structures we need
+    uint cap = PciRead8(id, PCI_CONFIG_CAPABILITIES) & ~0x3;
+    for (uint i = 0; cap && i < 48; ++i)
+    {
+        if (PciRead8(id, cap) == PCI_CAP_VENDOR)
+        {
+            switch (PciRead8(id, cap + VIRTIO_CAP_CFG_TYPE))
+            {
+            case VIRTIO_PCI_CAP_COMMON_CFG:
+                if (!dev->common)
+                {
+                    dev->common = VirtioCapAddr(id, cap);
+                }
+                break;
+
+            case VIRTIO_PCI_CAP_NOTIFY_CFG:
+                if (!dev->notifyBase)
+                {
+                    dev->notifyBase = VirtioCapAddr(id, cap);
+                    dev->notifyMultiplier = PciRead32(id, cap + VIRTIO_CAP_NOTIFY_MULTIPLIER);
+                }
+                break;
+
+            case VIRTIO_PCI_CAP_DEVICE_CFG:
+                if (!dev->config)
+                {
+                    dev->config = VirtioCapAddr(id, cap);
+                }
+                break;
+            }
+        }
+
+        cap = PciRead8(id, cap + 1) & ~0x3;
+    }
+
+    return dev->common && dev->notifyBase && dev->config;
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool VirtqInit(EthVirtioDevice *dev, Virtqueue *vq, uint index)
+{
+    VirtioCommonCfg *common = dev->common;
+
+    common->queueSelect = index;
+
+    uint size = common->queueSize;
+    if (!size)
+    {
+        return false;
+    }
+
+    if (size > QUEUE_SIZE_MAX)
+    {
+        size = QUEUE_SIZE_MAX;
+        common->queueSize = size;
+    }
+
+    // Descriptor table, then the driver and device areas each with their event field
+    uint descSize = size * sizeof(VirtqDesc);
+    uint availSize = sizeof(VirtqAvail) + size * sizeof(u16) + sizeof(u16);
+    uint usedSize = sizeof(VirtqUsed) + size * sizeof(VirtqUsedElem) + sizeof(u16);
+
+    vq->desc = VMAllocAlign(descSize, 16);
+    vq->avail = VMAllocAlign(availSize, 2);
+    vq->used = VMAllocAlign(usedSize, 4);
+
+    memset(vq->desc, 0, descSize);
+    memset(vq->avail, 0, availSize);
+    memset(vq->used, 0, usedSize);
+
+    vq->index = index;
+    vq->size = size;
+    vq->availIdx = 0;
+    vq->notifiedIdx = 0;
+    vq->usedIdx = 0;
+
+    vq->freeCount = size;
+    for (uint i = 0; i < size; ++i)
+    {
+        vq->freeIds[i] = size - 1 - i;
+        vq->bufs[i] = 0;
+    }
+
+    vq->notifyAddr = (volatile u16 *)(dev->notifyBase + common->queueNotifyOff * dev->notifyMultiplier);
+
+    // The queues are polled, so no interrupt vector is assigned
+    common->queueMsixVector = 0xffff;
+    common->queueDesc = (uintptr_t)vq->desc;
+    common->queueDriver = (uintptr_t)vq->avail;
+    common->queueDevice = (uintptr_t)vq->used;
+    common->queueEnable = 1;
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+static volatile u16 *VirtqUsedEvent(Virtqueue *vq)
+{
+    // Computed from the ring base, the areas are packed structures
+    u8 *base = (u8 *)vq->avail;
+    return (volatile u16 *)(base + sizeof(VirtqAvail) + vq->size * sizeof(u16));
+}
+
+// ------------------------------------------------------------------------------------------------
+static volatile u16 *VirtqAvailEvent(Virtqueue *vq)
+{
+    u8 *base = (u8 *)vq->used;
+    return (volatile u16 *)(base + sizeof(VirtqUsed) + vq->size * sizeof(VirtqUsedElem));
+}
+
+// ------------------------------------------------------------------------------------------------
+static void VirtqPost(Virtqueue *vq, NetBuf *buf, u8 *addr, uint len, uint flags)
+{
+    u16 id = vq->freeIds[--vq->freeCount];
+
+    VirtqDesc *desc = &vq->desc[id];
+    desc->addr = (uintptr_t)addr;
+    desc->len = len;
+    desc->flags = flags;
+    desc->next = 0;
+    vq->bufs[id] = buf;
+
+    vq->avail->ring[vq->availIdx & (vq->size - 1)] = id;
+    ++vq->availIdx;
+}
+
+// ------------------------------------------------------------------------------------------------
+static NetBuf *VirtqTakeUsed(Virtqueue *vq, uint *len)
+{
+    if (vq->usedIdx == vq->used->idx)
+    {
+        return 0;
+    }
+
+    VirtqUsedElem *elem = &vq->used->ring[vq->usedIdx & (vq->size - 1)];
+    u16 id = elem->id;
+    *len = elem->len;
+    ++vq->usedIdx;
+
+    NetBuf *buf = vq->bufs[id];
+    vq->bufs[id] = 0;
+    vq->freeIds[vq->freeCount++] = id;
+
+    return buf;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void VirtqKick(EthVirtioDevice *dev, Virtqueue *vq)
+{
+    u16 newIdx = vq->availIdx;
+    u16 oldIdx = vq->notifiedIdx;
+    if (newIdx == oldIdx)
+    {
+        return;
+    }
+
+    // Frames leave with this kick
+    if (vq->index == QUEUE_TX)
+    {
+        for (u16 idx = oldIdx; idx != newIdx; ++idx)
+        {
+            NetBuf *buf = vq->bufs[vq->avail->ring[idx & (vq->size - 1)]];
+
+            LatencyStamp(buf, LAT_TX_DEVICE);
+            LatencyRecord(buf, LAT_TX_SEND, LAT_TX_DEVICE);
+        }
+    }
+
+    // Publish all entries posted since the last kick with one index update
+    __asm__ volatile("" ::: "memory");
+    vq->avail->idx = newIdx;
+    vq->notifiedIdx = newIdx;
+    __asm__ volatile("mfence" ::: "memory");
+
+    // Only notify when the device asked to hear about one of the new entries
+    bool notify;
+    if (dev->features & FEATURE(VIRTIO_RING_F_EVENT_IDX))
+    {
+        u16 event = *VirtqAvailEvent(vq);
+        notify = (u16)(newIdx - event - 1) < (u16)(newIdx - oldIdx);
+    }
+    else
+    {
+        notify = !(vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+    }
+
+    if (notify)
+    {
+        *vq->notifyAddr = vq->index;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthVirtioRxFill(EthVirtioDevice *dev)
+{
+    Virtqueue *vq = &dev->rxQueue;
+
+    // The header lands in the headroom immediately before the packet data
+    while (vq->freeCount)
+    {
+        NetBuf *buf = NetAllocBufSize(dev->rxBufSize);
+        u8 *addr = buf->start - sizeof(VirtioNetHeader);
+        uint len = buf->size + sizeof(VirtioNetHeader);
+
+        VirtqPost(vq, buf, addr, len, VIRTQ_DESC_F_WRITE);
+    }
+
+    VirtqKick(dev, vq);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthVirtioTxReap(EthVirtioDevice *dev)
+{
+    Virtqueue *vq = &dev->txQueue;
+
+    uint len;
+    NetBuf *buf;
+    while ((buf = VirtqTakeUsed(vq, &len)))
+    {
+        NetReleaseBuf(buf);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthVirtioRecv(NetIntf *intf, NetBuf *buf)
+{
+    EthVirtioDevice *dev = intf->dev;
+
+    // Receive paths expect contiguous packets
+    buf = NetLinearizeBuf(buf);
+    if (!buf)
+    {
+        NetIntfDrop(intf, NET_DROP_NO_BUF);
+        return;
+    }
+
+    ++dev->rxPackets;
+
+    if (XdpRecv(intf, buf))
+    {
+        CaptureTap(intf, buf);
+        LatencyStartRx(buf);
+        GroRecv(intf, buf);
+    }
+
+    NetReleaseBuf(buf);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthVirtioPoll(NetIntf *intf)
+{
+    EthVirtioDevice *dev = intf->dev;
+    Virtqueue *vq = &dev->rxQueue;
+
+    for (uint budget = RX_POLL_BUDGET; budget; --budget)
+    {
+        uint len;
+        NetBuf *buf = VirtqTakeUsed(vq, &len);
+        if (!buf)
+        {
+            break;
+        }
+
+        if (dev->rxChain)
+        {
+            // Continuation buffers carry no header, data fills the whole descriptor
+            buf->start -= sizeof(VirtioNetHeader);
+            buf->end = buf->start + len;
+            NetAppendBuf(dev->rxChain, buf);
+
+            if (!--dev->rxChainLeft)
+            {
+                buf = dev->rxChain;
+                dev->rxChain = 0;
+                EthVirtioRecv(intf, buf);
+            }
+
+            continue;
+        }
+
+        if (len < sizeof(VirtioNetHeader))
+        {
+            NetIntfDrop(intf, NET_DROP_HEADER);
+            NetReleaseBuf(buf);
+            continue;
+        }
+
+        const VirtioNetHeader *hdr = (const VirtioNetHeader *)(buf->start - sizeof(VirtioNetHeader));
+
+        buf->end = buf->start + len - sizeof(VirtioNetHeader);
+
+        // Partial checksums come from the host itself and need no verification
+        buf->csumFlags = 0;
+        if (hdr->flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM))
+        {
+            buf->csumFlags = NET_CSUM_L4_VALID;
+        }
+
+        // With mergeable buffers the rest of the packet follows in the next used entries
+        uint numBuffers = 1;
+        if (dev->features & FEATURE(VIRTIO_NET_F_MRG_RXBUF) && hdr->numBuffers > 1)
+        {
+            numBuffers = hdr->numBuffers;
+        }
+
+        if (numBuffers > 1)
+        {
+            dev->rxChain = buf;
+            dev->rxChainLeft = numBuffers - 1;
+            continue;
+        }
+
+        EthVirtioRecv(intf, buf);
+    }
+
+    // Deliver segments coalesced during this burst
+    GroFlush();
+
+    // Replace consumed buffers with a single notification
+    EthVirtioRxFill(dev);
+
+    // Transmit packets sent since the last poll, including replies generated above
+    EthVirtioTxReap(dev);
+    VirtqKick(dev, &dev->txQueue);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void EthVirtioSend(NetIntf *intf, NetBuf *buf)
+{
+    EthVirtioDevice *dev = intf->dev;
+    Virtqueue *vq = &dev->txQueue;
+
+    CaptureTap(intf, buf);
+
+    if (!vq->freeCount)
+    {
+        EthVirtioTxReap(dev);
+
+        if (!vq->freeCount)
+        {
+            NetIntfDrop(intf, NET_DROP_RING_FULL);
+            NetReleaseBuf(buf);
+            return;
+        }
+    }
+
+    // Header and packet share one descriptor
+    VirtioNetHeader *hdr = (VirtioNetHeader *)(buf->start - sizeof(VirtioNetHeader));
+    memset(hdr, 0, sizeof(VirtioNetHeader));
+    hdr->gsoType = VIRTIO_NET_HDR_GSO_NONE;
+
+    if (buf->csumFlags & NET_CSUM_PARTIAL)
+    {
+        hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr->csumStart = buf->csumStart - buf->start;
+        hdr->csumOffset = buf->csumOffset;
+    }
+
+    if (buf->gsoSize)
+    {
+        // The device segments; the header length covers Ethernet, IPv4 and TCP
+        const TcpHeader *tcpHdr = (const TcpHeader *)buf->csumStart;
+
+        hdr->gsoType = VIRTIO_NET_HDR_GSO_TCPV4;
+        hdr->hdrLen = hdr->csumStart + (tcpHdr->off >> 2);
+        hdr->gsoSize = buf->gsoSize;
+    }
+
+    buf->start -= sizeof(VirtioNetHeader);
+
+    VirtqPost(vq, buf, buf->start, buf->end - buf->start, 0);
+    ++dev->txPackets;
+
+    // Notify once a batch has built up rather than per packet
+    if ((u16)(vq->availIdx - vq->notifiedIdx) >= TX_BATCH_SIZE)
+    {
+        VirtqKick(dev, vq);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static bool EthVirtioSetMtu(NetIntf *intf, uint mtu)
+{
+    EthVirtioDevice *dev = intf->dev;
+
+    if (mtu > ETH_MAX_MTU)
+    {
+        return false;
+    }
+
+    // Buffers already posted keep their size and are replaced as they are used
+    dev->rxBufSize = mtu + ETH_FRAME_OVERHEAD;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+void EthVirtioInit(uint id, PciDeviceInfo *info)
+{
+    // Check device supported.
+    if (info->vendorId != 0x1af4)
+    {
+        return;
+    }
+
+    if (!(info->deviceId == 0x1041 || info->deviceId == 0x1000))
+    {
+        return;
+    }
+
+    ConsolePrint("Initializing Virtio Network\n");
+
+    EthVirtioDevice *dev = VMAlloc(sizeof(EthVirtioDevice));
+    memset(dev, 0, sizeof(EthVirtioDevice));
+    if (!VirtioFindCaps(dev, id))
+    {
+        // Only the modern interface is supported
+        return;
+    }
+
+    VirtioCommonCfg *common = dev->common;
+
+    // Reset and announce the driver
+    common->deviceStatus = 0;
+    while (common->deviceStatus)
+    {
+    }
+
+    common->deviceStatus = STATUS_ACKNOWLEDGE;
+    common->deviceStatus |= STATUS_DRIVER;
+
+    // Feature negotiation
+    common->deviceFeatureSelect = 0;
+    u64 features = common->deviceFeature;
+    common->deviceFeatureSelect = 1;
+    features |= (u64)common->deviceFeature << 32;
+
+    features &= DRIVER_FEATURES;
+
+    // Segmentation depends on checksum offload
+    if (~features & FEATURE(VIRTIO_NET_F_CSUM))
+    {
+        features &= ~FEATURE(VIRTIO_NET_F_HOST_TSO4);
+    }
+    if (!(features & FEATURE(VIRTIO_F_VERSION_1)))
+    {
+        common->deviceStatus = STATUS_FAILED;
+        return;
+    }
+
+    common->driverFeatureSelect = 0;
+    common->driverFeature = (u32)features;
+    common->driverFeatureSelect = 1;
+    common->driverFeature = (u32)(features >> 32);
+
+    common->deviceStatus |= STATUS_FEATURES_OK;
+    if (~common->deviceStatus & STATUS_FEATURES_OK)
+    {
+        common->deviceStatus = STATUS_FAILED;
+        return;
+    }
+
+    dev->features = features;
+
+    // Queues
+    if (!VirtqInit(dev, &dev->rxQueue, QUEUE_RX) || !VirtqInit(dev, &dev->txQueue, QUEUE_TX))
+    {
+        common->deviceStatus = STATUS_FAILED;
+        return;
+    }
+
+    // Without interrupts, never ask the device for used buffer notifications
+    if (features & FEATURE(VIRTIO_RING_F_EVENT_IDX))
+    {
+        *VirtqUsedEvent(&dev->rxQueue) = 0xffff;
+        *VirtqUsedEvent(&dev->txQueue) = 0xffff;
+    }
+
+    // MAC address, the configuration field is only valid when offered
+    EthAddr localAddr = { { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00 } };
+    if (features & FEATURE(VIRTIO_NET_F_MAC))
+    {
+        for (uint i = 0; i < sizeof(EthAddr); ++i)
+        {
+            localAddr.n[i] = dev->config->mac[i];
+        }
+    }
+    else
+    {
+        // Locally administered address derived from the PCI location
+        localAddr.n[4] = id >> 16;
+        localAddr.n[5] = id >> 8;
+    }
+
+    char macStr[ETH_ADDR_STRING_SIZE];
+    EthAddrToStr(macStr, sizeof(macStr), &localAddr);
+
+    EthIntfName(dev->name, sizeof(dev->name));
+    ConsolePrint("%s MAC = %s\n", dev->name, macStr);
+
+    common->deviceStatus |= STATUS_DRIVER_OK;
+
+    dev->rxBufSize = NET_DEFAULT_MTU + ETH_FRAME_OVERHEAD;
+
+    EthVirtioRxFill(dev);
+
+    // Create net interface
+    NetIntf *intf = NetIntfCreate();
+    intf->ethAddr = localAddr;
+    intf->ipAddr = g_nullIpv4Addr;
+    intf->name = dev->name;
+    intf->dev = dev;
+    intf->caps = NET_INTF_GSO;
+    if (features & FEATURE(VIRTIO_NET_F_CSUM))
+    {
+        intf->caps |= NET_INTF_TX_CSUM;
+    }
+
+    if (features & FEATURE(VIRTIO_NET_F_HOST_TSO4))
+    {
+        intf->caps |= NET_INTF_TSO;
+    }
+    intf->poll = EthVirtioPoll;
+    intf->send = EthSendIntf;
+    intf->devSend = EthVirtioSend;
+    intf->setMtu = EthVirtioSetMtu;
+
+    NetIntfAdd(intf);
+}
@@ -0,0 +1,9 @@
+// ------------------------------------------------------------------------------------------------
+// net/virtio.h
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "pci/driver.h"
+
+void EthVirtioInit(uint id, PciDeviceInfo *info);
@@ -0,0 +1,274 @@
+// ------------------------------------------------------------------------------------------------
+// net/xdp.c
+// ------------------------------------------------------------------------------------------------
+
+#include "net/xdp.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/icmp.h"
+#include "net/swap.h"
+#include "console/console.h"
+#include "stdlib/string.h"
+
+// ------------------------------------------------------------------------------------------------
+// Drop Filters
+
+typedef struct XdpFilter
+{
+    NetIntf *intf;                      // 0 if the slot is free
+    BpfInsn prog[BPF_COMPILE_MAX];
+    uint count;
+} XdpFilter;
+
+static XdpFilter s_filters[XDP_MAX_FILTERS];
+
+// ------------------------------------------------------------------------------------------------
+// Globals
+
+static u64 s_verdicts[XDP_VERDICT_COUNT];
+
+static const char *s_verdictNames[XDP_VERDICT_COUNT] =
+{
+    "drop",
+    "pass",
+    "tx",
+    "redirect",
+};
+
+// ------------------------------------------------------------------------------------------------
+void XdpAttach(NetIntf *intf, uint (*hook)(NetIntf *intf, NetBuf *buf, NetIntf **target), void *ctx)
+{
+    XdpDetach(intf);
+
+    intf->rxHookCtx = ctx;
+    intf->rxHook = hook;
+}
+
+// ------------------------------------------------------------------------------------------------
+void XdpDetach(NetIntf *intf)
+{
+    intf->rxHook = 0;
+    intf->rxHookCtx = 0;
+
+    for (uint i = 0; i < XDP_MAX_FILTERS; ++i)
+    {
+        if (s_filters[i].intf == intf)
+        {
+            s_filters[i].intf = 0;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+static uint XdpFilterHook(NetIntf *intf, NetBuf *buf, NetIntf **target)
+{
+    const XdpFilter *filter = intf->rxHookCtx;
+    uint len = buf->end - buf->start;
+
+    return BpfRun(filter->prog, buf->start, len, len) ? XDP_DROP : XDP_PASS;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool XdpAttachFilter(NetIntf *intf, const BpfInsn *prog, uint count)
+{
+    if (count > BPF_COMPILE_MAX || !BpfValidate(prog, count))
+    {
+        return false;
+    }
+
+    // Find a slot before touching the current hook, reusing the interface's own filter slot
+    XdpFilter *filter = 0;
+    for (uint i = 0; i < XDP_MAX_FILTERS; ++i)
+    {
+        if (s_filters[i].intf == intf)
+        {
+            filter = &s_filters[i];
+            break;
+        }
+
+        if (!filter && !s_filters[i].intf)
+        {
+            filter = &s_filters[i];
+        }
+    }
+
+    if (!filter)
+    {
+        return false;
+    }
+
+    // Attaching detaches the previous hook and frees its slot, so claim the slot after
+    XdpAttach(intf, XdpFilterHook, filter);
+
+    memcpy(filter->prog, prog, count * sizeof(BpfInsn));
+    filter->count = count;
+    filter->intf = intf;
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+static uint XdpEchoHook(NetIntf *intf, NetBuf *buf, NetIntf **target)
+{
+    // Only plain IPv4 echo requests addressed to us, everything else takes the normal path
+    u8 *frame = buf->start;
+    if (buf->end - frame < sizeof(EthHeader) + sizeof(Ipv4Header) + 8)
+    {
+        return XDP_PASS;
+    }
+
+    EthHeader *ethHdr = (EthHeader *)frame;
+    Ipv4Header *ipHdr = (Ipv4Header *)(ethHdr + 1);
+    u8 *icmp = (u8 *)(ipHdr + 1);
+
+    NetIntf *owner = intf->master ? intf->master : intf;
+    uint ipLen = NetSwap16(ipHdr->len);
+
+    if (ethHdr->etherType != NetSwap16(ET_IPV4) ||
+        ipHdr->verIhl != 0x45 ||
+        ipHdr->protocol != IP_PROTOCOL_ICMP ||
+        NetSwap16(ipHdr->offset) & 0x3fff ||
+        ipHdr->dst.u.bits != owner->ipAddr.u.bits ||
+        ipLen < sizeof(Ipv4Header) + 8 ||
+        sizeof(EthHeader) + ipLen > buf->end - frame ||
+        icmp[0] != ICMP_TYPE_ECHO_REQUEST || icmp[1] != 0)
+    {
+        return XDP_PASS;
+    }
+
+    // Turn the request around in place
+    EthAddr ethAddr = ethHdr->src;
+    ethHdr->src = owner->ethAddr;
+    ethHdr->dst = ethAddr;
+
+    ipHdr->dst = ipHdr->src;
+    ipHdr->src = owner->ipAddr;
+    ipHdr->ttl = 64;
+    ipHdr->checksum = 0;
+    ipHdr->checksum = NetChecksum((u8 *)ipHdr, icmp);
+
+    // Incremental update for the changed type (RFC 1624), keeping the sender's payload as is
+    u16 *word = (u16 *)icmp;
+    u16 *checksum = (u16 *)(icmp + 2);
+    uint sum = (u16)~*checksum + (u16)~*word;
+    icmp[0] = ICMP_TYPE_ECHO_REPLY;
+    sum += *word;
+    *checksum = NetChecksumFinal(sum);
+
+    // Drop Ethernet padding
+    buf->end = frame + sizeof(EthHeader) + ipLen;
+    return XDP_TX;
+}
+
+// ------------------------------------------------------------------------------------------------
+void XdpAttachEcho(NetIntf *intf)
+{
+    XdpAttach(intf, XdpEchoHook, 0);
+}
+
+// ------------------------------------------------------------------------------------------------
+static uint XdpRedirectHook(NetIntf *intf, NetBuf *buf, NetIntf **target)
+{
+    *target = intf->rxHookCtx;
+    return XDP_REDIRECT;
+}
+
+// ------------------------------------------------------------------------------------------------
+void XdpAttachRedirect(NetIntf *intf, NetIntf *target)
+{
+    XdpAttach(intf, XdpRedirectHook, target);
+}
+
+// ------------------------------------------------------------------------------------------------
+bool XdpRun(NetIntf *intf, NetBuf *buf)
+{
+    // A port without its own hook runs the aggregate's, which sees the aggregate as its
+    // interface; XDP_TX still answers out of the port the frame arrived on
+    NetIntf *owner = intf->master ? intf->master : intf;
+    NetIntf *hooked = intf->rxHook ? intf : owner;
+
+    NetIntf *target = intf;
+    uint verdict = hooked->rxHook(hooked, buf, &target);
+
+    if (verdict == XDP_PASS)
+    {
+        ++s_verdicts[XDP_PASS];
+        return true;
+    }
+
+    // The stack never sees the frame, so count it here as EthRecv would
+    ++owner->stats.rxPackets;
+    owner->stats.rxBytes += buf->end - buf->start;
+
+    if (verdict == XDP_TX)
+    {
+        target = intf;
+    }
+    else if (verdict != XDP_REDIRECT)
+    {
+        verdict = XDP_DROP;
+    }
+
+    if (verdict == XDP_DROP || !target || !target->devSend)
+    {
+        ++s_verdicts[XDP_DROP];
+        NetIntfDrop(owner, NET_DROP_HOOK);
+        return false;
+    }
+
+    if (buf->end - buf->start > target->mtu + ETH_FRAME_OVERHEAD)
+    {
+        ++s_verdicts[XDP_DROP];
+        NetIntfDrop(owner, NET_DROP_TOO_LONG);
+        return false;
+    }
+
+    // The device takes its own reference; the driver replaces the receive buffer once it sees
+    // the frame is still in use
+    ++s_verdicts[verdict];
+    ++buf->refCount;
+    buf->csumFlags = 0;
+    buf->gsoSize = 0;
+
+    ++target->stats.txPackets;
+    target->stats.txBytes += buf->end - buf->start;
+    target->devSend(target, buf);
+
+    return false;
+}
+
+// ------------------------------------------------------------------------------------------------
+void XdpPrint()
+{
+    NetIntf *intf;
+    ListForEach(intf, g_netIntfList, link)
+    {
+        if (!intf->rxHook)
+        {
+            continue;
+        }
+
+        if (intf->rxHook == XdpFilterHook)
+        {
+            const XdpFilter *filter = intf->rxHookCtx;
+            ConsolePrint("%-16s filter, %d insns\n", intf->name, filter->count);
+        }
+        else if (intf->rxHook == XdpEchoHook)
+        {
+            ConsolePrint("%-16s echo\n", intf->name);
+        }
+        else if (intf->rxHook == XdpRedirectHook)
+        {
+            const NetIntf *target = intf->rxHookCtx;
+            ConsolePrint("%-16s redirect to %s\n", intf->name, target->name);
+        }
+        else
+        {
+            ConsolePrint("%-16s custom\n", intf->name);
+        }
+    }
+
+    for (uint i = 0; i < XDP_VERDICT_COUNT; ++i)
+    {
+        ConsolePrint("%-16s %14llu\n", s_verdictNames[i], s_verdicts[i]);
+    }
+}
@@ -0,0 +1,44 @@
+// ------------------------------------------------------------------------------------------------
+// net/xdp.h
+// ------------------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "net/bpf.h"
+#include "net/intf.h"
+
+// ------------------------------------------------------------------------------------------------
+// Receive Hook Verdicts
+//
+// A hook sees each frame in the driver receive loop, Ethernet header first, before capture,
+// GRO or any protocol processing.  It may rewrite the frame in place, but does not own it.
+
+#define XDP_DROP                0           // Release the frame
+#define XDP_PASS                1           // Continue into the stack
+#define XDP_TX                  2           // Send back out of the receiving interface
+#define XDP_REDIRECT            3           // Send out of the interface stored in *target
+#define XDP_VERDICT_COUNT       4
+
+#define XDP_MAX_FILTERS         8           // Interfaces with a drop filter at one time
+
+// ------------------------------------------------------------------------------------------------
+// Functions
+
+void XdpAttach(NetIntf *intf, uint (*hook)(NetIntf *intf, NetBuf *buf, NetIntf **target), void *ctx);
+void XdpDetach(NetIntf *intf);
+
+// Built in hooks
+bool XdpAttachFilter(NetIntf *intf, const BpfInsn *prog, uint count);   // drop matching frames
+void XdpAttachEcho(NetIntf *intf);                                      // answer ICMP echo
+void XdpAttachRedirect(NetIntf *intf, NetIntf *target);                 // forward every frame
+
+bool XdpRun(NetIntf *intf, NetBuf *buf);
+void XdpPrint();
+
+// ------------------------------------------------------------------------------------------------
+static inline bool XdpRecv(NetIntf *intf, NetBuf *buf)
+{
+    // Returns true if the frame continues into the stack.  Drivers pass the port a frame
+    // arrived on, which runs the hook of its aggregate unless it has one of its own.
+    return (!intf->rxHook && !(intf->master && intf->master->rxHook)) || XdpRun(intf, buf);
+}
@@ -7,6 +7,7 @@
 
 #include "gfx/gfx.h"
 #include "net/intel.h"
+#include "net/virtio.h"
 #include "usb/ehci.h"
 #include "usb/uhci.h"
 
@@ -14,6 +15,7 @@
 const PciDriver g_pciDriverTable[] =
 {
     { EthIntelInit },
+    { EthVirtioInit },
     { UhciInit },
     { EhciInit },
     { GfxInit },
@@ -118,3 +120,141 @@ void PciGetBar(PciBar *bar, uint id, uint index)
         bar->flags = addressLow & 0xf;
     }
 }
+
+// ------------------------------------------------------------------------------------------------
+// MSI Capability
+
+#define MSI_CONTROL                     0x02
+#define MSI_ADDR_LOW                    0x04
+#define MSI_ADDR_HIGH                   0x08
+#define MSI_DATA_32                     0x08
+#define MSI_DATA_64                     0x0c
+
+#define MSI_CONTROL_ENABLE              (1 << 0)
+#define MSI_CONTROL_MME_MASK            (7 << 4)    // Multiple Message Enable
+#define MSI_CONTROL_64                  (1 << 7)    // 64-bit Address Capable
+
+#define MSI_ADDR_BASE                   0xfee00000
+#define MSI_ADDR_DEST_SHIFT             12
+
+// ------------------------------------------------------------------------------------------------
+// MSI-X Capability
+
+#define MSIX_CONTROL                    0x02
+#define MSIX_TABLE                      0x04
+
+#define MSIX_CONTROL_SIZE_MASK          0x07ff      // Table Size - 1
+#define MSIX_CONTROL_MASK_ALL           (1 << 14)   // Function Mask
+#define MSIX_CONTROL_ENABLE             (1 << 15)
+
+#define MSIX_TABLE_BIR_MASK             0x7
+
+// Table Entry
+#define MSIX_ENTRY_SIZE                 16
+#define MSIX_ENTRY_ADDR_LOW             0x00
+#define MSIX_ENTRY_ADDR_HIGH            0x04
+#define MSIX_ENTRY_DATA                 0x08
+#define MSIX_ENTRY_CONTROL              0x0c
+#define MSIX_ENTRY_MASKED               (1 << 0)
+
+// ------------------------------------------------------------------------------------------------
+uint PciFindCapability(uint id, uint capId)
+{
+    if (~PciRead16(id, PCI_CONFIG_STATUS) & PCI_STATUS_CAP_LIST)
+    {
+        return 0;
+    }
+
+    // Walk capability list, bounded in case of a malformed chain
+    uint offset = PciRead8(id, PCI_CONFIG_CAPABILITIES) & ~0x3;
+    for (uint i = 0; offset && i < 48; ++i)
+    {
+        if (PciRead8(id, offset) == capId)
+        {
+            return offset;
+        }
+
+        offset = PciRead8(id, offset + 1) & ~0x3;
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool PciEnableMsi(uint id, uint vector, uint apicId)
+{
+    uint cap = PciFindCapability(id, PCI_CAP_MSI);
+    if (!cap)
+    {
+        return false;
+    }
+
+    u16 control = PciRead16(id, cap + MSI_CONTROL);
+
+    // Single message, fixed delivery, edge triggered
+    PciWrite32(id, cap + MSI_ADDR_LOW, MSI_ADDR_BASE | (apicId << MSI_ADDR_DEST_SHIFT));
+    if (control & MSI_CONTROL_64)
+    {
+        PciWrite32(id, cap + MSI_ADDR_HIGH, 0);
+        PciWrite16(id, cap + MSI_DATA_64, vector);
+    }
+    else
+    {
+        PciWrite16(id, cap + MSI_DATA_32, vector);
+    }
+
+    control &= ~MSI_CONTROL_MME_MASK;
+    control |= MSI_CONTROL_ENABLE;
+    PciWrite16(id, cap + MSI_CONTROL, control);
+
+    // Legacy interrupt pin is no longer needed
+    PciWrite16(id, PCI_CONFIG_COMMAND, PciRead16(id, PCI_CONFIG_COMMAND) | PCI_COMMAND_INTX_DISABLE);
+
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+bool PciEnableMsix(uint id, uint count, const uint *vectors, const uint *apicIds)
+{
+    uint cap = PciFindCapability(id, PCI_CAP_MSIX);
+    if (!cap)
+    {
+        return false;
+    }
+
+    u16 control = PciRead16(id, cap + MSIX_CONTROL);
+    if ((control & MSIX_CONTROL_SIZE_MASK) + 1 < count)
+    {
+        return false;
+    }
+
+    // Locate vector table within the BAR
+    u32 table = PciRead32(id, cap + MSIX_TABLE);
+
+    PciBar bar;
+    PciGetBar(&bar, id, table & MSIX_TABLE_BIR_MASK);
+    if (bar.flags & PCI_BAR_IO)
+    {
+        return false;
+    }
+
+    u8 *entry = (u8 *)bar.u.address + (table & ~MSIX_TABLE_BIR_MASK);
+
+    // Enable with all vectors masked while the table is written
+    PciWrite16(id, cap + MSIX_CONTROL, control | MSIX_CONTROL_ENABLE | MSIX_CONTROL_MASK_ALL);
+
+    for (uint i = 0; i < count; ++i, entry += MSIX_ENTRY_SIZE)
+    {
+        MmioWrite32(entry + MSIX_ENTRY_ADDR_LOW, MSI_ADDR_BASE | (apicIds[i] << MSI_ADDR_DEST_SHIFT));
+        MmioWrite32(entry + MSIX_ENTRY_ADDR_HIGH, 0);
+        MmioWrite32(entry + MSIX_ENTRY_DATA, vectors[i]);
+        MmioWrite32(entry + MSIX_ENTRY_CONTROL, 0);
+    }
+
+    PciWrite16(id, cap + MSIX_CONTROL, (control | MSIX_CONTROL_ENABLE) & ~MSIX_CONTROL_MASK_ALL);
+
+    // Legacy interrupt pin is no longer needed
+    PciWrite16(id, PCI_CONFIG_COMMAND, PciRead16(id, PCI_CONFIG_COMMAND) | PCI_COMMAND_INTX_DISABLE);
+
+    return true;
+}
@@ -50,6 +50,16 @@
 #define PCI_CONFIG_MIN_GRANT            0x3e
 #define PCI_CONFIG_MAX_LATENCY          0x3f
 
+// PCI Command Register
+#define PCI_COMMAND_INTX_DISABLE        (1 << 10)
+
+// PCI Status Register
+#define PCI_STATUS_CAP_LIST             (1 << 4)
+
+// Capability IDs
+#define PCI_CAP_MSI                     0x05
+#define PCI_CAP_MSIX                    0x11
+
 // ------------------------------------------------------------------------------------------------
 // PCI BAR
 
@@ -96,3 +106,7 @@ void PciWrite16(uint id, uint reg, u16 data);
 void PciWrite32(uint id, uint reg, u32 data);
 
 void PciGetBar(PciBar *bar, uint id, uint index);
+
+uint PciFindCapability(uint id, uint capId);
+bool PciEnableMsi(uint id, uint vector, uint apicId);
+bool PciEnableMsix(uint id, uint count, const uint *vectors, const uint *apicIds);
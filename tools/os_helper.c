@@ -3,16 +3,27 @@
 // ------------------------------------------------------------------------------------------------
 
 #include <netdb.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/select.h>
 
 // ------------------------------------------------------------------------------------------------
 #define PORT 4950
+#define CAPTURE_PORT 4951
 #define MAXBUFLEN 2048
 
+// Capture stream datagrams - see net/capture.h
+#define CAPTURE_MAGIC 0x70616343
+#define CAPTURE_HEADER_SIZE 8
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_SNAPLEN 65535
+#define PCAP_LINKTYPE_ETHERNET 1
+
 // ------------------------------------------------------------------------------------------------
 static void SockAddrToStr(char *buf, size_t len, struct sockaddr *sa)
 {
@@ -25,17 +36,16 @@ static void SockAddrToStr(char *buf, size_t len, struct sockaddr *sa)
 }
 
 // ------------------------------------------------------------------------------------------------
-int main(void)
+static int OpenSocket(int port)
 {
-    struct sockaddr_storage storage;
-    struct sockaddr *addr = (struct sockaddr *)&storage;
+    struct sockaddr_in addr;
 
     // Create socket
     int sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (sockfd == -1)
     {
         perror("Failed to create socket");
-        return EXIT_FAILURE;
+        exit(EXIT_FAILURE);
     }
 
     // Enable broadcast
@@ -43,43 +53,185 @@ int main(void)
     if (setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST, &val, sizeof(val)))
     {
         perror("Failed to enable broadcast");
-        return EXIT_FAILURE;
+        exit(EXIT_FAILURE);
     }
 
     // Bind
-    struct sockaddr_in *ipv4_addr = (struct sockaddr_in *)addr;
-    ipv4_addr->sin_family = AF_INET;
-    ipv4_addr->sin_port = htons(PORT);
-    ipv4_addr->sin_addr.s_addr = 0;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = 0;
 
-    if (bind(sockfd, addr, sizeof(struct sockaddr_in)) == -1)
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1)
     {
         perror("Failed to bind socket");
+        exit(EXIT_FAILURE);
+    }
+
+    return sockfd;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void PutLe16(uint8_t *p, uint16_t x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void PutLe32(uint8_t *p, uint32_t x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+    p[2] = x >> 16;
+    p[3] = x >> 24;
+}
+
+// ------------------------------------------------------------------------------------------------
+static uint32_t GetLe32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// ------------------------------------------------------------------------------------------------
+static FILE *PcapOpen(const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    // Records from the kernel are little endian, so the file is too
+    uint8_t hdr[24];
+    PutLe32(hdr + 0, PCAP_MAGIC);
+    PutLe16(hdr + 4, 2);
+    PutLe16(hdr + 6, 4);
+    PutLe32(hdr + 8, 0);
+    PutLe32(hdr + 12, 0);
+    PutLe32(hdr + 16, PCAP_SNAPLEN);
+    PutLe32(hdr + 20, PCAP_LINKTYPE_ETHERNET);
+
+    fwrite(hdr, sizeof(hdr), 1, fp);
+    fflush(fp);
+    return fp;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void RecvLog(int sockfd)
+{
+    struct sockaddr_storage storage;
+    struct sockaddr *addr = (struct sockaddr *)&storage;
+    char buf[MAXBUFLEN];
+
+    socklen_t addr_len = sizeof(storage);
+    int rx_count = recvfrom(sockfd, buf, MAXBUFLEN - 1, 0, addr, &addr_len);
+    if (rx_count == -1)
+    {
+        perror("recvfrom");
+        exit(EXIT_FAILURE);
+    }
+
+    buf[rx_count] = '\0';
+
+    char addrStr[INET6_ADDRSTRLEN];
+    SockAddrToStr(addrStr, sizeof(addrStr), addr);
+
+    printf("%s", buf);
+}
+
+// ------------------------------------------------------------------------------------------------
+static void RecvCapture(int sockfd, FILE *fp)
+{
+    static uint32_t nextSeq;
+    static int started;
+
+    uint8_t buf[MAXBUFLEN];
+
+    int rx_count = recv(sockfd, buf, MAXBUFLEN, 0);
+    if (rx_count == -1)
+    {
+        perror("recv");
+        exit(EXIT_FAILURE);
+    }
+
+    if (rx_count < CAPTURE_HEADER_SIZE || GetLe32(buf) != CAPTURE_MAGIC)
+    {
+        return;
+    }
+
+    uint32_t seq = GetLe32(buf + 4);
+    if (started && seq != nextSeq)
+    {
+        fprintf(stderr, "Capture: %u datagrams lost\n", seq - nextSeq);
+    }
+
+    started = 1;
+    nextSeq = seq + 1;
+
+    // The payload is a run of pcap records
+    fwrite(buf + CAPTURE_HEADER_SIZE, rx_count - CAPTURE_HEADER_SIZE, 1, fp);
+    fflush(fp);
+}
+
+// ------------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+    const char *capturePath = 0;
+
+    if (argc == 3 && strcmp(argv[1], "-w") == 0)
+    {
+        capturePath = argv[2];
+    }
+    else if (argc != 1)
+    {
+        fprintf(stderr, "Usage: os_helper [-w capture.pcap]\n");
         return EXIT_FAILURE;
     }
 
+    int logfd = OpenSocket(PORT);
+    int capturefd = -1;
+    FILE *captureFile = 0;
+
+    if (capturePath)
+    {
+        capturefd = OpenSocket(CAPTURE_PORT);
+        captureFile = PcapOpen(capturePath);
+    }
+
     // Listen for data
     printf("OS Helper ready\n");
 
     for (;;)
     {
-        char buf[MAXBUFLEN];
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(logfd, &fds);
+        if (capturefd != -1)
+        {
+            FD_SET(capturefd, &fds);
+        }
 
-        socklen_t addr_len = sizeof(storage);
-        int rx_count = recvfrom(sockfd, buf, MAXBUFLEN , 0, addr, &addr_len);
-        if (rx_count == -1)
+        int maxfd = logfd > capturefd ? logfd : capturefd;
+        if (select(maxfd + 1, &fds, 0, 0, 0) == -1)
         {
-            perror("recvfrom");
+            perror("select");
             exit(EXIT_FAILURE);
         }
 
-        char addrStr[INET6_ADDRSTRLEN];
-        SockAddrToStr(addrStr, sizeof(addrStr), addr);
+        if (FD_ISSET(logfd, &fds))
+        {
+            RecvLog(logfd);
+        }
 
-        printf("%s", buf);
+        if (capturefd != -1 && FD_ISSET(capturefd, &fds))
+        {
+            RecvCapture(capturefd, captureFile);
+        }
     }
 
-    close(sockfd);
+    close(logfd);
 
     return EXIT_SUCCESS;
 }